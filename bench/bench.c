@@ -0,0 +1,645 @@
+/*
+
+Front end benchmarks. Times five phases separately on each corpus:
+
+    lex       Lexer_next over the whole source, one token at a time
+    parse     parse_program over a pre-tokenized buffer (nodes from malloc)
+    teardown  free_ast on the tree parse_program built
+    fold      fold_constants on that tree
+    codegen   resolve_names and codegen_c on the folded tree, into memory
+
+and the arena variant of parse and teardown (parse into an arena, arena_free).
+Every phase runs --runs times; the table shows the median, minimum and
+mean ± standard deviation, and throughput computed from the median.
+
+    bin/bench [--kind name|all] [--size MB] [--runs N] [--seed N] [file.sr...]
+    bin/bench --generate kind [--size MB] [--seed N] > corpus.sr
+    bin/bench --vm [--iterations N] [--runs N] [--cc]
+    bin/bench --scan [--kind name|all] [--size MB] [--runs N] [--seed N] [file.sr...]
+
+--vm times loop-heavy programs on the bytecode VM (serrate --run) and
+the JIT (serrate --jit) instead, reporting loop iterations per second,
+with bytecode lowered straight from the tree and (the "+ ir" rows)
+through the optimizing SSA IR; --cc adds the time to generate C, build
+it with cc and run it.
+
+--scan checks the SIMD byte-run scanners (see lexer_simd.h) against the
+scalar ones instead: every scanner of every level this CPU runs is
+started at every byte of every corpus, plus a buffer of random bytes, and
+must stop where the scalar one does. Any difference is reported and makes
+the exit status 1. Then each level's throughput walking the whole corpus
+is timed.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "arena.h"
+#include "ast.h"
+#include "codegen.h"
+#include "fold.h"
+#include "intern.h"
+#include "ir.h"
+#include "jit.h"
+#include "lexer.h"
+#include "lexer_simd.h"
+#include "parser.h"
+#include "symbols.h"
+#include "vm.h"
+
+#define DEFAULT_SIZE_MB 8
+#define DEFAULT_RUNS    10
+#define DEFAULT_ITERATIONS 10000000
+
+typedef struct Sample {
+    double* seconds;
+    int runs;
+} Sample;
+
+typedef struct Corpus {
+    const char* name;
+    char* text;
+    size_t size;
+} Corpus;
+
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/*
+    Statistics
+*/
+typedef struct Summary {
+    double median, min, mean, deviation;
+} Summary;
+
+static Summary summarize(Sample* sample) {
+    Summary summary = { 0 };
+    qsort(sample->seconds, sample->runs, sizeof(double), compare_doubles);
+
+    int n = sample->runs;
+    summary.min = sample->seconds[0];
+    summary.median = n % 2 ? sample->seconds[n / 2] : (sample->seconds[n / 2 - 1] + sample->seconds[n / 2]) / 2;
+
+    for (int i = 0; i < n; i++) summary.mean += sample->seconds[i];
+    summary.mean /= n;
+    for (int i = 0; i < n; i++) summary.deviation += (sample->seconds[i] - summary.mean) * (sample->seconds[i] - summary.mean);
+    summary.deviation = n > 1 ? sqrt(summary.deviation / (n - 1)) : 0;
+    return summary;
+}
+
+// One row of the results table. `items` / `unit` give the second throughput column (0 for none).
+static void report(const Corpus* corpus, const char* phase, Sample* sample, double items, const char* unit) {
+    Summary s = summarize(sample);
+    printf("%-10s %-16s %9.3f %9.3f %9.3f ± %-7.3f %9.1f MB/s",
+        corpus->name, phase, s.median * 1e3, s.min * 1e3, s.mean * 1e3, s.deviation * 1e3,
+        corpus->size / s.median / 1e6);
+    if (items > 0) printf("  %9.2f M%s/s", items / s.median / 1e6, unit);
+    printf("\n");
+}
+
+
+/*
+    Phases
+*/
+static void bench_corpus(const Corpus* corpus, int runs) {
+    Sample lex = { calloc(runs, sizeof(double)), runs };
+    Sample parse = { calloc(runs, sizeof(double)), runs };
+    Sample teardown = { calloc(runs, sizeof(double)), runs };
+    Sample fold = { calloc(runs, sizeof(double)), runs };
+    Sample codegen = { calloc(runs, sizeof(double)), runs };
+    Sample arena_parse = { calloc(runs, sizeof(double)), runs };
+    Sample arena_teardown = { calloc(runs, sizeof(double)), runs };
+    if (!lex.seconds || !parse.seconds || !teardown.seconds || !fold.seconds || !codegen.seconds || !arena_parse.seconds || !arena_teardown.seconds) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    size_t token_count = 0, node_count = 0;
+
+    for (int run = 0; run < runs; run++) {
+        // Lex, one token at a time
+        Lexer lexer;
+        Lexer_init(&lexer, corpus->text);
+        size_t count = 0;
+        double start = now();
+        for (;;) {
+            Token token = Lexer_next(&lexer);
+            count++;
+            if (token.type == TOKEN_EOF) break;
+        }
+        lex.seconds[run] = now() - start;
+        token_count = count;
+
+        // Parse from a buffer, so only the parser is timed
+        TokenBuffer tokens;
+        Lexer_init(&lexer, corpus->text);
+        Lexer_tokenize_all(&lexer, &tokens);
+
+        Parser parser;
+        ast_use_arena(NULL);
+        *ast_stats() = (AstStats){ 0 };
+        parser_init_tokens(&parser, &tokens, 0, tokens.count);
+        start = now();
+        Node* root = parse_program(&parser);
+        parse.seconds[run] = now() - start;
+        node_count = ast_stats()->node_allocations;
+        parser_free(&parser);
+
+        FoldStats folded = { 0 };
+        start = now();
+        root = fold_constants(root, &folded);
+        fold.seconds[run] = now() - start;
+
+        Writer code;
+        writer_init(&code, NULL);
+        start = now();
+        resolve_names(root, stderr);
+        codegen_c(root, &code, stderr);
+        codegen.seconds[run] = now() - start;
+        writer_free(&code);
+
+        start = now();
+        free_ast(root);
+        teardown.seconds[run] = now() - start;
+
+        // Same again with an arena
+        Arena arena;
+        arena_init(&arena, 0);
+        ast_use_arena(&arena);
+        parser_init_tokens(&parser, &tokens, 0, tokens.count);
+        start = now();
+        parse_program(&parser);
+        arena_parse.seconds[run] = now() - start;
+        parser_free(&parser);
+        ast_use_arena(NULL);
+
+        start = now();
+        arena_free(&arena);
+        arena_teardown.seconds[run] = now() - start;
+
+        token_buffer_free(&tokens);
+    }
+
+    report(corpus, "lex", &lex, (double)token_count, "tokens");
+    report(corpus, "parse", &parse, (double)node_count, "nodes");
+    report(corpus, "teardown", &teardown, (double)node_count, "nodes");
+    report(corpus, "fold", &fold, (double)node_count, "nodes");
+    report(corpus, "codegen", &codegen, (double)node_count, "nodes");
+    report(corpus, "parse (arena)", &arena_parse, (double)node_count, "nodes");
+    report(corpus, "teardown (arena)", &arena_teardown, (double)node_count, "nodes");
+
+    free(lex.seconds);
+    free(parse.seconds);
+    free(teardown.seconds);
+    free(fold.seconds);
+    free(codegen.seconds);
+    free(arena_parse.seconds);
+    free(arena_teardown.seconds);
+}
+
+
+/*
+    Scanners. Each one, started at `p`, must stop exactly where the scalar
+    version does; the scalar ones are the reference.
+*/
+typedef const char* (*ScanFunction)(const char* p);
+
+static const char* scan_function_name(int function) {
+    static const char* names[] = { "skip_space", "skip_comment", "skip_identifier", "skip_digits" };
+    return names[function];
+}
+
+static ScanFunction scan_function(const LexerScanner* scanner, int function) {
+    switch (function) {
+        case 0: return scanner->skip_space;
+        case 1: return scanner->skip_comment;
+        case 2: return scanner->skip_identifier;
+        default: return scanner->skip_digits;
+    }
+}
+
+// Walk `text` the way the lexer does, handing every run to `scanner`
+static size_t scan_all(const LexerScanner* scanner, const char* text) {
+    size_t runs = 0;
+    const char* p = text;
+    while (*p) {
+        unsigned char c = (unsigned char)*p;
+        if (c == ' ' || (c >= '\t' && c <= '\r')) p = scanner->skip_space(p);
+        else if (c == '#') p = scanner->skip_comment(p);
+        else if (c >= '0' && c <= '9') p = scanner->skip_digits(p);
+        else if (c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) p = scanner->skip_identifier(p);
+        else p++;
+        runs++;
+    }
+    return runs;
+}
+
+// Compare every level against scalar from every byte of `corpus`. Returns the number of mismatches.
+static int check_scanners(const Corpus* corpus, int runs) {
+    const LexerScanner* scalar = lexer_scanner(LEXER_SCAN_SCALAR);
+    int mismatches = 0;
+    size_t run_count = 0;
+
+    for (int level = LEXER_SCAN_SCALAR; level <= (int)lexer_best_scan_level(); level++) {
+        const LexerScanner* scanner = lexer_scanner((LexerScanLevel)level);
+        for (int function = 0; function < 4 && level != LEXER_SCAN_SCALAR; function++) {
+            ScanFunction reference = scan_function(scalar, function), tested = scan_function(scanner, function);
+            for (size_t at = 0; at <= corpus->size; at++) {
+                const char* expected = reference(corpus->text + at);
+                const char* got = tested(corpus->text + at);
+                if (got == expected) continue;
+                if (mismatches++ < 10)
+                    fprintf(stderr, "%s: %s %s from byte %zu stopped at %zu, scalar at %zu\n", corpus->name,
+                        scanner->name, scan_function_name(function), at,
+                        (size_t)(got - corpus->text), (size_t)(expected - corpus->text));
+            }
+        }
+
+        Sample scan = { calloc(runs, sizeof(double)), runs };
+        if (!scan.seconds) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int run = 0; run < runs; run++) {
+            double start = now();
+            run_count = scan_all(scanner, corpus->text);
+            scan.seconds[run] = now() - start;
+        }
+        char phase[32];
+        snprintf(phase, sizeof(phase), "scan (%s)", scanner->name);
+        report(corpus, phase, &scan, (double)run_count, "runs");
+        free(scan.seconds);
+    }
+    return mismatches;
+}
+
+// Bytes of every value but '\0', in runs, to catch scanners that treat high bytes as signed
+static Corpus random_bytes(size_t size, uint64_t seed) {
+    Corpus corpus = { "bytes", malloc(size + 1), size };
+    if (!corpus.text) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+    unsigned char c = 'a';
+    for (size_t i = 0; i < size; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        if (state % 8 == 0) c = (unsigned char)(1 + (state >> 8) % 255);
+        corpus.text[i] = (char)c;
+    }
+    corpus.text[size] = '\0';
+    return corpus;
+}
+
+
+/*
+    VM Programs. `%ld` in the source is replaced by the iteration count
+    divided by `inner`, the iterations of the innermost loop per count.
+*/
+typedef struct LoopProgram {
+    const char* name;
+    long inner;
+    const char* source;
+} LoopProgram;
+
+static const LoopProgram loop_programs[] = {
+    { "globals", 1,
+        "let i = 0\n"
+        "let s = 0\n"
+        "while %ld - i\n"
+        "  let s = s + i * 3\n"
+        "  let i = i + 1\n"
+        "end\n"
+        "return s\n" },
+    { "locals", 1,
+        "func main():\n"
+        "  let i = 0\n"
+        "  let s = 0\n"
+        "  while %ld - i\n"
+        "    let s = s + i * 3\n"
+        "    let i = i + 1\n"
+        "  end\n"
+        "  return s\n"
+        "end\n" },
+    { "nested", 1000,
+        "func main():\n"
+        "  let s = 0\n"
+        "  let i = 0\n"
+        "  while %ld - i\n"
+        "    let j = 0\n"
+        "    while 1000 - j\n"
+        "      let s = s + i - j\n"
+        "      let j = j + 1\n"
+        "    end\n"
+        "    let i = i + 1\n"
+        "  end\n"
+        "  return s\n"
+        "end\n" },
+    { "fib", 1,
+        "func main():\n"
+        "  let a = 0\n"
+        "  let b = 1\n"
+        "  let n = %ld\n"
+        "  while n\n"
+        "    let t = a + b\n"
+        "    let a = b\n"
+        "    let b = t\n"
+        "    let n = n - 1\n"
+        "  end\n"
+        "  return a\n"
+        "end\n" },
+    { "divide", 1,
+        "func main():\n"
+        "  let s = 0\n"
+        "  let i = 1\n"
+        "  while %ld - i\n"
+        "    let s = s + 1000000007 / i - i / 3\n"
+        "    if s / 1000000\n"
+        "      let s = s - 1000000\n"
+        "    end\n"
+        "    let i = i + 1\n"
+        "  end\n"
+        "  return s\n"
+        "end\n" },
+};
+
+static void report_loop(const LoopProgram* loop, const char* phase, Sample* sample, double iterations) {
+    Summary s = summarize(sample);
+    printf("%-10s %-16s %9.3f %9.3f %9.3f ± %-7.3f %9.1f M/s\n",
+        loop->name, phase, s.median * 1e3, s.min * 1e3, s.mean * 1e3, s.deviation * 1e3,
+        iterations / s.median / 1e6);
+}
+
+/*
+    Startup to result through C: generate it, build it with cc and run
+    it. Returns the exit status, or -1 if that didn't work.
+*/
+static int run_through_cc(const Node* root) {
+    char source[64], binary[64], command[256];
+    snprintf(source, sizeof(source), "/tmp/serrate-bench-%d.c", (int)getpid());
+    snprintf(binary, sizeof(binary), "/tmp/serrate-bench-%d", (int)getpid());
+
+    Writer code;
+    FILE* file = fopen(source, "w");
+    if (!file) return -1;
+    writer_init(&code, file);
+    codegen_c(root, &code, stderr);
+    writer_free(&code);
+    fclose(file);
+
+    snprintf(command, sizeof(command), "cc -O2 -o %s %s && %s", binary, source, binary);
+    int status = system(command);
+    unlink(source);
+    unlink(binary);
+    return status == -1 || !WIFEXITED(status) ? -1 : WEXITSTATUS(status);
+}
+
+/*
+    Run `program` on the VM, then through the JIT (translation included,
+    since that is the latency --jit adds). Results must match `expected`,
+    unless `first` is set: then it's the VM's result.
+*/
+static void bench_bytecode(const LoopProgram* loop, const VmProgram* program, const char* suffix,
+                           Sample* vm, Sample* jit, long count, long* expected, int first) {
+    char phase[32];
+    long result = 0;
+    for (int run = 0; run < vm->runs; run++) {
+        double start = now();
+        if (vm_run(program, &result, stderr) != 0) exit(1);
+        vm->seconds[run] = now() - start;
+        if (first) *expected = result;
+        if (result != *expected) {
+            fprintf(stderr, "%s: the VM computed %ld%s, not %ld\n", loop->name, result, suffix, *expected);
+            exit(1);
+        }
+    }
+    snprintf(phase, sizeof(phase), "vm%s", suffix);
+    report_loop(loop, phase, vm, (double)count * loop->inner);
+
+    snprintf(phase, sizeof(phase), "jit%s", suffix);
+    for (int run = 0; run < jit->runs; run++) {
+        double start = now();
+        JitProgram code;
+        if (jit_compile(&code, program) != 0) {
+            printf("%-10s %-16s (not supported on this machine)\n", loop->name, phase);
+            return;
+        }
+        if (jit_run(&code, &result, stderr) != 0) exit(1);
+        jit->seconds[run] = now() - start;
+        jit_free(&code);
+
+        if (result != *expected) {
+            fprintf(stderr, "%s: the JIT computed %ld%s, the VM %ld\n", loop->name, result, suffix, *expected);
+            exit(1);
+        }
+    }
+    report_loop(loop, phase, jit, (double)count * loop->inner);
+}
+
+/*
+    Every program runs on bytecode lowered from the tree, then on bytecode
+    lowered through the IR, and with `cc` also through generated C. All
+    results must match the first.
+*/
+static void bench_vm(long iterations, int runs, int cc) {
+    Sample vm = { calloc(runs, sizeof(double)), runs };
+    Sample jit = { calloc(runs, sizeof(double)), runs };
+    Sample native = { calloc(runs, sizeof(double)), runs };
+    if (!vm.seconds || !jit.seconds || !native.seconds) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    printf("%-10s %-16s %9s %9s %9s   %-7s %14s\n", "program", "phase", "median ms", "min ms", "mean ms", "sd", "iterations");
+    for (size_t p = 0; p < sizeof(loop_programs) / sizeof(loop_programs[0]); p++) {
+        const LoopProgram* loop = &loop_programs[p];
+        long count = iterations / loop->inner;
+        char source[1024];
+        snprintf(source, sizeof(source), loop->source, count);
+
+        Arena arena;
+        arena_init(&arena, 0);
+        ast_use_arena(&arena);
+        TokenBuffer tokens;
+        Lexer lexer;
+        Lexer_init(&lexer, source);
+        Lexer_tokenize_all(&lexer, &tokens);
+        Parser parser;
+        parser_init_tokens(&parser, &tokens, 0, tokens.count);
+        FoldStats folded = { 0 };
+        Node* root = fold_constants(parse_program(&parser), &folded);
+        if (resolve_names(root, stderr) != 0) exit(1);
+        parser_free(&parser);
+        token_buffer_free(&tokens);
+        ast_use_arena(NULL);
+
+        long expected = 0;
+        VmProgram program;
+        if (vm_compile(&program, root, stderr) != 0) exit(1);
+        bench_bytecode(loop, &program, "", &vm, &jit, count, &expected, 1);
+        vm_program_free(&program);
+
+        IrProgram ir;
+        if (ir_build(&ir, root, stderr) != 0) exit(1);
+        ir_optimize(&ir);
+        if (ir_lower(&ir, &program) != 0) exit(1);
+        ir_free(&ir);
+        bench_bytecode(loop, &program, " + ir", &vm, &jit, count, &expected, 0);
+        vm_program_free(&program);
+
+        for (int run = 0; run < runs && cc; run++) {
+            double start = now();
+            int status = run_through_cc(root);
+            native.seconds[run] = now() - start;
+            if (status == -1) { cc = 0; printf("%-10s %-16s (cc failed)\n", loop->name, "cc"); break; }
+            if (status != (int)(expected & 0xff)) {
+                fprintf(stderr, "%s: the C program exited with %d, the VM computed %ld\n", loop->name, status, expected);
+                exit(1);
+            }
+        }
+        if (cc) report_loop(loop, "cc + run", &native, (double)count * loop->inner);
+
+        arena_free(&arena);
+    }
+    free(vm.seconds);
+    free(jit.seconds);
+    free(native.seconds);
+}
+
+
+// Read a whole file into a NUL-terminated buffer
+static char* read_source(const char* path, size_t* size) {
+    int file = open(path, O_RDONLY);
+    if (file == -1) { fprintf(stderr, "Could not open file '%s'\n", path); return NULL; }
+
+    struct stat info;
+    if (fstat(file, &info) == -1) { perror("Could not get file size"); close(file); return NULL; }
+
+    char* text = malloc(info.st_size + 1);
+    if (!text) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    size_t total = 0;
+    while (total < (size_t)info.st_size) {
+        ssize_t n = read(file, text + total, info.st_size - total);
+        if (n <= 0) break;
+        total += n;
+    }
+    text[total] = '\0';
+    close(file);
+
+    *size = total;
+    return text;
+}
+
+
+int main(int argc, char* argv[]) {
+    const char* kind_name = "all";
+    const char* generate = NULL;
+    double size_mb = DEFAULT_SIZE_MB;
+    int runs = DEFAULT_RUNS;
+    uint64_t seed = 1;
+    long iterations = DEFAULT_ITERATIONS;
+    int vm = 0, cc = 0, scan = 0;
+
+    int file_count = 0;
+    char** files = calloc(argc, sizeof(char*));
+    if (!files) { fprintf(stderr, "Out of memory\n"); return 1; }
+
+    for (int a = 1; a < argc; a++) {
+        const char* argument = argv[a];
+        const char* value = a + 1 < argc ? argv[a + 1] : NULL;
+
+        if (!strcmp(argument, "--kind") && value) { kind_name = value; a++; }
+        else if (!strcmp(argument, "--size") && value) { size_mb = atof(value); a++; }
+        else if (!strcmp(argument, "--runs") && value) { runs = atoi(value); a++; }
+        else if (!strcmp(argument, "--seed") && value) { seed = strtoull(value, NULL, 10); a++; }
+        else if (!strcmp(argument, "--generate") && value) { generate = value; a++; }
+        else if (!strcmp(argument, "--iterations") && value) { iterations = atol(value); a++; }
+        else if (!strcmp(argument, "--vm")) vm = 1;
+        else if (!strcmp(argument, "--cc")) cc = 1;
+        else if (!strcmp(argument, "--scan")) scan = 1;
+        else if (*argument == '-') {
+            fprintf(stderr,
+                "Usage: %s [--kind name|all] [--size MB] [--runs N] [--seed N] [file.sr...]\n"
+                "       %s --generate kind [--size MB] [--seed N] > corpus.sr\n"
+                "       %s --vm [--iterations N] [--runs N] [--cc]\n"
+                "       %s --scan [--kind name|all] [--size MB] [--runs N] [--seed N] [file.sr...]\n"
+                "Kinds:", argv[0], argv[0], argv[0], argv[0]);
+            for (int kind = 0; kind < CORPUS_KIND_COUNT; kind++) fprintf(stderr, " %s", corpus_kind_name(kind));
+            fprintf(stderr, "\n");
+            return 1;
+        }
+        else files[file_count++] = argv[a];
+    }
+    if (runs < 1) runs = 1;
+    size_t size = (size_t)(size_mb * 1024 * 1024);
+
+    // Just write a corpus out
+    if (generate) {
+        int kind = corpus_kind_from_name(generate);
+        if (kind < 0) { fprintf(stderr, "Unknown corpus kind '%s'\n", generate); return 1; }
+        size_t length;
+        char* text = corpus_generate(kind, size, seed, &length);
+        fwrite(text, 1, length, stdout);
+        free(text);
+        free(files);
+        return 0;
+    }
+
+    if (vm) {
+        if (iterations < 1000) iterations = 1000;
+        bench_vm(iterations, runs, cc);
+        free(files);
+        intern_free(intern_table());
+        return 0;
+    }
+
+    int mismatches = 0;
+    printf("%-10s %-16s %9s %9s %9s   %-7s %14s  %s\n", "corpus", "phase", "median ms", "min ms", "mean ms", "sd", "bytes", "items");
+
+    if (file_count > 0) {
+        for (int i = 0; i < file_count; i++) {
+            Corpus corpus = { files[i], NULL, 0 };
+            corpus.text = read_source(files[i], &corpus.size);
+            if (!corpus.text) return 2;
+            if (scan) mismatches += check_scanners(&corpus, runs);
+            else bench_corpus(&corpus, runs);
+            free(corpus.text);
+        }
+    } else {
+        int only = strcmp(kind_name, "all") ? corpus_kind_from_name(kind_name) : -1;
+        if (strcmp(kind_name, "all") && only < 0) { fprintf(stderr, "Unknown corpus kind '%s'\n", kind_name); return 1; }
+
+        for (int kind = 0; kind < CORPUS_KIND_COUNT; kind++) {
+            if (only >= 0 && kind != only) continue;
+            Corpus corpus = { corpus_kind_name(kind), NULL, 0 };
+            corpus.text = corpus_generate(kind, size, seed, &corpus.size);
+            if (scan) mismatches += check_scanners(&corpus, runs);
+            else bench_corpus(&corpus, runs);
+            free(corpus.text);
+        }
+    }
+
+    if (scan) {
+        Corpus corpus = random_bytes(size < (1 << 20) ? size : (1 << 20), seed);
+        mismatches += check_scanners(&corpus, runs);
+        free(corpus.text);
+        if (mismatches) fprintf(stderr, "%d scanner mismatches\n", mismatches);
+    }
+
+    free(files);
+    intern_free(intern_table());
+    return mismatches ? 1 : 0;
+}
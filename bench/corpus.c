@@ -0,0 +1,218 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "corpus.h"
+
+#define CORPUS_NAMES 64     // Distinct variable names used
+
+static const char* kind_names[CORPUS_KIND_COUNT] = {
+    [CORPUS_MIXED]       = "mixed",
+    [CORPUS_EXPRESSIONS] = "expr",
+    [CORPUS_LETS]        = "lets",
+    [CORPUS_NESTED]      = "nested",
+    [CORPUS_FUNCS]       = "funcs",
+    [CORPUS_COMMENTS]    = "comments",
+};
+
+typedef struct Generator {
+    char* text;
+    size_t length;
+    size_t capacity;
+    uint64_t state;     // xorshift64
+    int funcs;          // Functions emitted so far (for unique names)
+} Generator;
+
+
+const char* corpus_kind_name(CorpusKind kind) {
+    return kind_names[kind];
+}
+
+// Kind with the given name, or -1
+int corpus_kind_from_name(const char* name) {
+    for (int kind = 0; kind < CORPUS_KIND_COUNT; kind++)
+        if (!strcmp(name, kind_names[kind])) return kind;
+    return -1;
+}
+
+
+static uint32_t next_random(Generator* gen) {
+    gen->state ^= gen->state << 13;
+    gen->state ^= gen->state >> 7;
+    gen->state ^= gen->state << 17;
+    return (uint32_t)(gen->state >> 32);
+}
+
+// Uniform in [0, bound)
+static uint32_t random_below(Generator* gen, uint32_t bound) {
+    return (uint32_t)(((uint64_t)next_random(gen) * bound) >> 32);
+}
+
+// Append formatted text
+static void emit(Generator* gen, const char* format, ...) {
+    for (;;) {
+        va_list arguments;
+        va_start(arguments, format);
+        int n = vsnprintf(gen->text + gen->length, gen->capacity - gen->length, format, arguments);
+        va_end(arguments);
+
+        if (n >= 0 && (size_t)n < gen->capacity - gen->length) {
+            gen->length += n;
+            return;
+        }
+
+        gen->capacity *= 2;
+        gen->text = realloc(gen->text, gen->capacity);
+        if (!gen->text) {
+            fprintf(stderr, "Out of memory generating corpus\n");
+            exit(1);
+        }
+    }
+}
+
+static void indent(Generator* gen, int depth) {
+    for (int i = 0; i < depth; i++) emit(gen, "  ");
+}
+
+
+/*
+    Pieces
+*/
+static void expression(Generator* gen, int depth, int max_depth) {
+    uint32_t r = random_below(gen, 100);
+    if (depth >= max_depth || r < 25) { emit(gen, "%u", random_below(gen, 100000)); return; }
+    if (r < 45) { emit(gen, "v%u", random_below(gen, CORPUS_NAMES)); return; }
+    if (r < 52) { emit(gen, "-"); expression(gen, depth + 1, max_depth); return; }
+    if (r < 65) { emit(gen, "("); expression(gen, depth + 1, max_depth); emit(gen, ")"); return; }
+
+    expression(gen, depth + 1, max_depth);
+    emit(gen, " %c ", "+-*/"[random_below(gen, 4)]);
+    expression(gen, depth + 1, max_depth);
+}
+
+// A fully parenthesized chain `depth` levels deep
+static void deep_expression(Generator* gen, int depth) {
+    if (depth == 0) { emit(gen, "v%u", random_below(gen, CORPUS_NAMES)); return; }
+    emit(gen, "(");
+    deep_expression(gen, depth - 1);
+    emit(gen, " %c %u)", "+-*/"[random_below(gen, 4)], random_below(gen, 1000) + 1);
+}
+
+static void let(Generator* gen, int depth, int max_depth) {
+    indent(gen, depth);
+    emit(gen, "let v%u = ", random_below(gen, CORPUS_NAMES));
+    expression(gen, 0, max_depth);
+    emit(gen, "\n");
+}
+
+static void comment(Generator* gen, int depth) {
+    static const char* words[] = { "the", "value", "is", "kept", "for", "later", "TODO", "check", "this", "loop" };
+    indent(gen, depth);
+    emit(gen, "#");
+    for (uint32_t i = 0, n = 3 + random_below(gen, 10); i < n; i++) emit(gen, " %s", words[random_below(gen, 10)]);
+    emit(gen, "\n");
+}
+
+static void statement(Generator* gen, int depth, int max_nesting) {
+    uint32_t r = random_below(gen, 100);
+    if (depth < max_nesting && r < 10) {
+        indent(gen, depth);
+        emit(gen, "if ");
+        expression(gen, 0, 3);
+        emit(gen, ":\n");
+        for (uint32_t i = 0, n = 1 + random_below(gen, 4); i < n; i++) statement(gen, depth + 1, max_nesting);
+        indent(gen, depth);
+        emit(gen, "end\n");
+    } else if (depth < max_nesting && r < 20) {
+        indent(gen, depth);
+        emit(gen, "while ");
+        expression(gen, 0, 3);
+        emit(gen, "\n");
+        for (uint32_t i = 0, n = 1 + random_below(gen, 4); i < n; i++) statement(gen, depth + 1, max_nesting);
+        indent(gen, depth);
+        emit(gen, "end\n");
+    } else if (r < 25) {
+        indent(gen, depth);
+        emit(gen, "return ");
+        expression(gen, 0, 4);
+        emit(gen, "\n");
+    } else if (r < 30) {
+        comment(gen, depth);
+    } else {
+        let(gen, depth, 5);
+    }
+}
+
+// A block nested `depth` levels deep, alternating if and while
+static void nested_block(Generator* gen, int depth, int level) {
+    indent(gen, level);
+    emit(gen, level % 2 ? "while v%u\n" : "if v%u:\n", random_below(gen, CORPUS_NAMES));
+    let(gen, level + 1, 2);
+    if (level + 1 < depth) nested_block(gen, depth, level + 1);
+    indent(gen, level);
+    emit(gen, "end\n");
+}
+
+
+// One top-level unit of the given kind
+static void unit(Generator* gen, CorpusKind kind) {
+    switch (kind) {
+        case CORPUS_MIXED:
+            emit(gen, "func p%d(a, b):\n", gen->funcs++);
+            for (uint32_t i = 0, n = 1 + random_below(gen, 10); i < n; i++) statement(gen, 1, 3);
+            emit(gen, "end\n");
+            break;
+        case CORPUS_EXPRESSIONS:
+            emit(gen, "let v%u = ", random_below(gen, CORPUS_NAMES));
+            deep_expression(gen, 16 + random_below(gen, 48));
+            emit(gen, " + ");
+            expression(gen, 0, 12);
+            emit(gen, "\n");
+            break;
+        case CORPUS_LETS:
+            for (int i = 0; i < 64; i++) let(gen, 0, 2);
+            break;
+        case CORPUS_NESTED:
+            emit(gen, "func p%d():\n", gen->funcs++);
+            nested_block(gen, 8 + random_below(gen, 24), 1);
+            emit(gen, "end\n");
+            break;
+        case CORPUS_FUNCS:
+            emit(gen, "func p%d(a):\n", gen->funcs++);
+            let(gen, 1, 2);
+            emit(gen, "  return v%u\nend\n", random_below(gen, CORPUS_NAMES));
+            break;
+        case CORPUS_COMMENTS:
+            for (uint32_t i = 0, n = 4 + random_below(gen, 8); i < n; i++) comment(gen, 0);
+            let(gen, 0, 3);
+            break;
+        default:
+            break;
+    }
+}
+
+
+/*
+    Generate about `size` bytes of source (whole top-level units only, so
+    the result always parses). Every variable is declared up front as a
+    global, so the result also compiles. The text is NUL-terminated; free
+    it with free().
+*/
+char* corpus_generate(CorpusKind kind, size_t size, uint64_t seed, size_t* length) {
+    Generator gen = { 0 };
+    gen.capacity = size + 4096;
+    gen.text = malloc(gen.capacity);
+    if (!gen.text) {
+        fprintf(stderr, "Out of memory generating corpus\n");
+        exit(1);
+    }
+    gen.text[0] = '\0';
+    gen.state = seed * 0x9E3779B97F4A7C15ull + 1;   // Never zero
+
+    for (int i = 0; i < CORPUS_NAMES; i++) emit(&gen, "let v%d = %d\n", i, i + 1);
+    while (gen.length < size) unit(&gen, kind);
+
+    *length = gen.length;
+    return gen.text;
+}
@@ -0,0 +1,26 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Synthetic Serrate sources for benchmarking. Each kind stresses one part
+    of the front end; the same (kind, size, seed) always gives the same text.
+*/
+typedef enum {
+    CORPUS_MIXED,       // A bit of everything, roughly like real code
+    CORPUS_EXPRESSIONS, // Deeply nested arithmetic
+    CORPUS_LETS,        // Long runs of flat `let` statements
+    CORPUS_NESTED,      // Deeply nested if / while blocks
+    CORPUS_FUNCS,       // Many small functions
+    CORPUS_COMMENTS,    // Mostly comment lines
+    CORPUS_KIND_COUNT
+} CorpusKind;
+
+// Forward Declarations
+const char* corpus_kind_name(CorpusKind kind);
+int corpus_kind_from_name(const char* name);
+char* corpus_generate(CorpusKind kind, size_t size, uint64_t seed, size_t* length);
+
+#endif
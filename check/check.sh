@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Differential check of the back ends: every program here is run on the
+# VM and the JIT (with and without the IR and folding), built from the
+# generated C and from the generated assembly, and each must give the
+# exit status on its "# status:" line and the same stderr as the C build.
+# The generated C has to compile without a single warning (-Wall -Werror).
+#
+#     sh check/check.sh [path/to/serrate]
+#
+# Exits 1 if anything differs.
+
+serrate=${1:-bin/serrate}
+directory=$(dirname "$0")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failures=0
+
+fail() {
+    echo "FAIL $1: $2"
+    failures=$((failures + 1))
+}
+
+# Compare one run's status ($2) and stderr (in $work/err) against the C build
+compare() {
+    if [ "$2" != "$expected" ]; then fail "$1" "exited with $2, expected $expected"
+    elif ! cmp -s "$work/err" "$work/c.err"; then fail "$1" "printed '$(cat "$work/err")', the C build '$(cat "$work/c.err")'"
+    fi
+}
+
+for program in "$directory"/*.sr; do
+    name=$(basename "$program")
+    expected=$(sed -n 's/^# status: *//p' "$program")
+    if [ -z "$expected" ]; then fail "$name" "has no '# status:' line"; continue; fi
+
+    # Through C first: its stderr is the reference
+    if "$serrate" "$program" -o "$work/p.c" >/dev/null && cc -O1 -Wall -Werror -o "$work/c" "$work/p.c"; then
+        "$work/c" 2>"$work/c.err"
+        status=$?
+        cp "$work/c.err" "$work/err"
+        compare "$name (C)" $status
+    else
+        fail "$name" "could not be built through C"
+        continue
+    fi
+
+    for mode in "--run" "--jit" "--run --no-opt" "--jit --no-opt" "--run --no-fold" "--jit --no-fold"; do
+        "$serrate" "$program" $mode >/dev/null 2>"$work/err"
+        compare "$name ($mode)" $?
+    done
+
+    for mode in "" "--no-opt"; do
+        if "$serrate" "$program" $mode -o "$work/p.s" >/dev/null && as -o "$work/p.o" "$work/p.s" && ld -o "$work/s" "$work/p.o"; then
+            "$work/s" 2>"$work/err"
+            compare "$name (.s${mode:+ $mode})" $?
+        else
+            fail "$name" "could not be built through assembly${mode:+ $mode}"
+        fi
+    done
+done
+
+if [ $failures -gt 0 ]; then
+    echo "$failures failures"
+    exit 1
+fi
+echo "All back ends agree"
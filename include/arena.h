@@ -0,0 +1,37 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+    A bump allocator. Memory is handed out from large chunks and is only
+    ever released all at once with arena_free, which makes teardown of
+    the AST cost one free() per chunk instead of one per node.
+*/
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;    // Usable bytes in this chunk
+    size_t used;    // Bytes handed out so far
+} ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk* head;       // Chunk currently being bumped
+    size_t chunk_size;      // Default size for new chunks
+    void* last;             // Most recent allocation (can be grown in place)
+
+    // Statistics
+    size_t allocations;     // Calls to arena_alloc
+    size_t bytes_allocated; // Bytes requested by callers
+    size_t bytes_reserved;  // Bytes obtained from malloc
+    size_t chunk_count;     // Chunks obtained from malloc
+} Arena;
+
+// Forward Declarations
+void arena_init(Arena* arena, size_t chunk_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+char* arena_strndup(Arena* arena, const char* string, size_t length);
+void arena_adopt(Arena* arena, Arena* other);
+void arena_free(Arena* arena);
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stdio.h>
+
+#include "arena.h"
+
 typedef enum {
     AST_IDENTIFIER,
     AST_INTEGER,   
@@ -14,34 +18,84 @@ typedef enum {
     AST_RETURN,
 
     AST_BINOP,
-    AST_UNARY
+    AST_UNARY,
+
+    AST_NODE_TYPE_COUNT     // Number of node types, not a node type
 } NodeType;
 
+/*
+    Operators of BINOP and UNARY nodes are their character: + - * / < >.
+    The ones spelled with two characters are stored as one of these.
+    A comparison is 1 or 0.
+*/
+enum {
+    AST_OP_LESS_EQUAL = 'L',
+    AST_OP_GREATER_EQUAL = 'G',
+    AST_OP_EQUAL = 'E',
+    AST_OP_NOT_EQUAL = 'N',
+};
+
+static inline int ast_is_comparison(char op) {
+    return op == '<' || op == '>' || op == AST_OP_LESS_EQUAL || op == AST_OP_GREATER_EQUAL
+        || op == AST_OP_EQUAL || op == AST_OP_NOT_EQUAL;
+}
+
+/*
+    A node made while an arena is set (see ast_use_arena) belongs to that
+    arena, and add_child grows its children there. So the Arena itself,
+    not just its memory, has to stay where it is for as long as the node
+    is in use. Whoever hands an arena's chunks to another with arena_adopt
+    first moves its nodes over with ast_move_arena.
+*/
 typedef struct Node {
     NodeType node;
+    int slot;        // For IDENTIFIER, with depth: what it names; for PROGRAM, the index of main (see symbols.h)
 
     // Literals / Identifiers
-    char* name;      // For IDENTIFIER
-    int value;       // For INTEGER
+    const char* name;   // For IDENTIFIER (interned, see intern.h)
+    long value;      // For INTEGER
     struct Node* condition; // For if/while
 
     // Statements and Expressions
     struct Node** children;
     int children_count;
+    int children_capacity;  // Slots allocated in children (grows geometrically)
+    Arena* arena;   // The arena the node and its children array came from (released by arena_free, not free_ast), or NULL
 
     // Body
     // struct Node** body;
     // int body_count;
 
     char op;        // Operator Type
+    char type;      // IntType (see types.h): a LET's annotation; an expression's, once resolved
+    int depth;      // For IDENTIFIER: block depth of the local it names, 0 for a global, -1 if unresolved
 } Node;
 
+// Allocation counters for the AST constructors (per thread)
+typedef struct AstStats {
+    size_t node_allocations;    // Nodes created by new_node
+    size_t child_reallocations; // Child array resizes in add_child
+    size_t bytes;               // Total bytes requested for nodes and child arrays
+    size_t mallocs;             // malloc calls by new_node (none with an arena)
+    size_t reallocs;            // realloc calls by add_child (none with an arena)
+    size_t nodes_by_type[AST_NODE_TYPE_COUNT];
+} AstStats;
+
 // Forward Declarations
 Node* new_node(NodeType type);
-Node* new_int_node(int value);
+Node* new_int_node(long value);
 Node* new_identifier_node(const char* name);
 Node* new_binop_node(char op, Node* left, Node* right);
 void add_child(Node* parent, Node* child);
 void free_ast(Node* node);
 
+void ast_use_arena(Arena* arena);
+void ast_move_arena(Node* node, const Arena* from, Arena* to);
+Arena* ast_arena(void);
+AstStats* ast_stats(void);
+void ast_stats_add(AstStats* total, const AstStats* stats);
+const char* ast_node_type_name(NodeType type);
+const char* ast_operator_name(char op);
+void print_alloc_stats(FILE* out, const Arena* arena);
+
 #endif
\ No newline at end of file
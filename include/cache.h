@@ -0,0 +1,59 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Results of earlier compilations, keyed by a hash of the source text
+    (and of anything else that changes the result, see CompileJob). Used by
+    the daemon so an unchanged file costs one hash and a few writes.
+    The full source is kept and compared on a hit, so a hash collision
+    can't return the wrong result. Least recently used entries are dropped
+    once the cache holds more than `budget` bytes. Safe to share between
+    threads.
+*/
+typedef struct CacheEntry {
+    uint64_t key;
+    struct CacheEntry* next_in_bucket;
+    struct CacheEntry* newer;       // Recency list, most recent at cache->newest
+    struct CacheEntry* older;
+
+    char* source; size_t source_size;
+    char* out;    size_t out_size;      // Informational output
+    char* err;    size_t err_size;      // Diagnostics
+    char* output; size_t output_size;   // Contents of the generated file
+} CacheEntry;
+
+typedef struct CompileCache {
+    CacheEntry** buckets;
+    uint32_t bucket_count;      // Always a power of two
+    uint32_t count;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+    size_t bytes;               // Memory held by entries
+    size_t budget;
+    pthread_mutex_t lock;
+
+    // Statistics
+    size_t hits;
+    size_t misses;
+} CompileCache;
+
+// What cache_lookup hands back: copies the caller frees with cache_result_free
+typedef struct CacheResult {
+    char* out;    size_t out_size;
+    char* err;    size_t err_size;
+    char* output; size_t output_size;
+} CacheResult;
+
+// Forward Declarations
+void cache_init(CompileCache* cache, size_t budget);
+uint64_t cache_key(const char* data, size_t size, uint64_t variant);
+int cache_lookup(CompileCache* cache, uint64_t key, const char* source, size_t source_size, CacheResult* result);
+void cache_store(CompileCache* cache, uint64_t key, const char* source, size_t source_size, const CacheResult* result);
+void cache_result_free(CacheResult* result);
+void cache_free(CompileCache* cache);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdio.h>
+
+#include "ast.h"
+#include "regalloc.h"
+#include "vm.h"
+#include "writer.h"
+
+/*
+    C code generation. Every value is a `long`; + - * and negation wrap
+    around on overflow and division by zero stops the program, whatever C
+    compiler builds the output.
+
+    `let` assigns a variable that is already visible and declares it in
+    the current block otherwise. Top-level lets are globals, visible in
+    every function. Functions become `long f_name(void)`; the program runs
+    the top-level statements in order, then `func main` if there is one,
+    and exits with what it returns (or what a top-level `return` gave).
+*/
+
+/*
+    codegen_asm writes the same program as x86-64 GNU assembler source
+    instead (a .s file), from its bytecode (see vm.h), and needs no C
+    compiler:
+
+        as -o foo.o foo.s && ld -o foo foo.o
+
+    It doesn't use libc; the program starts at _start and ends with the
+    exit system call (Linux).
+*/
+
+extern const RegisterSet asm_registers;     // What codegen_asm keeps values in
+
+// Forward Declarations
+int codegen_c(const Node* program, Writer* out, FILE* errors);
+void codegen_asm(const VmProgram* program, Writer* out);
+
+#endif
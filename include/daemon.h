@@ -0,0 +1,21 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+
+/*
+    A long-running compiler process. `serrate --daemon` listens on a Unix
+    socket; `serrate --client ...` hands its arguments, working directory
+    and stdout/stderr to it and exits with whatever status it returns.
+    Requests are run one at a time by the same `command` a normal
+    invocation uses, so caches (results, interned names, the allocator)
+    stay warm across them.
+*/
+typedef int (*DaemonCommand)(int argc, char** argv, FILE* out, FILE* err);
+
+// Forward Declarations
+const char* daemon_socket_path(void);
+int daemon_serve(const char* path, DaemonCommand command);
+int daemon_forward(const char* path, int argc, char** argv);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <stdio.h>
+
+#include "cache.h"
+#include "stats.h"
+
+// What to print to `out` while compiling
+#define DUMP_TOKENS 1
+#define DUMP_AST    2
+#define DUMP_BYTECODE 4
+#define DUMP_IR     8
+#define DUMP_REGISTERS 16
+#define DUMP_ALL    (DUMP_TOKENS | DUMP_AST | DUMP_BYTECODE | DUMP_IR | DUMP_REGISTERS)
+
+// How to run the program instead of generating C
+#define RUN_VM  1
+#define RUN_JIT 2
+
+/*
+    One source file to compile. `out` receives the dumps asked for in
+    `dump` (nothing by default) and `err` the diagnostics.
+    An input ending in .sast is a binary AST (see flat_ast.h) and skips
+    lexing and parsing. With `run` set nothing is written: the program is
+    run on the bytecode VM (see vm.h) or compiled to machine code (see
+    jit.h), and its result becomes the status.
+*/
+typedef struct CompileJob {
+    const char* input;      // Source file path
+    const char* output;     // Generated C file path
+    const char* ast_output; // Binary AST file to write after parsing, or NULL
+    FILE* out;
+    FILE* err;
+    int parse_threads;      // Threads for parsing this one file (1 for serial)
+    int dump;               // DUMP_* flags
+    int fold;               // Fold constants before code generation (see fold.h)
+    int run;                // RUN_* to run the program instead of generating C
+    int optimize;           // Optimize through the SSA IR (see ir.h) before lowering to bytecode
+    CompileStats* stats;    // Pass times and counters are added here, if not NULL
+    int status;             // Exit status for this file, 0 on success (the program's with `run`)
+} CompileJob;
+
+// Forward Declarations
+int compile_file(CompileJob* job);
+int compile_all(CompileJob* jobs, int count, int threads);
+int default_thread_count(void);
+void compile_use_cache(CompileCache* cache);
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "writer.h"
+
+#define FLAT_NONE 0xFFFFFFFFu   // "No node" (missing condition / NULL child)
+
+/*
+    Compact, pointer-free form of the AST. Every node is an index, and its
+    fields live in parallel arrays (struct-of-arrays), so a traversal that
+    only looks at kinds only touches one byte per node.
+
+    The children of a node are the slice
+        child_index[first_child[i] .. first_child[i] + child_counts[i]]
+    Identifier names are NUL-terminated strings in `strings`, referenced
+    by their byte offset in `payloads`; integer literals are 64 bits, in
+    `constants`, referenced by their index. Nodes are stored in pre-order.
+*/
+typedef struct FlatAst {
+    uint32_t count;         // Number of nodes
+    uint32_t capacity;
+
+    uint8_t* kinds;         // NodeType
+    uint8_t* ops;           // Operator for BINOP / UNARY, annotation (IntType) for LET
+    uint32_t* payloads;     // INTEGER: index into constants, IDENTIFIER: offset into strings
+    uint32_t* conditions;   // Condition node for IF / WHILE, or FLAT_NONE
+    uint32_t* first_child;  // Start of this node's slice of child_index
+    uint32_t* child_counts; // Length of this node's slice of child_index
+
+    uint32_t* child_index;  // Node indices of all children, grouped by parent
+    uint32_t edge_count;
+    uint32_t edge_capacity;
+
+    int64_t* constants;     // Integer literals
+    uint32_t constant_count;
+    uint32_t constant_capacity;
+
+    char* strings;          // Identifier names
+    uint32_t string_size;
+    uint32_t string_capacity;
+
+    uint32_t root;          // Index of the root node, or FLAT_NONE
+
+    void* mapping;          // Set by flat_ast_load: the arrays point into this read-only file mapping
+    size_t mapping_size;
+} FlatAst;
+
+
+/*
+    Binary AST files (.sast). The arrays above are written out as they
+    are, behind a fixed header that records where each one starts, so a
+    file is loaded by mapping it and pointing the arrays at the sections.
+    Nothing is decoded per node. Node references are indices, never
+    pointers, so a file can be mapped at any address.
+
+    All integers are in the byte order of the machine that wrote the file
+    (recorded in byte_order, foreign files are rejected). Every section
+    starts on an 8-byte boundary. Bump FLAT_AST_VERSION whenever the
+    layout or the meaning of a NodeType changes.
+*/
+#define FLAT_AST_MAGIC      "SAST"
+#define FLAT_AST_VERSION    2
+#define FLAT_AST_BYTE_ORDER 0x01020304u
+
+enum {
+    FLAT_SECTION_KINDS,
+    FLAT_SECTION_OPS,
+    FLAT_SECTION_PAYLOADS,
+    FLAT_SECTION_CONDITIONS,
+    FLAT_SECTION_FIRST_CHILD,
+    FLAT_SECTION_CHILD_COUNTS,
+    FLAT_SECTION_CHILD_INDEX,
+    FLAT_SECTION_CONSTANTS,
+    FLAT_SECTION_STRINGS,
+    FLAT_SECTION_COUNT
+};
+
+typedef struct FlatAstHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t count;
+    uint32_t edge_count;
+    uint32_t string_size;
+    uint32_t root;
+    uint32_t constant_count;
+    uint64_t file_size;
+    uint64_t sections[FLAT_SECTION_COUNT];  // Byte offset of each array from the start of the file
+} FlatAstHeader;
+
+// Forward Declarations
+void flat_ast_init(FlatAst* ast);
+uint32_t flat_ast_build(FlatAst* ast, const Node* root);
+Node* flat_ast_expand(const FlatAst* ast, uint32_t index);
+void flat_ast_print(const FlatAst* ast, uint32_t index, int indent);
+void flat_ast_fprint(FILE* out, const FlatAst* ast, uint32_t index, int indent);
+void flat_ast_write(Writer* writer, const FlatAst* ast, uint32_t root, int indent);
+void flat_ast_free(FlatAst* ast);
+
+int flat_ast_save(const FlatAst* ast, const char* path, FILE* errors);
+int flat_ast_load(FlatAst* ast, const char* path, FILE* errors);
+int flat_ast_verify(const FlatAst* ast);
+
+
+/*
+    Accessors
+*/
+static inline NodeType flat_kind(const FlatAst* ast, uint32_t index) {
+    return (NodeType)ast->kinds[index];
+}
+
+static inline uint32_t flat_child(const FlatAst* ast, uint32_t index, uint32_t n) {
+    return ast->child_index[ast->first_child[index] + n];
+}
+
+static inline const char* flat_name(const FlatAst* ast, uint32_t index) {
+    return ast->strings + ast->payloads[index];
+}
+
+static inline long flat_value(const FlatAst* ast, uint32_t index) {
+    return (long)ast->constants[ast->payloads[index]];
+}
+
+#endif
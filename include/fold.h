@@ -0,0 +1,26 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stddef.h>
+
+#include "ast.h"
+
+/*
+    Constant folding and algebraic simplification, run on the tree between
+    parsing and code generation. Arithmetic is folded with the semantics of
+    the generated code (wrapping + - * and negation). A division by zero
+    is left in place so it still traps at run time, and x*0 is only
+    simplified when x can't trap.
+*/
+typedef struct FoldStats {
+    size_t folded;      // Operators replaced by their constant value
+    size_t simplified;  // Identities applied (x+0, x*1, x*0, -(-x), ...)
+    size_t removed;     // Nodes no longer in the tree
+} FoldStats;
+
+// Forward Declarations
+Node* fold_constants(Node* node, FoldStats* stats);
+int fold_evaluate(const Node* node, long* value);
+void fold_stats_add(FoldStats* total, const FoldStats* stats);
+
+#endif
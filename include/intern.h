@@ -0,0 +1,45 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/*
+    String interning. Every distinct identifier is stored exactly once and
+    intern() always returns the same pointer for the same bytes, so names
+    can be compared with == and never need to be copied or freed per use.
+    Names are hashed straight out of the source buffer.
+*/
+typedef struct InternEntry {
+    uint32_t hash;
+    uint32_t length;
+    const char* string;     // NULL if the slot is empty
+} InternEntry;
+
+typedef struct InternTable {
+    InternEntry* entries;   // Open addressing, linear probing
+    uint32_t capacity;      // Always a power of two
+    uint32_t count;
+    Arena strings;          // Storage for the interned bytes
+
+    // Set while several threads intern into this table at once
+    int shared;
+    pthread_mutex_t lock;
+
+    // Statistics
+    size_t lookups;
+} InternTable;
+
+// Forward Declarations
+void intern_init(InternTable* table);
+const char* intern_in(InternTable* table, const char* start, size_t length);
+void intern_free(InternTable* table);
+
+const char* intern(const char* start, size_t length);
+void intern_use_table(InternTable* table);
+InternTable* intern_table(void);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "vm.h"
+#include "writer.h"
+
+/*
+    A mid-level SSA form between the tree and the bytecode. Each function
+    is a graph of basic blocks; every value is defined once, and phis merge
+    the values of a variable where control flow joins. Block 0 is an entry
+    block that only holds the values variables start with and jumps to
+    block 1, where the function's code begins.
+
+    ir_build numbers functions and globals like vm_compile and reports the
+    same errors; it returns -1 without a report for a tree nested too
+    deeply to walk, and ir_lower for a function needing more registers
+    than a window holds, so the caller can compile the tree directly
+    instead. Locals become SSA values, and so do the globals inside a
+    function: they are loaded when the function needs them and stored
+    back before a call or return, which is all anyone else can observe
+    (the top level never stores them at all, since nothing runs after it
+    but main).
+
+    ir_optimize runs the passes: copy propagation, global value numbering
+    with constant folding, branch folding and dead-code elimination.
+    ir_lower then turns the result into bytecode (see vm.h), so the VM,
+    the JIT and the assembly back end all run the optimized program.
+*/
+typedef enum IrOp {
+    IR_CONST,   // constant
+    IR_PHI,     // phi[i] when coming from preds[i]
+    IR_COPY,    // args[0]; left behind by the passes until copies are propagated
+    IR_ADD,     // args[0] op args[1]
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,     // Traps when args[1] is 0
+    IR_DIVU,    // Unsigned; traps when args[1] is 0
+    IR_LT,      // args[0] op args[1] ? 1 : 0
+    IR_LE,
+    IR_EQ,
+    IR_NE,
+    IR_LTU,     // Unsigned
+    IR_LEU,
+    IR_NEG,     // -args[0]
+    IR_NARROW,  // args[0] wrapped to the width of the IntType constant (see types.h)
+    IR_LOAD,    // globals[constant]
+    IR_STORE,   // globals[constant] = args[0]
+    IR_CALL,    // functions[constant]()
+    IR_JUMP,    // To succ[0]
+    IR_BRANCH,  // To succ[0] if args[0] != 0, else succ[1]
+    IR_RETURN,  // Return args[0]
+    IR_OP_COUNT
+} IrOp;
+
+#define IR_NONE UINT32_MAX
+
+typedef struct IrValue {
+    uint8_t op;
+    uint8_t dead;       // Removed by a pass
+    uint32_t block;
+    uint32_t args[2];
+    long constant;      // CONST value, global index, function index or NARROW type
+    uint32_t* phi;      // PHI operands, in the order of the block's preds
+    uint32_t phi_count;
+    uint32_t phi_capacity;
+} IrValue;
+
+typedef struct IrBlock {
+    uint32_t* phis;     // Values, all PHIs (or copies they were reduced to)
+    uint32_t phi_count;
+    uint32_t phi_capacity;
+    uint32_t* values;   // Values in order, ending with JUMP, BRANCH or RETURN
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* preds;
+    uint32_t pred_count;
+    uint32_t pred_capacity;
+    uint32_t succ[2];
+    uint8_t succ_count;
+    uint8_t sealed;     // All preds are known (while building)
+    uint8_t dead;       // Unreachable, removed by a pass
+} IrBlock;
+
+typedef struct IrFunction {
+    const char* name;   // Interned; NULL for the top level
+    IrValue* values;
+    uint32_t value_count;
+    uint32_t value_capacity;
+    IrBlock* blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+} IrFunction;
+
+typedef struct IrProgram {
+    IrFunction* functions;  // [0] is the top level, numbered like VmProgram
+    uint32_t function_count;
+    uint32_t global_count;
+} IrProgram;
+
+// Forward Declarations
+int ir_build(IrProgram* program, const Node* ast, FILE* errors);
+void ir_optimize(IrProgram* program);
+int ir_lower(const IrProgram* program, VmProgram* bytecode);
+void ir_dump(const IrProgram* program, Writer* out);
+void ir_free(IrProgram* program);
+
+// Internal
+uint32_t ir_remove_trivial_phi(IrFunction* function, uint32_t phi);
+uint32_t ir_reverse_postorder(const IrFunction* function, uint32_t* order, uint32_t* position);
+
+// The value `value` stands for, through copies
+static inline uint32_t ir_resolve(const IrFunction* function, uint32_t value) {
+    while (function->values[value].op == IR_COPY) value = function->values[value].args[0];
+    return value;
+}
+
+// How many of `args` an op uses
+static inline int ir_arg_count(IrOp op) {
+    if (op >= IR_ADD && op <= IR_LEU) return 2;
+    return op == IR_COPY || op == IR_NEG || op == IR_NARROW || op == IR_STORE || op == IR_BRANCH || op == IR_RETURN;
+}
+
+#endif
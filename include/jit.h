@@ -0,0 +1,41 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "regalloc.h"
+#include "vm.h"
+
+/*
+    An x86-64 JIT for serrate --jit. Each function's bytecode (see vm.h) is
+    translated to machine code, so lowering and semantics are shared with
+    the VM: VM registers live in machine registers where the allocator
+    finds room (see regalloc.h) and in slots of a register stack in memory
+    otherwise, calls are native calls, and a trap (division by zero,
+    runaway calls) unwinds back to jit_run, which reports it like vm_run.
+
+    The code is assembled in ordinary memory, copied into an mmap'd buffer
+    and only then made executable, so no page is ever writable and
+    executable at once. jit_compile returns -1 when it can't translate a
+    program (another architecture, an opcode it doesn't know, operands out
+    of range, or no executable memory); the caller then runs the program
+    on the VM instead.
+*/
+typedef struct JitProgram {
+    uint8_t* memory;        // Executable, `size` bytes
+    size_t size;
+    uint32_t* entries;      // Offset of each function's code in `memory`
+    uint32_t function_count;
+    uint32_t global_count;
+} JitProgram;
+
+extern const RegisterSet jit_registers;
+
+// Forward Declarations
+int jit_compile(JitProgram* jit, const VmProgram* program);
+int jit_run(const JitProgram* jit, long* result, FILE* errors);
+void jit_free(JitProgram* jit);
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stdint.h>
+
+#include "lexer_simd.h"
+
 typedef enum TokenType {
     TOKEN_IDENTIFIER,
     TOKEN_INTEGER,
@@ -22,6 +26,10 @@ typedef enum TokenType {
     TOKEN_ASSIGN,
     TOKEN_GREATER_THAN,
     TOKEN_LESS_THAN,
+    TOKEN_EQUAL,
+    TOKEN_NOT_EQUAL,
+    TOKEN_GREATER_EQUAL,
+    TOKEN_LESS_EQUAL,
     TOKEN_PLUS,
     TOKEN_MINUS,
     TOKEN_ASTERISK,
@@ -31,25 +39,55 @@ typedef enum TokenType {
 
     TOKEN_UNKNOWN,
 
-    TOKEN_EOF
+    TOKEN_EOF,
+
+    TOKEN_TYPE_COUNT        // Number of token types, not a token type
 } TokenType;
 
 typedef struct Token {
     TokenType type;
     const char* start;
     int length;
-    int line, column;
+    long value;     // Decoded value of an INTEGER token
 } Token;
 
+/*
+    A token as stored by Lexer_tokenize_all: a byte offset and length into
+    the source instead of a pointer. INTEGER tokens carry an index into the buffer's
+    literal table, which holds the value decoded by the lexer.
+*/
+typedef struct PackedToken {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t literal;   // INTEGER only: index into TokenBuffer.literals
+    uint8_t type;       // TokenType
+} PackedToken;
+
+typedef struct TokenBuffer {
+    const char* source;
+    PackedToken* tokens;    // Always ends with a TOKEN_EOF
+    uint32_t count;
+    uint32_t capacity;
+
+    long* literals;
+    uint32_t literal_count;
+    uint32_t literal_capacity;
+} TokenBuffer;
+
 typedef struct Lexer {
+    const char* source;
     const char* start;
     const char* current;
-    int line, column;
+    const LexerScanner* scanner;    // Byte-run scanners (scalar / SSE2 / AVX2)
 } Lexer;
 
 // Forward Declarations
 void Lexer_init(Lexer* lexer, const char* source);
 Token Lexer_next(Lexer* lexer);
+void Lexer_tokenize_all(Lexer* lexer, TokenBuffer* buffer);
+Token token_buffer_get(const TokenBuffer* buffer, uint32_t index);
+void token_buffer_free(TokenBuffer* buffer);
 const char* token_type_name(TokenType type);
+LexerScanLevel Lexer_set_scan_level(LexerScanLevel level);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef LEXER_SIMD_H
+#define LEXER_SIMD_H
+
+/*
+    Byte-run scanners used by the lexer. Each one returns a pointer to the
+    first byte that does NOT belong to the run starting at `p`. The source
+    must be NUL-terminated: '\0' ends every run, and the vector versions
+    only ever load aligned blocks that contain at least one byte before
+    the terminator, so they never touch a page past the end of the input.
+*/
+typedef enum LexerScanLevel {
+    LEXER_SCAN_SCALAR,
+    LEXER_SCAN_SSE2,
+    LEXER_SCAN_AVX2
+} LexerScanLevel;
+
+typedef struct LexerScanner {
+    LexerScanLevel level;
+    const char* name;
+    const char* (*skip_space)(const char* p);       // ' ', \t, \v, \f, \r, \n
+    const char* (*skip_comment)(const char* p);     // Up to '\n' or '\0'
+    const char* (*skip_identifier)(const char* p);  // [A-Za-z0-9_]
+    const char* (*skip_digits)(const char* p);      // [0-9]
+} LexerScanner;
+
+// Forward Declarations
+LexerScanLevel lexer_best_scan_level(void);
+const LexerScanner* lexer_scanner(LexerScanLevel level);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Maps byte offsets to line and column. Nothing is computed until the
+    first lookup: then the start of every line is found once (with memchr)
+    and each lookup is a binary search. "\n", "\r\n" and a lone "\r" each
+    end one line.
+
+    Line: Starts at 1, because that's the beginning of the file, duh
+    Column: Starts at 0 in Serrate
+*/
+typedef struct LineIndex {
+    const char* source;
+    size_t length;
+    uint32_t* starts;   // Offset of the first byte of every line, NULL until built
+    uint32_t count;
+} LineIndex;
+
+// Forward Declarations
+void line_index_init(LineIndex* index, const char* source, size_t length);
+void line_index_position(LineIndex* index, uint32_t offset, int* line, int* column);
+void line_index_free(LineIndex* index);
+
+#endif
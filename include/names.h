@@ -0,0 +1,26 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <stdint.h>
+
+/*
+    A map from interned names (compared by pointer, see intern.h) to an int,
+    for the symbol table of name resolution (see symbols.h).
+*/
+typedef struct NameSlot {
+    const char* name;   // NULL if the slot is empty
+    int value;
+} NameSlot;
+
+typedef struct NameMap {
+    NameSlot* slots;    // Open addressing, linear probing
+    uint32_t capacity;  // Always a power of two
+    uint32_t used;
+} NameMap;
+
+// Forward Declarations
+NameSlot* name_slot(NameMap* map, const char* name);
+void name_map_reserve(NameMap* map, uint32_t count);
+void name_map_free(NameMap* map);
+
+#endif
@@ -3,20 +3,39 @@
 
 #include <lexer.h>
 #include <ast.h>
+#include <lines.h>
+#include <writer.h>
 
+/*
+    The parser reads from a TokenBuffer through a cursor, so any token can
+    be looked at ahead of time (parser_peek). Positions at or past `end`
+    read as TOKEN_EOF, which lets a parser work on a slice of a buffer.
+*/
 typedef struct {
-    Lexer* lexer;
+    const TokenBuffer* tokens;
+    uint32_t position;      // Index of `current` in tokens
+    uint32_t end;           // One past the last token this parser may consume
     Token current;
     Token previous;
+    TokenBuffer owned;      // Filled by parser_init, released by parser_free
+    LineIndex lines;        // Positions for diagnostics, built on the first error
+    FILE* errors;           // Where diagnostics go (stderr by default, NULL to only count them)
+    int error_count;
 } Parser;
 
 // Forward Declarations
 void parser_init(Parser* parser, Lexer* lexer);
+void parser_init_tokens(Parser* parser, const TokenBuffer* tokens, uint32_t begin, uint32_t end);
+void parser_free(Parser* parser);
+TokenType parser_peek(const Parser* parser, uint32_t distance);
 Node* parse_factor(Parser* parser);
-Node* parse_term(Parser* parser);
 Node* parse_program(Parser* parser);
+Node* parse_program_parallel(Parser* parser, int threads);
 Node* parse_statement(Parser* parser);
 Node* parse_expression(Parser* parser);
 void print_ast(Node* node, int indent);
+void fprint_ast(FILE* out, Node* node, int indent);
+void write_ast(Writer* writer, const Node* root, int indent);
+void write_tokens(Writer* writer, const TokenBuffer* tokens);
 
 #endif
\ No newline at end of file
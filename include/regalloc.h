@@ -0,0 +1,54 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdint.h>
+
+#include "vm.h"
+#include "writer.h"
+
+/*
+    Linear-scan register allocation for the native back ends (the JIT and
+    assembly output). Both translate bytecode, where every VM register has
+    a slot in memory; this picks the ones that live in machine registers
+    instead.
+
+    Each VM register gets one live interval, from the first instruction
+    that mentions it to the last, stretched over every loop (a backward
+    jump and the code it jumps back over) it is live around. Intervals are
+    taken in order of start and given a free machine register; when none
+    is left, whichever of the interval and the active ones is used least
+    for its length stays in its slot, each use counting 8 times more per
+    enclosing loop. An interval that spans a CALL only gets a register
+    calls preserve.
+*/
+#define REGALLOC_SPILLED 0xFF
+
+// The machine registers a back end can give out
+typedef struct RegisterSet {
+    const char* const* names;   // For dumps
+    uint8_t count;              // At most 32
+    uint8_t scratch_count;      // The first ones, which calls change; the rest are preserved
+} RegisterSet;
+
+typedef struct LiveInterval {
+    uint32_t reg;       // VM register
+    uint32_t start;     // First and last instruction it's live at
+    uint32_t end;
+    uint64_t weight;    // Uses, scaled by loop depth
+    uint8_t live_in;    // Already holds a value at `start`
+    uint8_t calls;      // Spans a CALL
+} LiveInterval;
+
+typedef struct RegisterAssignment {
+    uint8_t* location;          // VM register -> index in the set, or REGALLOC_SPILLED
+    uint32_t saved;             // Preserved registers used, which the function must save
+    LiveInterval* intervals;    // In order of start
+    uint32_t interval_count;
+} RegisterAssignment;
+
+// Forward Declarations
+void regalloc(RegisterAssignment* assignment, const VmFunction* function, const RegisterSet* set);
+void regalloc_dump(const VmProgram* program, const RegisterSet* set, Writer* out);
+void regalloc_free(RegisterAssignment* assignment);
+
+#endif
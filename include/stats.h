@@ -0,0 +1,61 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "fold.h"
+#include "lexer.h"
+
+/*
+    Per-compilation instrumentation for --time-passes and --stats. Each
+    pass is timed on the wall clock and on the CPU clock of the thread
+    doing the compiling (so helper threads of a parallel parse are not
+    included in its CPU time).
+*/
+typedef enum CompilePass {
+    PASS_MAP,       // Opening and mapping the source
+    PASS_LEX,
+    PASS_PARSE,
+    PASS_FOLD,      // Constant folding
+    PASS_RESOLVE,   // Name resolution
+    PASS_PRINT,     // Token and AST dumps, AST file
+    PASS_CODEGEN,
+    PASS_IR,        // Building and optimizing the SSA IR
+    PASS_BYTECODE,  // Lowering to bytecode for --run, --jit and assembly
+    PASS_JIT,       // Translating the bytecode to machine code for --jit
+    PASS_RUN,       // Running it
+    PASS_TEARDOWN,  // Freeing the AST and tokens, unmapping the source
+    PASS_WRITE,     // Writing the output file
+    PASS_COUNT
+} CompilePass;
+
+typedef struct PassClock {
+    double wall;
+    double cpu;
+} PassClock;
+
+typedef struct CompileStats {
+    int files;
+    double wall[PASS_COUNT];    // Seconds
+    double cpu[PASS_COUNT];
+    size_t bytes_read;
+    size_t tokens[TOKEN_TYPE_COUNT];
+    AstStats ast;
+    FoldStats fold;
+} CompileStats;
+
+// What to report
+#define STATS_TIMES     1
+#define STATS_COUNTERS  2
+
+// Forward Declarations
+void stats_start(PassClock* clock);
+void stats_stop(CompileStats* stats, CompilePass pass, const PassClock* clock);
+void stats_count_tokens(CompileStats* stats, const TokenBuffer* tokens);
+void stats_add(CompileStats* total, const CompileStats* stats);
+void stats_print(FILE* out, const CompileStats* total, int what);
+void stats_print_json(FILE* out, const CompileStats* files, const char* const* names, int count, const CompileStats* total, int what);
+
+#endif
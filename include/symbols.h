@@ -0,0 +1,43 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdio.h>
+
+#include "ast.h"
+
+/*
+    Name resolution, run on the tree between folding and code generation.
+    Every identifier is looked up once, in a symbol table that follows the
+    scopes of the program (the top level, each func, each if and while
+    body), and gets what it names stored on the node:
+
+        depth 0     a global; slot is its index, in order of the first
+                    top-level let of it. A func's own name is depth 0
+                    too, with its function index (from 1, 0 being the
+                    top level) as slot, or -1 for a duplicate.
+        depth > 0   a local, declared at that block depth; slot is its
+                    index among the locals of its function, each `let`
+                    that declares one taking the next, so they can be
+                    laid out in a dense frame.
+        depth -1    undeclared (reported).
+
+    The program node's own slot is the function index of main, or -1 if
+    there is none, so the back ends don't look for it by name.
+
+    Types are worked out on the way (see types.h): a variable has the type
+    of the let that declares it, which every identifier naming it gets as
+    `type`, and an operator gets the type of its result. A later let of it
+    with another annotation is an error, as is storing a constant (or an
+    expression of constants, folded or not) that doesn't fit. A variable
+    declared without an annotation is simply i64: no type is inferred
+    from its value.
+
+    The back ends work from these and never look a name up themselves.
+    A `let` only declares a name that isn't visible yet, so no local ever
+    hides another: leaving a scope simply forgets its symbols.
+*/
+
+// Forward Declarations
+int resolve_names(Node* program, FILE* errors);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <stddef.h>
+
+#include "ast.h"
+
+/*
+    Integer widths. A variable can be declared with one (`let x: u8 = 1`);
+    without one it is i64. Every value is computed in 64 bits with the
+    usual wrapping arithmetic, and stored into a narrower variable it is
+    wrapped to that width, so the variable only ever holds values of its
+    type. The exceptions are division and comparisons, which are unsigned
+    when either operand is a u64.
+
+    resolve_names works out the types (see symbols.h); the back ends use
+    them to store narrow variables compactly and to skip wrapping a value
+    that is known to fit already.
+*/
+typedef enum IntType {
+    TYPE_NONE,      // No annotation (a LET), or not worked out
+    TYPE_I8,
+    TYPE_I16,
+    TYPE_I32,
+    TYPE_I64,
+    TYPE_U8,
+    TYPE_U16,
+    TYPE_U32,
+    TYPE_U64,
+    TYPE_COUNT      // Number of types, not a type
+} IntType;
+
+// Forward Declarations
+IntType type_named(const char* name, size_t length);
+const char* type_name(IntType type);
+const char* type_c_name(IntType type);
+int type_bits(IntType type);
+int type_is_unsigned(IntType type);
+long type_wrap(IntType type, long value);
+int type_fits(IntType type, long value);
+int type_within(IntType inner, IntType outer);
+int type_narrows(IntType type, const Node* value);
+int type_unsigned_operands(const Node* node);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "writer.h"
+
+/*
+    A register-based bytecode for running Serrate without a C compiler
+    (serrate --run). Programs behave exactly like the generated C (see
+    codegen.h): wrapping arithmetic, narrow variables wrapped when they're
+    stored, and a division by zero stops the program with "serrate:
+    division by zero".
+
+    Every function has its own register window. Locals live in registers
+    for as long as their block lasts, temporaries above them; globals are
+    a separate array. Function 0 runs the top-level statements and then
+    calls main, like sr_program.
+
+    The interpreter dispatches with computed goto where the compiler
+    supports it; build with -DVM_SWITCH_DISPATCH for a plain switch.
+*/
+#define VM_MAX_REGISTERS 65536  // Register operands are 16 bits
+
+typedef enum VmOpcode {
+    OP_MOVE,    // R[a] = R[b]
+    OP_LOADI,   // R[a] = immediate
+    OP_LOADK,   // R[a] = constants[index]
+    OP_GETG,    // R[a] = globals[index]
+    OP_SETG,    // globals[index] = R[a]
+    OP_ADD,     // R[a] = R[b] op R[c]
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_DIVU,    // Unsigned
+    OP_LT,      // R[a] = R[b] op R[c] ? 1 : 0 (> and >= swap b and c)
+    OP_LE,
+    OP_EQ,
+    OP_NE,
+    OP_LTU,     // Unsigned
+    OP_LEU,
+    OP_ADDI,    // R[a] = R[b] op small, with small a signed 16-bit constant
+    OP_SUBI,
+    OP_MULI,
+    OP_DIVI,    // Never 0 or -1, so it needs no checks
+    OP_NEG,     // R[a] = -R[b]
+    OP_NARROW,  // R[a] = R[b] wrapped to the width of type c (an IntType, see types.h)
+    OP_JUMP,    // Continue at code[index]
+    OP_JUMPZ,   // Continue at code[index] if R[a] == 0
+    OP_JUMPNZ,  // Continue at code[index] if R[a] != 0
+    OP_CALL,    // R[a] = functions[index]()
+    OP_RETURN,  // Return R[a] to the caller
+    OP_COUNT
+} VmOpcode;
+
+typedef struct VmInstruction {
+    uint8_t op;
+    uint16_t a;
+    union {
+        struct {
+            uint16_t b;
+            union { uint16_t c; int16_t small; };
+        };
+        int32_t immediate;  // LOADI
+        uint32_t index;     // LOADK, GETG, SETG, CALL and jump targets
+    };
+} VmInstruction;    // 8 bytes
+
+typedef struct VmFunction {
+    const char* name;   // Interned; NULL for the top level
+    VmInstruction* code;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t registers; // Size of the register window
+} VmFunction;
+
+typedef struct VmProgram {
+    VmFunction* functions;  // [0] is the top level
+    uint32_t function_count;
+    long* constants;        // Values too big for an immediate
+    uint32_t constant_count;
+    uint32_t global_count;
+} VmProgram;
+
+// Forward Declarations
+int vm_compile(VmProgram* program, const Node* ast, FILE* errors);
+int vm_run(const VmProgram* program, long* result, FILE* errors);
+void vm_disassemble(const VmProgram* program, Writer* out);
+void vm_program_free(VmProgram* program);
+
+#endif
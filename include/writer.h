@@ -0,0 +1,39 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+    Buffered text output. Everything is collected in a large buffer and
+    handed to `out` in big writes, instead of one stdio call per piece.
+    Without an `out` the buffer just grows, and writer_take hands the
+    whole text over at the end.
+*/
+typedef struct Writer {
+    FILE* out;              // NULL for an in-memory writer
+    char* buffer;
+    size_t length;
+    size_t capacity;
+} Writer;
+
+// Forward Declarations
+void writer_init(Writer* writer, FILE* out);
+void writer_flush(Writer* writer);
+void writer_free(Writer* writer);
+char* writer_take(Writer* writer, size_t* length);
+void writer_write(Writer* writer, const char* data, size_t length);
+void writer_long(Writer* writer, long value);
+void writer_indent(Writer* writer, int depth);
+
+
+static inline void writer_char(Writer* writer, char c) {
+    if (writer->length == writer->capacity) writer_flush(writer);
+    writer->buffer[writer->length++] = c;
+}
+
+static inline void writer_string(Writer* writer, const char* string) {
+    while (*string) writer_char(writer, *string++);
+}
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGNMENT     16
+#define ARENA_DEFAULT_CHUNK (64 * 1024)
+
+// Round size up to the arena alignment
+static inline size_t align_up(size_t size) {
+    return (size + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// Usable memory starts right after the (aligned) chunk header
+static inline char* chunk_data(ArenaChunk* chunk) {
+    return (char*)chunk + align_up(sizeof(ArenaChunk));
+}
+
+
+// Get a fresh chunk from malloc that can hold at least `size` bytes
+static ArenaChunk* new_chunk(Arena* arena, size_t size) {
+    ArenaChunk* chunk = malloc(align_up(sizeof(ArenaChunk)) + size);
+    if (!chunk) {
+        fprintf(stderr, "Out of memory allocating arena chunk\n");
+        exit(1);
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    arena->bytes_reserved += size;
+    arena->chunk_count++;
+    return chunk;
+}
+
+
+// Set up an empty arena. Chunks are only allocated on first use.
+void arena_init(Arena* arena, size_t chunk_size) {
+    arena->head = NULL;
+    arena->chunk_size = chunk_size ? align_up(chunk_size) : ARENA_DEFAULT_CHUNK;
+    arena->last = NULL;
+
+    arena->allocations = 0;
+    arena->bytes_allocated = 0;
+    arena->bytes_reserved = 0;
+    arena->chunk_count = 0;
+}
+
+
+/*
+    Bump `size` bytes off the head chunk. Requests bigger than a quarter
+    of a chunk get a dedicated chunk that is linked in behind the head,
+    so the remaining space in the head chunk isn't thrown away.
+*/
+void* arena_alloc(Arena* arena, size_t size) {
+    size_t needed = align_up(size ? size : 1);
+    arena->allocations++;
+    arena->bytes_allocated += size;
+
+    ArenaChunk* head = arena->head;
+    if (head && head->size - head->used >= needed) {
+        void* pointer = chunk_data(head) + head->used;
+        head->used += needed;
+        arena->last = pointer;
+        return pointer;
+    }
+
+    if (needed > arena->chunk_size / 4) {
+        ArenaChunk* chunk = new_chunk(arena, needed);
+        chunk->used = needed;
+        if (head) {
+            chunk->next = head->next;
+            head->next = chunk;
+        } else {
+            arena->head = chunk;
+        }
+        arena->last = NULL; // Not at the bump position of the head chunk
+        return chunk_data(chunk);
+    }
+
+    ArenaChunk* chunk = new_chunk(arena, arena->chunk_size);
+    chunk->next = head;
+    arena->head = chunk;
+
+    chunk->used = needed;
+    arena->last = chunk_data(chunk);
+    return arena->last;
+}
+
+
+/*
+    Resize an allocation. If `ptr` is the most recent allocation in the
+    head chunk it is extended in place, otherwise the contents are copied
+    into a new block (the old block is simply abandoned until arena_free).
+*/
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_alloc(arena, new_size);
+    if (new_size <= old_size) return ptr;
+
+    ArenaChunk* head = arena->head;
+    if (ptr == arena->last) {
+        size_t offset = (size_t)((char*)ptr - chunk_data(head));
+        size_t needed = align_up(new_size);
+        if (head->size - offset >= needed) {
+            head->used = offset + needed;
+            arena->bytes_allocated += new_size - old_size;
+            return ptr;
+        }
+    }
+
+    void* pointer = arena_alloc(arena, new_size);
+    memcpy(pointer, ptr, old_size);
+    return pointer;
+}
+
+
+// Copy `length` bytes of a string into the arena and NUL-terminate it
+char* arena_strndup(Arena* arena, const char* string, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+
+/*
+    Move every chunk of `other` into `arena`, so one arena_free releases
+    both. The chunks go behind the head, which keeps bumping where it was.
+    `other` is left empty.
+*/
+void arena_adopt(Arena* arena, Arena* other) {
+    if (!other->head) return;
+
+    ArenaChunk* tail = other->head;
+    while (tail->next) tail = tail->next;
+
+    if (arena->head) {
+        tail->next = arena->head->next;
+        arena->head->next = other->head;
+    } else {
+        arena->head = other->head;
+        arena->last = NULL;
+    }
+
+    arena->allocations += other->allocations;
+    arena->bytes_allocated += other->bytes_allocated;
+    arena->bytes_reserved += other->bytes_reserved;
+    arena->chunk_count += other->chunk_count;
+
+    other->head = NULL;
+    arena_free(other);
+}
+
+
+// Release every chunk at once. The arena can be reused afterwards.
+void arena_free(Arena* arena) {
+    ArenaChunk* chunk = arena->head;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena_init(arena, arena->chunk_size);
+}
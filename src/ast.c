@@ -3,37 +3,129 @@
 #include <string.h>
 
 #include "ast.h"
+#include "intern.h"
+
+/*
+    When an arena is set (per thread), every constructor below allocates
+    from it and the whole tree is released with a single arena_free.
+    Without one, nodes come from malloc and are released by free_ast.
+*/
+static _Thread_local Arena* current_arena = NULL;
+static _Thread_local AstStats stats;
+
+
+// Route AST allocations on this thread to `arena` (NULL for malloc)
+void ast_use_arena(Arena* arena) {
+    current_arena = arena;
+}
+
+// The arena AST allocations on this thread go to, or NULL
+Arena* ast_arena(void) {
+    return current_arena;
+}
+
+// Make every node under `node` that belongs to `from` belong to `to`, before `from` is adopted into it
+void ast_move_arena(Node* node, const Arena* from, Arena* to) {
+    if (!node) return;
+    if (node->arena == from) node->arena = to;
+    ast_move_arena(node->condition, from, to);
+    for (int i = 0; i < node->children_count; i++) ast_move_arena(node->children[i], from, to);
+}
+
+// Allocation counters for this thread
+AstStats* ast_stats(void) {
+    return &stats;
+}
+
+// Add the counters in `stats` to `total`
+void ast_stats_add(AstStats* total, const AstStats* stats) {
+    total->node_allocations += stats->node_allocations;
+    total->child_reallocations += stats->child_reallocations;
+    total->bytes += stats->bytes;
+    total->mallocs += stats->mallocs;
+    total->reallocs += stats->reallocs;
+    for (int i = 0; i < AST_NODE_TYPE_COUNT; i++) total->nodes_by_type[i] += stats->nodes_by_type[i];
+}
+
+// Name of a node type, as fprint_ast writes it
+const char* ast_node_type_name(NodeType type) {
+    switch (type) {
+        case AST_IDENTIFIER:    return "IDENTIFIER";
+        case AST_INTEGER:       return "INTEGER";
+        case AST_PROGRAM:       return "PROGRAM";
+        case AST_FUNC:          return "FUNC";
+        case AST_LET:           return "LET";
+        case AST_IF:            return "IF";
+        case AST_WHILE:         return "WHILE";
+        case AST_RETURN:        return "RETURN";
+        case AST_BINOP:         return "BINOP";
+        case AST_UNARY:         return "UNARY";
+        default:                return "UNKNOWN";
+    }
+}
+
+// How an operator is spelled in the source
+const char* ast_operator_name(char op) {
+    switch (op) {
+        case '+':                   return "+";
+        case '-':                   return "-";
+        case '*':                   return "*";
+        case '/':                   return "/";
+        case '<':                   return "<";
+        case '>':                   return ">";
+        case AST_OP_LESS_EQUAL:     return "<=";
+        case AST_OP_GREATER_EQUAL:  return ">=";
+        case AST_OP_EQUAL:          return "==";
+        case AST_OP_NOT_EQUAL:      return "!=";
+        default:                    return "?";
+    }
+}
+
 
 // Create a new Node wih given type
 Node* new_node(NodeType type) {
-    Node* node = malloc(sizeof(Node));
-    if (!node) {
-        fprintf(stderr, "Out of memory allocating Node\n");
-        exit(1);
+    Node* node;
+    if (current_arena) {
+        node = arena_alloc(current_arena, sizeof(Node));
+    } else {
+        node = malloc(sizeof(Node));
+        if (!node) {
+            fprintf(stderr, "Out of memory allocating Node\n");
+            exit(1);
+        }
+        stats.mallocs++;
     }
+    stats.node_allocations++;
+    stats.nodes_by_type[type]++;
+    stats.bytes += sizeof(Node);
 
     node->node = type;
     node->name = NULL;
     node->value = 0;
+    node->slot = -1;
     node->condition = NULL;
     node->children = NULL;
     node->children_count = 0;
+    node->children_capacity = 0;
     node->op = 0;
+    node->arena = current_arena;
+    node->type = 0;
+    node->depth = -1;
 
     return node;
 }
 
 // Create an integer literal Node
-Node* new_int_node(int value) {
+Node* new_int_node(long value) {
     Node* node = new_node(AST_INTEGER);
     node->value = value;
     return node;
 }
 
-// Create an identifier Node
+// Create an identifier Node. `name` must come from intern(), it is shared, not copied.
 Node* new_identifier_node(const char* name) {
     Node* node = new_node(AST_IDENTIFIER);
-    node->name = strdup(name);
+    node->name = name;
     return node;
 }
 
@@ -46,18 +138,42 @@ Node* new_binop_node(char op, Node* left, Node* right) {
     return node;
 }
 
-// Add a child Node to a parent Node
+/*
+    Add a child Node to a parent Node. The child array doubles when it is
+    full, so appending N statements to a body costs O(log N) resizes
+    instead of one realloc (and copy) per child. An arena node's array
+    grows in the arena the node came from, whichever one (if any) this
+    thread is using now.
+*/
 void add_child(Node* parent, Node* child) {
-    parent->children = realloc(parent->children, sizeof(Node*) * (parent->children_count + 1));
+    if (parent->children_count == parent->children_capacity) {
+        int capacity = parent->children_capacity ? parent->children_capacity * 2 : 2;
+        size_t old_size = sizeof(Node*) * parent->children_capacity;
+        size_t new_size = sizeof(Node*) * capacity;
+
+        if (parent->arena) {
+            parent->children = arena_grow(parent->arena, parent->children, old_size, new_size);
+        } else {
+            parent->children = realloc(parent->children, new_size);
+            if (!parent->children) {
+                fprintf(stderr, "Out of memory allocating children\n");
+                exit(1);
+            }
+            stats.reallocs++;
+        }
+        parent->children_capacity = capacity;
+        stats.child_reallocations++;
+        stats.bytes += new_size;
+    }
+
     parent->children[parent->children_count++] = child;
 }
 
+
 // Recursively free allocated memory from AST
+// Arena nodes are skipped, they are released together by arena_free.
 void free_ast(Node* node) {
-    if (!node) return;
-
-    // Fre name if it exists
-    if (node->name) free(node->name);
+    if (!node || node->arena) return;
 
     // Free any children
     for (int i = 0; i < node->children_count; i++) free_ast(node->children[i]);
@@ -68,4 +184,20 @@ void free_ast(Node* node) {
     // free(node->body);
 
     free(node);
-}
\ No newline at end of file
+}
+
+
+// Report allocation counters (and arena usage, if one was used)
+void print_alloc_stats(FILE* out, const Arena* arena) {
+    fprintf(out, "Allocations: %zu nodes, %zu child resizes, %zu bytes requested\n",
+        stats.node_allocations, stats.child_reallocations, stats.bytes);
+
+    if (arena) {
+        fprintf(out, "Arena: %zu allocations, %zu bytes used, %zu bytes reserved in %zu chunks\n",
+            arena->allocations, arena->bytes_allocated, arena->bytes_reserved, arena->chunk_count);
+    }
+
+    InternTable* names = intern_table();
+    fprintf(out, "Names: %u interned from %zu lookups, %zu bytes\n",
+        names->count, names->lookups, names->strings.bytes_allocated);
+}
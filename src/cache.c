@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define CACHE_INITIAL_BUCKETS 256
+
+
+// malloc'd copy of `size` bytes (never NULL, even for size 0)
+static char* copy_bytes(const char* data, size_t size) {
+    char* copy = malloc(size ? size : 1);
+    if (!copy) {
+        fprintf(stderr, "Out of memory allocating cache entry\n");
+        exit(1);
+    }
+    if (size) memcpy(copy, data, size);
+    return copy;
+}
+
+static size_t entry_bytes(const CacheEntry* entry) {
+    return sizeof(CacheEntry) + entry->source_size + entry->out_size + entry->err_size + entry->output_size;
+}
+
+
+/*
+    Recency List
+*/
+static void unlink_entry(CompileCache* cache, CacheEntry* entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+}
+
+static void push_newest(CompileCache* cache, CacheEntry* entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) cache->newest->newer = entry;
+    else cache->oldest = entry;
+    cache->newest = entry;
+}
+
+
+// Take `entry` out of its bucket and the recency list and free it
+static void drop_entry(CompileCache* cache, CacheEntry* entry) {
+    CacheEntry** link = &cache->buckets[entry->key & (cache->bucket_count - 1)];
+    while (*link != entry) link = &(*link)->next_in_bucket;
+    *link = entry->next_in_bucket;
+
+    unlink_entry(cache, entry);
+    cache->bytes -= entry_bytes(entry);
+    cache->count--;
+
+    free(entry->source);
+    free(entry->out);
+    free(entry->err);
+    free(entry->output);
+    free(entry);
+}
+
+// Double the bucket array and rehash every entry
+static void grow_buckets(CompileCache* cache) {
+    uint32_t bucket_count = cache->bucket_count * 2;
+    CacheEntry** buckets = calloc(bucket_count, sizeof(CacheEntry*));
+    if (!buckets) {
+        fprintf(stderr, "Out of memory growing cache\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < cache->bucket_count; i++) {
+        CacheEntry* entry = cache->buckets[i];
+        while (entry) {
+            CacheEntry* next = entry->next_in_bucket;
+            CacheEntry** bucket = &buckets[entry->key & (bucket_count - 1)];
+            entry->next_in_bucket = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+static CacheEntry* find(CompileCache* cache, uint64_t key, const char* source, size_t source_size) {
+    CacheEntry* entry = cache->buckets[key & (cache->bucket_count - 1)];
+    for (; entry; entry = entry->next_in_bucket)
+        if (entry->key == key && entry->source_size == source_size && !memcmp(entry->source, source, source_size))
+            return entry;
+    return NULL;
+}
+
+
+// Set up an empty cache that holds at most about `budget` bytes
+void cache_init(CompileCache* cache, size_t budget) {
+    cache->buckets = calloc(CACHE_INITIAL_BUCKETS, sizeof(CacheEntry*));
+    if (!cache->buckets) {
+        fprintf(stderr, "Out of memory allocating cache\n");
+        exit(1);
+    }
+    cache->bucket_count = CACHE_INITIAL_BUCKETS;
+    cache->count = 0;
+    cache->newest = cache->oldest = NULL;
+    cache->bytes = 0;
+    cache->budget = budget;
+    cache->hits = cache->misses = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+
+// FNV-1a (64-bit) over `data`, seeded with `variant`
+uint64_t cache_key(const char* data, size_t size, uint64_t variant) {
+    uint64_t hash = 14695981039346656037ull ^ variant;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// Copy the stored result for `source` into `result`. Returns 1 on a hit, 0 on a miss.
+int cache_lookup(CompileCache* cache, uint64_t key, const char* source, size_t source_size, CacheResult* result) {
+    pthread_mutex_lock(&cache->lock);
+
+    CacheEntry* entry = find(cache, key, source, source_size);
+    if (entry) {
+        unlink_entry(cache, entry);
+        push_newest(cache, entry);
+
+        result->out = copy_bytes(entry->out, entry->out_size);
+        result->out_size = entry->out_size;
+        result->err = copy_bytes(entry->err, entry->err_size);
+        result->err_size = entry->err_size;
+        result->output = copy_bytes(entry->output, entry->output_size);
+        result->output_size = entry->output_size;
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return entry != NULL;
+}
+
+
+// Remember `result` for `source`, replacing any older result and evicting the least recently used ones
+void cache_store(CompileCache* cache, uint64_t key, const char* source, size_t source_size, const CacheResult* result) {
+    CacheEntry* entry = malloc(sizeof(CacheEntry));
+    if (!entry) {
+        fprintf(stderr, "Out of memory allocating cache entry\n");
+        exit(1);
+    }
+    entry->key = key;
+    entry->source = copy_bytes(source, source_size);
+    entry->source_size = source_size;
+    entry->out = copy_bytes(result->out, result->out_size);
+    entry->out_size = result->out_size;
+    entry->err = copy_bytes(result->err, result->err_size);
+    entry->err_size = result->err_size;
+    entry->output = copy_bytes(result->output, result->output_size);
+    entry->output_size = result->output_size;
+
+    pthread_mutex_lock(&cache->lock);
+
+    CacheEntry* old = find(cache, key, source, source_size);
+    if (old) drop_entry(cache, old);
+    if (cache->count >= cache->bucket_count) grow_buckets(cache);
+
+    CacheEntry** bucket = &cache->buckets[key & (cache->bucket_count - 1)];
+    entry->next_in_bucket = *bucket;
+    *bucket = entry;
+    push_newest(cache, entry);
+    cache->bytes += entry_bytes(entry);
+    cache->count++;
+
+    // The newest entry always stays, even if it alone is over budget
+    while (cache->bytes > cache->budget && cache->oldest != entry)
+        drop_entry(cache, cache->oldest);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+void cache_result_free(CacheResult* result) {
+    free(result->out);
+    free(result->err);
+    free(result->output);
+    memset(result, 0, sizeof(*result));
+}
+
+
+// Drop every entry
+void cache_free(CompileCache* cache) {
+    while (cache->oldest) drop_entry(cache, cache->oldest);
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->bucket_count = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,304 @@
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "types.h"
+
+/*
+    Names are prefixed so no Serrate name can collide with C keywords or
+    the library: variables become v_name, functions f_name. A variable is
+    declared with the C type of its width (see types.h), so storing into
+    it is what wraps the value, as gcc and clang define the conversion.
+*/
+typedef struct CodeGen {
+    Writer* out;
+    FILE* errors;
+    int error_count;
+
+    uint8_t* declared;  // Per local slot of the function being written: declared yet
+    int slots;          // Size of `declared`
+
+    int depth;          // Current block depth
+} CodeGen;
+
+// Runtime support every generated file starts with
+static const char* prelude =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "\n"
+    "static inline long sr_add(long a, long b) { return (long)((unsigned long)a + (unsigned long)b); }\n"
+    "static inline long sr_sub(long a, long b) { return (long)((unsigned long)a - (unsigned long)b); }\n"
+    "static inline long sr_mul(long a, long b) { return (long)((unsigned long)a * (unsigned long)b); }\n"
+    "static inline long sr_neg(long a) { return (long)(0ul - (unsigned long)a); }\n"
+    "static inline long sr_div(long a, long b) {\n"
+    "    if (b == 0) { fputs(\"serrate: division by zero\\n\", stderr); exit(1); }\n"
+    "    return b == -1 ? sr_neg(a) : a / b;\n"
+    "}\n"
+    "static inline long sr_divu(unsigned long a, unsigned long b) {\n"
+    "    if (b == 0) { fputs(\"serrate: division by zero\\n\", stderr); exit(1); }\n"
+    "    return (long)(a / b);\n"
+    "}\n";
+
+
+static void error(CodeGen* gen, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(gen->errors, format, arguments);
+    va_end(arguments);
+    gen->error_count++;
+}
+
+// Four spaces per block level
+static void indent(CodeGen* gen) {
+    writer_indent(gen->out, gen->depth * 2);
+}
+
+
+/*
+    Scopes: names are resolved already (see symbols.h), all that's left is
+    knowing which let of a local is the one that declares it.
+*/
+static int declares(CodeGen* gen, const Node* variable) {
+    if (variable->depth <= 0) return 0;
+    if (variable->slot >= gen->slots) {
+        int slots = gen->slots ? gen->slots : 64;
+        while (slots <= variable->slot) slots *= 2;
+        gen->declared = realloc(gen->declared, slots);
+        if (!gen->declared) {
+            fprintf(stderr, "Out of memory generating code\n");
+            exit(1);
+        }
+        memset(gen->declared + gen->slots, 0, slots - gen->slots);
+        gen->slots = slots;
+    }
+    if (gen->declared[variable->slot]) return 0;
+    gen->declared[variable->slot] = 1;
+    return 1;
+}
+
+// A function's locals are numbered from 0 again
+static void begin_function(CodeGen* gen) {
+    if (gen->declared) memset(gen->declared, 0, gen->slots);
+}
+
+
+/*
+    Expressions
+*/
+static void name(CodeGen* gen, char prefix, const char* name) {
+    writer_char(gen->out, prefix);
+    writer_char(gen->out, '_');
+    writer_string(gen->out, name);
+}
+
+static void expression(CodeGen* gen, const Node* node);
+
+// A comparison is C's own, with both sides unsigned if either is a u64
+static void comparison(CodeGen* gen, const Node* node) {
+    const char* cast = type_unsigned_operands(node) ? "(unsigned long)" : "";
+    writer_char(gen->out, '(');
+    writer_string(gen->out, cast);
+    expression(gen, node->children_count > 0 ? node->children[0] : NULL);
+    writer_char(gen->out, ' ');
+    writer_string(gen->out, ast_operator_name(node->op));
+    writer_char(gen->out, ' ');
+    writer_string(gen->out, cast);
+    expression(gen, node->children_count > 1 ? node->children[1] : NULL);
+    writer_char(gen->out, ')');
+}
+
+static void expression(CodeGen* gen, const Node* node) {
+    if (!node) { error(gen, "Missing expression\n"); return; }
+
+    switch (node->node) {
+        case AST_INTEGER:
+            // -9223372036854775808L would negate a constant too big for long
+            if (node->value == LONG_MIN) { writer_string(gen->out, "(-9223372036854775807L - 1)"); break; }
+            writer_long(gen->out, node->value);
+            writer_char(gen->out, 'L');
+            break;
+
+        case AST_IDENTIFIER:
+            name(gen, 'v', node->name);
+            break;
+
+        case AST_UNARY:
+            writer_string(gen->out, "sr_neg(");
+            expression(gen, node->children_count > 0 ? node->children[0] : NULL);
+            writer_char(gen->out, ')');
+            break;
+
+        case AST_BINOP: {
+            if (ast_is_comparison(node->op)) {
+                comparison(gen, node);
+                break;
+            }
+            const char* helper;
+            switch (node->op) {
+                case '+': helper = "sr_add("; break;
+                case '-': helper = "sr_sub("; break;
+                case '*': helper = "sr_mul("; break;
+                case '/': helper = node->type == TYPE_U64 ? "sr_divu(" : "sr_div("; break;
+                default:  error(gen, "Unknown operator '%c'\n", node->op); return;
+            }
+            writer_string(gen->out, helper);
+            expression(gen, node->children_count > 0 ? node->children[0] : NULL);
+            writer_string(gen->out, ", ");
+            expression(gen, node->children_count > 1 ? node->children[1] : NULL);
+            writer_char(gen->out, ')');
+            break;
+        }
+
+        default:
+            error(gen, "Expected an expression, found %s\n", ast_node_type_name(node->node));
+            break;
+    }
+}
+
+
+/*
+    Statements
+*/
+static void statement(CodeGen* gen, const Node* node);
+
+static void block(CodeGen* gen, const Node* node) {
+    writer_string(gen->out, " {\n");
+    gen->depth++;
+    for (int i = 0; i < node->children_count; i++) statement(gen, node->children[i]);
+    gen->depth--;
+    indent(gen);
+    writer_string(gen->out, "}\n");
+}
+
+static void statement(CodeGen* gen, const Node* node) {
+    if (!node) return;
+    indent(gen);
+
+    switch (node->node) {
+        case AST_LET: {
+            const Node* variable = node->children[0];
+            if (declares(gen, variable)) {
+                writer_string(gen->out, type_c_name((IntType)variable->type));
+                writer_char(gen->out, ' ');
+            }
+            name(gen, 'v', variable->name);
+            writer_string(gen->out, " = ");
+            expression(gen, node->children_count > 1 ? node->children[1] : NULL);
+            writer_string(gen->out, ";\n");
+            break;
+        }
+
+        case AST_IF:
+        case AST_WHILE:
+            writer_string(gen->out, node->node == AST_IF ? "if (" : "while (");
+            expression(gen, node->condition);
+            writer_char(gen->out, ')');
+            block(gen, node);
+            break;
+
+        case AST_RETURN:
+            writer_string(gen->out, "return ");
+            expression(gen, node->children_count > 0 ? node->children[0] : NULL);
+            writer_string(gen->out, ";\n");
+            break;
+
+        case AST_FUNC:
+            error(gen, "Function '%s' must be defined at the top level\n", node->children[0]->name);
+            writer_char(gen->out, '\n');
+            break;
+
+        default:
+            writer_string(gen->out, "(void)");
+            expression(gen, node);
+            writer_string(gen->out, ";\n");
+            break;
+    }
+}
+
+
+// A top-level func: its name, then its body
+static void function(CodeGen* gen, const Node* node) {
+    writer_string(gen->out, "\nlong ");
+    name(gen, 'f', node->children[0]->name);
+    writer_string(gen->out, "(void) {\n");
+
+    begin_function(gen);
+    gen->depth++;
+    for (int i = 1; i < node->children_count; i++) statement(gen, node->children[i]);
+    indent(gen);
+    writer_string(gen->out, "return 0;\n");
+    gen->depth--;
+
+    writer_string(gen->out, "}\n");
+}
+
+
+/*
+    Write C for a whole program to `out`, once resolve_names has gone over
+    it without errors. Problems are reported to `errors`; returns how many
+    there were (the output is unusable unless 0).
+*/
+int codegen_c(const Node* program, Writer* out, FILE* errors) {
+    CodeGen gen = { 0 };
+    gen.out = out;
+    gen.errors = errors;
+    int has_main = program->slot > 0;  // Found by resolve_names
+
+    writer_string(out, "/* Generated by serrate */\n");
+    writer_string(out, prelude);
+
+    // Prototypes, so functions can appear in any order
+    writer_char(out, '\n');
+    for (int i = 0; i < program->children_count; i++) {
+        const Node* node = program->children[i];
+        if (!node || node->node != AST_FUNC) continue;
+
+        const Node* function_name = node->children[0];
+        if (function_name->slot < 0) continue;  // A duplicate
+
+        writer_string(out, "long ");
+        name(&gen, 'f', function_name->name);
+        writer_string(out, "(void);\n");
+    }
+
+    // Globals: every name a top-level let assigns, numbered in order of its first one
+    writer_char(out, '\n');
+    int globals = 0;
+    for (int i = 0; i < program->children_count; i++) {
+        const Node* node = program->children[i];
+        if (!node || node->node != AST_LET || node->children[0]->slot != globals) continue;
+
+        globals++;
+        writer_string(out, "static ");
+        writer_string(out, type_c_name((IntType)node->children[0]->type));
+        writer_char(out, ' ');
+        name(&gen, 'v', node->children[0]->name);
+        writer_string(out, ";\n");
+    }
+
+    for (int i = 0; i < program->children_count; i++) {
+        const Node* node = program->children[i];
+        if (node && node->node == AST_FUNC && node->children[0]->slot >= 0) function(&gen, node);
+    }
+
+    // The top-level statements, then main
+    writer_string(out, "\nstatic long sr_program(void) {\n");
+    begin_function(&gen);
+    gen.depth++;
+    for (int i = 0; i < program->children_count; i++) {
+        const Node* node = program->children[i];
+        if (node && node->node != AST_FUNC) statement(&gen, node);
+    }
+    indent(&gen);
+    writer_string(out, has_main ? "return f_main();\n" : "return 0;\n");
+    gen.depth--;
+    writer_string(out, "}\n\nint main(void) {\n    return (int)sr_program();\n}\n");
+
+    free(gen.declared);
+    return gen.error_count;
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "codegen.h"
+#include "regalloc.h"
+#include "types.h"
+#include "vm.h"
+
+/*
+    The program comes as bytecode, so scoping and semantics are the VM's,
+    and every bytecode instruction becomes a few x86-64 instructions. A VM
+    register lives in the machine register the allocator gave it (see
+    regalloc.h), or else in a stack slot below rbp; globals are in .bss.
+    rax, rcx and rdx are scratch: results the destination can't hold go
+    through rax, and division uses all three.
+*/
+typedef struct AsmGen {
+    Writer* out;
+    const VmProgram* program;
+    uint32_t function;          // Index of the function being written, for labels
+    const uint8_t* location;    // From the RegisterAssignment
+} AsmGen;
+
+// Values can live in these: the ones calls change first, then the ones they preserve
+static const char* const machine_names[] = { "rsi", "rdi", "r8", "r9", "r10", "r11", "rbx", "r12", "r13", "r14", "r15" };
+const RegisterSet asm_registers = { machine_names, sizeof(machine_names) / sizeof(*machine_names), 6 };
+
+// Startup without libc, and the division trap (write to stderr, exit 1)
+static const char* runtime =
+    "\n"
+    "    .globl _start\n"
+    "_start:\n"
+    "    xorl %ebp, %ebp\n"
+    "    call sr_program\n"
+    "    movq %rax, %rdi\n"
+    "    movl $60, %eax\n"
+    "    syscall\n"
+    "\n"
+    "sr_divide_by_zero:\n"
+    "    movl $1, %eax\n"
+    "    movl $2, %edi\n"
+    "    leaq sr_message(%rip), %rsi\n"
+    "    movl $sr_message_length, %edx\n"
+    "    syscall\n"
+    "    movl $60, %eax\n"
+    "    movl $1, %edi\n"
+    "    syscall\n"
+    "\n"
+    "    .section .rodata\n"
+    "sr_message:\n"
+    "    .ascii \"serrate: division by zero\\n\"\n"
+    "    .set sr_message_length, . - sr_message\n";
+
+
+static void line(AsmGen* gen, const char* text) {
+    writer_string(gen->out, "    ");
+    writer_string(gen->out, text);
+}
+
+static void slot(AsmGen* gen, long index) {
+    writer_long(gen->out, -8L * (index + 1));
+    writer_string(gen->out, "(%rbp)");
+}
+
+static void global(AsmGen* gen, uint32_t index) {
+    writer_string(gen->out, "sr_globals+");
+    writer_long(gen->out, 8L * index);
+    writer_string(gen->out, "(%rip)");
+}
+
+static void label(AsmGen* gen, uint32_t instruction) {
+    writer_string(gen->out, ".L");
+    writer_long(gen->out, gen->function);
+    writer_char(gen->out, '_');
+    writer_long(gen->out, instruction);
+}
+
+static void function_name(AsmGen* gen, uint32_t index) {
+    const char* name = gen->program->functions[index].name;
+    if (!name) {
+        writer_string(gen->out, "sr_program");
+        return;
+    }
+    writer_string(gen->out, "f_");
+    writer_string(gen->out, name);
+}
+
+// The machine register VM register `reg` lives in, or NULL
+static const char* where(AsmGen* gen, int reg) {
+    uint8_t location = gen->location[reg];
+    return location == REGALLOC_SPILLED ? NULL : machine_names[location];
+}
+
+static void machine(AsmGen* gen, const char* name) {
+    writer_char(gen->out, '%');
+    writer_string(gen->out, name);
+}
+
+// VM register `reg`: its machine register or its slot
+static void operand(AsmGen* gen, int reg) {
+    const char* name = where(gen, reg);
+    if (name) machine(gen, name);
+    else slot(gen, reg);
+}
+
+// `instruction` VM register `reg`, machine register `name`
+static void from(AsmGen* gen, const char* instruction, int reg, const char* name) {
+    line(gen, instruction);
+    operand(gen, reg);
+    writer_string(gen->out, ", ");
+    machine(gen, name);
+    writer_char(gen->out, '\n');
+}
+
+// `instruction` $value, then `rest`
+static void immediate(AsmGen* gen, const char* instruction, long value, const char* rest) {
+    line(gen, instruction);
+    writer_char(gen->out, '$');
+    writer_long(gen->out, value);
+    writer_string(gen->out, rest);
+}
+
+static void load(AsmGen* gen, const char* name, int reg) {
+    if (where(gen, reg) != name) from(gen, "movq ", reg, name);
+}
+
+static void store(AsmGen* gen, int reg, const char* name) {
+    if (where(gen, reg) == name) return;
+    line(gen, "movq ");
+    machine(gen, name);
+    writer_string(gen->out, ", ");
+    operand(gen, reg);
+    writer_char(gen->out, '\n');
+}
+
+// Where to compute a result for `reg`: its own register, or rax
+static const char* target(AsmGen* gen, int reg) {
+    const char* name = where(gen, reg);
+    return name ? name : "rax";
+}
+
+// Save (or restore) the preserved registers the function uses, in slots after its VM registers'
+static void save(AsmGen* gen, const VmFunction* function, uint32_t saved, int restore) {
+    long index = function->registers;
+    for (uint32_t i = 0; i < asm_registers.count; i++) {
+        if (!(saved & (1u << i))) continue;
+        line(gen, "movq ");
+        if (restore) slot(gen, index);
+        else machine(gen, machine_names[i]);
+        writer_string(gen->out, ", ");
+        if (restore) machine(gen, machine_names[i]);
+        else slot(gen, index);
+        writer_char(gen->out, '\n');
+        index++;
+    }
+}
+
+
+static void function(AsmGen* gen, uint32_t index) {
+    const VmFunction* function = &gen->program->functions[index];
+    Writer* out = gen->out;
+    RegisterAssignment assignment;
+    regalloc(&assignment, function, &asm_registers);
+    gen->function = index;
+    gen->location = assignment.location;
+
+    uint8_t* targets = calloc(function->count + 1, 1);
+    if (!targets) {
+        fprintf(stderr, "Out of memory generating assembly\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < function->count; i++) {
+        VmOpcode op = function->code[i].op;
+        if (op == OP_JUMP || op == OP_JUMPZ || op == OP_JUMPNZ) targets[function->code[i].index] = 1;
+    }
+
+    writer_char(out, '\n');
+    function_name(gen, index);
+    writer_string(out, ":\n");
+    line(gen, "pushq %rbp\n");
+    line(gen, "movq %rsp, %rbp\n");
+    long slots = function->registers + __builtin_popcount(assignment.saved);
+    immediate(gen, "subq ", (slots * 8 + 15) & ~15L, ", %rsp\n");
+    save(gen, function, assignment.saved, 0);
+
+    for (uint32_t i = 0; i < function->count; i++) {
+        const VmInstruction* in = &function->code[i];
+        if (targets[i]) {
+            label(gen, i);
+            writer_string(out, ":\n");
+        }
+
+        switch ((VmOpcode)in->op) {
+            case OP_MOVE: {
+                const char* name = where(gen, in->a) ? where(gen, in->a) : target(gen, in->b);
+                load(gen, name, in->b);
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_LOADI:
+                immediate(gen, "movq ", in->immediate, ", ");
+                operand(gen, in->a);
+                writer_char(out, '\n');
+                break;
+
+            case OP_LOADK: {
+                const char* name = target(gen, in->a);
+                immediate(gen, "movabsq ", gen->program->constants[in->index], ", ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_GETG: {
+                const char* name = target(gen, in->a);
+                line(gen, "movq ");
+                global(gen, in->index);
+                writer_string(out, ", ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_SETG: {
+                const char* name = target(gen, in->a);
+                load(gen, name, in->a);
+                line(gen, "movq ");
+                machine(gen, name);
+                writer_string(out, ", ");
+                global(gen, in->index);
+                writer_char(out, '\n');
+                break;
+            }
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL: {
+                const char* name = target(gen, in->a);
+                if (name == where(gen, in->c) && in->b != in->c) name = "rax";
+                load(gen, name, in->b);
+                from(gen, in->op == OP_ADD ? "addq " : in->op == OP_SUB ? "subq " : "imulq ", in->c, name);
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_DIV:
+                load(gen, "rcx", in->c);
+                line(gen, "testq %rcx, %rcx\n");
+                line(gen, "jz sr_divide_by_zero\n");
+                load(gen, "rax", in->b);
+                line(gen, "cmpq $-1, %rcx\n");
+                line(gen, "je 1f\n");
+                line(gen, "cqto\n");
+                line(gen, "idivq %rcx\n");
+                line(gen, "jmp 2f\n");
+                writer_string(out, "1:  negq %rax\n");
+                writer_string(out, "2:\n");
+                store(gen, in->a, "rax");
+                break;
+
+            case OP_DIVU:
+                load(gen, "rcx", in->c);
+                line(gen, "testq %rcx, %rcx\n");
+                line(gen, "jz sr_divide_by_zero\n");
+                load(gen, "rax", in->b);
+                line(gen, "xorl %edx, %edx\n");
+                line(gen, "divq %rcx\n");
+                store(gen, in->a, "rax");
+                break;
+
+            case OP_LT:
+            case OP_LE:
+            case OP_EQ:
+            case OP_NE:
+            case OP_LTU:
+            case OP_LEU: {
+                static const char* const sets[OP_COUNT] = {
+                    [OP_LT] = "setl %al\n", [OP_LE] = "setle %al\n", [OP_EQ] = "sete %al\n",
+                    [OP_NE] = "setne %al\n", [OP_LTU] = "setb %al\n", [OP_LEU] = "setbe %al\n",
+                };
+                const char* name = where(gen, in->b);
+                if (!name) load(gen, name = "rcx", in->b);
+                line(gen, "xorl %eax, %eax\n");
+                from(gen, "cmpq ", in->c, name);
+                line(gen, sets[in->op]);
+                store(gen, in->a, "rax");
+                break;
+            }
+
+            case OP_ADDI:
+            case OP_SUBI: {
+                const char* name = target(gen, in->a);
+                load(gen, name, in->b);
+                immediate(gen, in->op == OP_ADDI ? "addq " : "subq ", in->small, ", ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_MULI: {
+                const char* name = target(gen, in->a);
+                immediate(gen, "imulq ", in->small, ", ");
+                operand(gen, in->b);
+                writer_string(out, ", ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_DIVI:
+                load(gen, "rax", in->b);
+                immediate(gen, "movq ", in->small, ", %rcx\n");
+                line(gen, "cqto\n");
+                line(gen, "idivq %rcx\n");
+                store(gen, in->a, "rax");
+                break;
+
+            case OP_NEG: {
+                const char* name = target(gen, in->a);
+                load(gen, name, in->b);
+                line(gen, "negq ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_NARROW: {
+                const char* name = target(gen, in->a);
+                long shift = 64 - type_bits((IntType)in->c);
+                load(gen, name, in->b);
+                immediate(gen, "shlq ", shift, ", ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                immediate(gen, type_is_unsigned((IntType)in->c) ? "shrq " : "sarq ", shift, ", ");
+                machine(gen, name);
+                writer_char(out, '\n');
+                store(gen, in->a, name);
+                break;
+            }
+
+            case OP_JUMP:
+                line(gen, "jmp ");
+                label(gen, in->index);
+                writer_char(out, '\n');
+                break;
+
+            case OP_JUMPZ:
+            case OP_JUMPNZ: {
+                const char* name = where(gen, in->a);
+                if (name) {
+                    line(gen, "testq ");
+                    machine(gen, name);
+                    writer_string(out, ", ");
+                    machine(gen, name);
+                    writer_char(out, '\n');
+                } else {
+                    line(gen, "cmpq $0, ");
+                    slot(gen, in->a);
+                    writer_char(out, '\n');
+                }
+                line(gen, in->op == OP_JUMPZ ? "jz " : "jnz ");
+                label(gen, in->index);
+                writer_char(out, '\n');
+                break;
+            }
+
+            case OP_CALL:
+                line(gen, "call ");
+                function_name(gen, in->index);
+                writer_char(out, '\n');
+                store(gen, in->a, "rax");
+                break;
+
+            case OP_RETURN:
+                load(gen, "rax", in->a);
+                save(gen, function, assignment.saved, 1);
+                line(gen, "leave\n");
+                line(gen, "ret\n");
+                break;
+
+            default:
+                break;
+        }
+    }
+    free(targets);
+    regalloc_free(&assignment);
+}
+
+
+/*
+    Write GNU assembler source (AT&T syntax, x86-64 System V) for a whole
+    program, lowered to bytecode, to `out`.
+*/
+void codegen_asm(const VmProgram* program, Writer* out) {
+    AsmGen gen = { out, program, 0, NULL };
+    writer_string(out, "# Generated by serrate\n");
+    writer_string(out, "    .text\n");
+    for (uint32_t i = 0; i < program->function_count; i++)
+        if (program->functions[i].code) function(&gen, i);
+    writer_string(out, runtime);
+
+    if (program->global_count) {
+        writer_string(out, "\n    .bss\n    .align 8\nsr_globals:\n    .zero ");
+        writer_long(out, 8L * program->global_count);
+        writer_char(out, '\n');
+    }
+    writer_string(out, "\n    .section .note.GNU-stack,\"\",@progbits\n");
+}
@@ -0,0 +1,284 @@
+/*
+
+The compiler daemon and its client.
+
+A request is a RequestHeader followed by `size` bytes holding the working
+directory and then every argument, each NUL-terminated. The client's
+stdout and stderr travel with the header as SCM_RIGHTS, so the daemon
+writes output straight to wherever the client's would have gone. The
+reply is the exit status as an int32_t.
+
+Only the user running the daemon may use it: the socket is created
+private and every peer's uid is checked.
+
+*/
+
+#define _GNU_SOURCE     // accept4, SO_PEERCRED
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "cache.h"
+#include "driver.h"
+
+#define DAEMON_MAGIC        0x31445253u     // "SRD1"
+#define DAEMON_MAX_REQUEST  (1u << 20)      // Bytes of arguments accepted per request
+#define DAEMON_CACHE_BUDGET ((size_t)256 << 20)
+#define DAEMON_RECEIVE_TIMEOUT 5            // Seconds a client gets to send its request
+
+typedef struct RequestHeader {
+    uint32_t magic;
+    uint32_t size;      // Bytes of strings that follow
+} RequestHeader;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal) {
+    (void)signal;
+    stopping = 1;
+}
+
+
+// Receive or send exactly `size` bytes. Returns 0, or -1 on error / end of file.
+static int receive_all(int connection, void* data, size_t size) {
+    char* bytes = data;
+    while (size > 0) {
+        ssize_t n = recv(connection, bytes, size, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+static int send_all(int connection, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size > 0) {
+        ssize_t n = send(connection, bytes, size, MSG_NOSIGNAL);  // The other side may be gone
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+// $SERRATE_SOCKET, or a per-user socket in /tmp
+const char* daemon_socket_path(void) {
+    static char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    const char* configured = getenv("SERRATE_SOCKET");
+    if (configured && *configured) return configured;
+
+    snprintf(path, sizeof(path), "/tmp/serrate-%u.sock", (unsigned)getuid());
+    return path;
+}
+
+static int socket_address(const char* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) return -1;
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+
+/*
+    Daemon
+*/
+
+// Run one request on an accepted connection
+static void serve_client(int client, DaemonCommand command) {
+    // Refuse other users, they would be compiling with our permissions
+    struct ucred peer;
+    socklen_t peer_size = sizeof(peer);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) == -1 || peer.uid != getuid()) return;
+
+    // Requests are served one at a time, so a client that never sends must not hold up the rest
+    struct timeval timeout = { .tv_sec = DAEMON_RECEIVE_TIMEOUT };
+    if (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) return;
+
+    RequestHeader header;
+    union { struct cmsghdr align; char buffer[CMSG_SPACE(2 * sizeof(int))]; } control;
+    struct iovec part = { &header, sizeof(header) };
+    struct msghdr message = { .msg_iov = &part, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer) };
+
+    ssize_t received = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+    if (received <= 0) return;     // Timed out or gone; `control` was never filled in
+    struct cmsghdr* fds = CMSG_FIRSTHDR(&message);
+    if (!fds || fds->cmsg_level != SOL_SOCKET || fds->cmsg_type != SCM_RIGHTS || fds->cmsg_len != CMSG_LEN(2 * sizeof(int))) return;
+
+    int streams[2];
+    memcpy(streams, CMSG_DATA(fds), sizeof(streams));
+
+    char* strings = NULL;
+    if (received != sizeof(header) || header.magic != DAEMON_MAGIC || header.size == 0 || header.size > DAEMON_MAX_REQUEST
+        || !(strings = malloc(header.size)) || receive_all(client, strings, header.size) == -1 || strings[header.size - 1] != '\0') {
+        free(strings);
+        close(streams[0]);
+        close(streams[1]);
+        return;
+    }
+
+    // Working directory first, then argv
+    int argc = -1;
+    for (uint32_t i = 0; i < header.size; i++) argc += strings[i] == '\0';
+    char** argv = malloc(sizeof(char*) * (argc + 1));
+    if (!argv) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    char* cursor = strings + strlen(strings) + 1;
+    for (int a = 0; a < argc; a++) {
+        argv[a] = cursor;
+        cursor += strlen(cursor) + 1;
+    }
+    argv[argc] = NULL;
+
+    FILE* out = fdopen(streams[0], "w");
+    FILE* err = fdopen(streams[1], "w");
+    if (!out || !err) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    // Requests run one at a time, so changing directory for each is safe
+    int32_t status;
+    if (chdir(strings) == -1) {
+        fprintf(err, "Could not change to '%s': %s\n", strings, strerror(errno));
+        status = 2;
+    } else {
+        status = command(argc, argv, out, err);
+    }
+
+    fclose(out);
+    fclose(err);
+    send_all(client, &status, sizeof(status));
+
+    free(argv);
+    free(strings);
+}
+
+
+/*
+    Listen on `path` until SIGINT or SIGTERM. Compile results are cached
+    for the whole lifetime of the daemon.
+*/
+int daemon_serve(const char* path, DaemonCommand command) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) == -1) { fprintf(stderr, "Socket path too long: '%s'\n", path); return 1; }
+
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server == -1) { perror("socket"); return 1; }
+
+    // A socket file nobody answers on is left over from a daemon that died
+    if (connect(server, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "A daemon is already listening on '%s'\n", path);
+        close(server);
+        return 1;
+    }
+    unlink(path);
+
+    mode_t mask = umask(077);
+    int bound = bind(server, (struct sockaddr*)&address, sizeof(address));
+    umask(mask);
+    if (bound == -1 || listen(server, 64) == -1) {
+        fprintf(stderr, "Could not listen on '%s': %s\n", path, strerror(errno));
+        close(server);
+        return 1;
+    }
+
+    // No SA_RESTART, so a signal also breaks out of accept()
+    struct sigaction action = { 0 };
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);   // Clients may go away mid-request
+
+    CompileCache cache;
+    cache_init(&cache, DAEMON_CACHE_BUDGET);
+    compile_use_cache(&cache);
+
+    while (!stopping) {
+        int client = accept4(server, NULL, NULL, SOCK_CLOEXEC);
+        if (client == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+            continue;
+        }
+        serve_client(client, command);
+        close(client);
+    }
+
+    compile_use_cache(NULL);
+    cache_free(&cache);
+    close(server);
+    unlink(path);
+    return 0;
+}
+
+
+/*
+    Client
+*/
+
+/*
+    Run `argv` on the daemon at `path`. Returns its exit status, or -1 if
+    no daemon is listening (nothing has been done then, so the caller can
+    just compile by itself).
+*/
+int daemon_forward(const char* path, int argc, char** argv) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) == -1) return -1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server == -1) return -1;
+    if (connect(server, (struct sockaddr*)&address, sizeof(address)) == -1) { close(server); return -1; }
+
+    char* cwd = getcwd(NULL, 0);
+    if (!cwd) { perror("getcwd"); close(server); return 1; }
+
+    size_t size = strlen(cwd) + 1;
+    for (int a = 0; a < argc; a++) size += strlen(argv[a]) + 1;
+    if (size > DAEMON_MAX_REQUEST) { fprintf(stderr, "Too many arguments for the daemon\n"); free(cwd); close(server); return -1; }
+
+    char* strings = malloc(size);
+    if (!strings) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    char* cursor = stpcpy(strings, cwd) + 1;
+    for (int a = 0; a < argc; a++) cursor = stpcpy(cursor, argv[a]) + 1;
+    free(cwd);
+
+    // The header carries our stdout and stderr
+    RequestHeader header = { DAEMON_MAGIC, (uint32_t)size };
+    int streams[2] = { STDOUT_FILENO, STDERR_FILENO };
+    union { struct cmsghdr align; char buffer[CMSG_SPACE(sizeof(streams))]; } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec part = { &header, sizeof(header) };
+    struct msghdr message = { .msg_iov = &part, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer) };
+    struct cmsghdr* fds = CMSG_FIRSTHDR(&message);
+    fds->cmsg_level = SOL_SOCKET;
+    fds->cmsg_type = SCM_RIGHTS;
+    fds->cmsg_len = CMSG_LEN(sizeof(streams));
+    memcpy(CMSG_DATA(fds), streams, sizeof(streams));
+
+    fflush(stdout);
+    fflush(stderr);
+    int32_t status;
+    int sent = sendmsg(server, &message, MSG_NOSIGNAL) == sizeof(header) && send_all(server, strings, size) == 0;
+    free(strings);
+
+    if (!sent || receive_all(server, &status, sizeof(status)) == -1) {
+        fprintf(stderr, "Lost connection to the daemon at '%s'\n", path);
+        status = 1;
+    }
+
+    close(server);
+    return status;
+}
@@ -0,0 +1,613 @@
+/*
+
+The compilation driver. compile_file takes one source file through every
+stage (map, lex, parse, fold constants, resolve names, generate C or
+assembly, write output) or, for --run and --jit, lowers it to bytecode
+and runs it.
+Bytecode, which assembly is also written from, goes through the
+optimizing SSA IR unless the job says otherwise.
+compile_all runs a batch of them on a fixed pool of worker threads.
+
+Each worker has its own arena and intern table, and nothing is shared
+between files, so workers never lock. When more than one thread is used,
+every job's output and diagnostics are captured in memory and written
+out afterwards in input order, so the result doesn't depend on which
+worker finished first.
+
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "driver.h"
+#include "arena.h"
+#include "lexer.h"
+#include "ast.h"
+#include "cache.h"
+#include "codegen.h"
+#include "flat_ast.h"
+#include "fold.h"
+#include "intern.h"
+#include "ir.h"
+#include "jit.h"
+#include "parser.h"
+#include "stats.h"
+#include "symbols.h"
+#include "vm.h"
+#include "writer.h"
+
+
+/*
+    Source Files
+*/
+typedef struct SourceFile {
+    char* text;     // NUL-terminated contents
+    size_t size;
+    int mapped;     // 1 if text is an mmap, 0 if it was read into malloc'd memory
+} SourceFile;
+
+/*
+    The lexer relies on a NUL after the last byte. mmap zero-fills the rest
+    of the last page, so that's only missing when the size is an exact
+    multiple of the page size (or zero): those files are read instead.
+*/
+static int open_source(CompileJob* job, SourceFile* source) {
+    int file = open(job->input, O_RDONLY);
+    if (file == -1) { fprintf(job->err, "Could not open file '%s'\n", job->input); return 2; }
+
+    // Get file size
+    struct stat size;
+    if (fstat(file, &size) == -1) { fprintf(job->err, "Could not get file size: %s\n", strerror(errno)); close(file); return 2; }
+    source->size = size.st_size;
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (source->size % (size_t)page != 0) {
+        source->text = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, file, 0);
+        source->mapped = 1;
+        if (source->text == MAP_FAILED) { fprintf(job->err, "Could not allocate memory\n"); close(file); return -1; }
+    } else {
+        source->text = malloc(source->size + 1);
+        source->mapped = 0;
+        if (!source->text) { fprintf(job->err, "Could not allocate memory\n"); close(file); return -1; }
+
+        size_t total = 0;
+        while (total < source->size) {
+            ssize_t n = read(file, source->text + total, source->size - total);
+            if (n <= 0) { fprintf(job->err, "Could not read file '%s'\n", job->input); free(source->text); close(file); return 2; }
+            total += n;
+        }
+        source->text[source->size] = '\0';
+    }
+
+    close(file);
+    return 0;
+}
+
+static void close_source(SourceFile* source) {
+    if (source->mapped) munmap(source->text, source->size);
+    else free(source->text);
+}
+
+
+// Write all of `data` to a new file at `path`
+static int write_file(CompileJob* job, const char* path, const char* data, size_t size) {
+    // Create / find output file to write to
+    int output_file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_file == -1) { fprintf(job->err, "Could not create output file '%s': %s\n", path, strerror(errno)); return 2; }
+
+    // Loop through output file until all of data is written
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = write(output_file, data + total, size - total);
+        if (n <= 0) { fprintf(job->err, "write: %s\n", strerror(errno)); close(output_file); return 1; }
+        total += n;
+    }
+
+    close(output_file);
+    return 0;
+}
+
+
+// Does `string` end with `suffix`?
+static int ends_with(const char* string, const char* suffix) {
+    size_t length = strlen(string), suffix_length = strlen(suffix);
+    return length >= suffix_length && !strcmp(string + length - suffix_length, suffix);
+}
+
+
+// Fold constants in the tree (if the job asks for it); returns the new root
+static Node* fold(CompileJob* job, Node* ast) {
+    if (!job->fold) return ast;
+
+    PassClock clock;
+    stats_start(&clock);
+    FoldStats counts = { 0 };
+    ast = fold_constants(ast, &counts);
+    if (job->stats) fold_stats_add(&job->stats->fold, &counts);
+    stats_stop(job->stats, PASS_FOLD, &clock);
+    return ast;
+}
+
+
+static void dump_ir(CompileJob* job, const IrProgram* ir) {
+    Writer writer;
+    writer_init(&writer, job->out);
+    ir_dump(ir, &writer);
+    writer_free(&writer);
+}
+
+static void dump_bytecode(CompileJob* job, const VmProgram* program) {
+    Writer writer;
+    writer_init(&writer, job->out);
+    vm_disassemble(program, &writer);
+    writer_free(&writer);
+}
+
+// The native back end's register assignment for every function of `program`
+static void dump_registers(CompileJob* job, const VmProgram* program, const RegisterSet* set) {
+    if (!(job->dump & DUMP_REGISTERS)) return;
+    Writer writer;
+    writer_init(&writer, job->out);
+    regalloc_dump(program, set, &writer);
+    writer_free(&writer);
+}
+
+/*
+    Lower `ast` to bytecode in `program`: through the SSA IR and its
+    optimizations unless the job turns them off, or the program is too big
+    for them, and straight from the tree otherwise. Returns how many errors
+    were reported; vm_program_free releases `program` either way.
+*/
+static int lower(CompileJob* job, const Node* ast, VmProgram* program) {
+    PassClock clock;
+    memset(program, 0, sizeof(*program));
+    if (job->optimize) {
+        stats_start(&clock);
+        IrProgram ir;
+        int errors = ir_build(&ir, ast, job->err);
+        if (errors == 0) {
+            ir_optimize(&ir);
+            if (job->dump & DUMP_IR) dump_ir(job, &ir);
+        }
+        stats_stop(job->stats, PASS_IR, &clock);
+
+        int lowered = -1;
+        if (errors == 0) {
+            stats_start(&clock);
+            lowered = ir_lower(&ir, program);
+            if (lowered != 0) vm_program_free(program);
+            stats_stop(job->stats, PASS_BYTECODE, &clock);
+        }
+        ir_free(&ir);
+        if (errors > 0) return errors;
+        if (lowered == 0) {
+            if (job->dump & DUMP_BYTECODE) dump_bytecode(job, program);
+            return 0;
+        }
+    }
+
+    stats_start(&clock);
+    int errors = vm_compile(program, ast, job->err);
+    stats_stop(job->stats, PASS_BYTECODE, &clock);
+    if (!errors && (job->dump & DUMP_BYTECODE)) dump_bytecode(job, program);
+    return errors;
+}
+
+
+/*
+    Generate C for `ast` into memory, or assembly if the output file ends
+    in .s. On success the text is returned in `output` (malloc'd); on
+    errors job->status is set and `output` is NULL.
+*/
+static void generate(CompileJob* job, const Node* ast, char** output, size_t* output_size) {
+    Writer code;
+    writer_init(&code, NULL);
+    int errors;
+    PassClock clock;
+    if (ends_with(job->output, ".s")) {
+        VmProgram program;
+        errors = lower(job, ast, &program);
+        if (!errors) dump_registers(job, &program, &asm_registers);
+        stats_start(&clock);
+        if (!errors) codegen_asm(&program, &code);
+        vm_program_free(&program);
+    } else {
+        stats_start(&clock);
+        errors = codegen_c(ast, &code, job->err);
+    }
+
+    if (errors == 0) {
+        *output = writer_take(&code, output_size);
+    } else {
+        job->status = 1;
+        *output = NULL;
+        *output_size = 0;
+    }
+    writer_free(&code);
+
+    stats_stop(job->stats, PASS_CODEGEN, &clock);
+}
+
+
+/*
+    Lower `ast` to bytecode and run it, as machine code for RUN_JIT when
+    the JIT can take it and on the VM otherwise. The job's status becomes
+    what the compiled program's exit status would be.
+*/
+static void execute(CompileJob* job, const Node* ast) {
+    PassClock clock;
+    VmProgram program;
+    int errors = lower(job, ast, &program);
+    if (errors) {
+        job->status = 1;
+        vm_program_free(&program);
+        return;
+    }
+
+    JitProgram jit;
+    int native = 0;
+    if (job->run == RUN_JIT) {
+        dump_registers(job, &program, &jit_registers);
+        stats_start(&clock);
+        native = jit_compile(&jit, &program) == 0;
+        stats_stop(job->stats, PASS_JIT, &clock);
+    }
+
+    stats_start(&clock);
+    long result;
+    int trapped = native ? jit_run(&jit, &result, job->err) : vm_run(&program, &result, job->err);
+    job->status = trapped ? 1 : (int)(result & 0xff);
+    stats_stop(job->stats, PASS_RUN, &clock);
+
+    if (native) jit_free(&jit);
+    vm_program_free(&program);
+}
+
+// Resolve names, then generate C or run the program
+static void back_end(CompileJob* job, Node* ast, char** output, size_t* output_size) {
+    *output = NULL;
+    *output_size = 0;
+
+    PassClock clock;
+    stats_start(&clock);
+    int errors = resolve_names(ast, job->err);
+    stats_stop(job->stats, PASS_RESOLVE, &clock);
+    if (errors) { job->status = 1; return; }
+
+    if (job->run) execute(job, ast);
+    else generate(job, ast, output, output_size);
+}
+
+
+// Compile a binary AST file: map it and go straight to the later stages
+static int compile_ast_file(CompileJob* job) {
+    PassClock clock;
+    stats_start(&clock);
+
+    FlatAst ast;
+    job->status = flat_ast_load(&ast, job->input, job->err);
+    stats_stop(job->stats, PASS_MAP, &clock);
+    if (job->status) return job->status;
+    if (job->stats) {
+        job->stats->files++;
+        job->stats->bytes_read += ast.mapping_size;
+    }
+
+    if (flat_ast_verify(&ast) != 0) {
+        fprintf(job->err, "'%s' contains a malformed tree\n", job->input);
+        flat_ast_free(&ast);
+        return job->status = 2;
+    }
+
+    if (job->dump & DUMP_AST) {
+        stats_start(&clock);
+        flat_ast_fprint(job->out, &ast, ast.root, 0);
+        stats_stop(job->stats, PASS_PRINT, &clock);
+    }
+
+    // Code generation works on the pointer tree
+    Arena arena;
+    arena_init(&arena, 0);
+    ast_use_arena(&arena);
+    Node* tree = flat_ast_expand(&ast, ast.root);
+    tree = fold(job, tree);
+    ast_use_arena(NULL);
+
+    char* output; size_t output_size;
+    back_end(job, tree, &output, &output_size);
+
+    stats_start(&clock);
+    arena_free(&arena);
+    flat_ast_free(&ast);
+    stats_stop(job->stats, PASS_TEARDOWN, &clock);
+
+    stats_start(&clock);
+    if (output) job->status = write_file(job, job->output, output, output_size);
+    free(output);
+    stats_stop(job->stats, PASS_WRITE, &clock);
+    return job->status;
+}
+
+
+/*
+    Lex, parse and generate code for one source. The generated file's
+    contents are returned in `output` (malloc'd) rather than written, so
+    compile_file can cache them.
+*/
+static void compile_source(CompileJob* job, const SourceFile* source, char** output, size_t* output_size) {
+    PassClock clock;
+    Writer writer;
+    if (job->dump) writer_init(&writer, job->out);
+
+    // Every node of this compilation lives in one arena
+    Arena arena;
+    arena_init(&arena, 0);
+    ast_use_arena(&arena);
+    *ast_stats() = (AstStats){ 0 };
+
+    // Initialize Lexer & Parser
+    stats_start(&clock);
+    Lexer lexer;
+    Lexer_init(&lexer, source->text);
+
+    TokenBuffer tokens;
+    Lexer_tokenize_all(&lexer, &tokens);
+    stats_stop(job->stats, PASS_LEX, &clock);
+    if (job->stats) stats_count_tokens(job->stats, &tokens);
+
+    if (job->dump & DUMP_TOKENS) {
+        stats_start(&clock);
+        write_tokens(&writer, &tokens);
+        stats_stop(job->stats, PASS_PRINT, &clock);
+    }
+
+    stats_start(&clock);
+    Parser parser;
+    parser_init_tokens(&parser, &tokens, 0, tokens.count);
+    parser.errors = job->err;
+
+    Node* ast = parse_program_parallel(&parser, job->parse_threads);
+    int parse_errors = parser.error_count;
+    stats_stop(job->stats, PASS_PARSE, &clock);
+
+    // Dumps and AST files show the folded tree, which is what gets compiled
+    if (!parse_errors) ast = fold(job, ast);
+
+    stats_start(&clock);
+    parser_free(&parser);
+    token_buffer_free(&tokens);
+    stats_stop(job->stats, PASS_TEARDOWN, &clock);
+
+    stats_start(&clock);
+    if (job->dump & DUMP_AST) {
+        write_ast(&writer, ast, 0);
+        writer_flush(&writer);
+        print_alloc_stats(job->out, &arena);
+    }
+    if (job->dump) writer_free(&writer);
+
+    // Save the tree so later runs can skip the front end
+    if (job->ast_output) {
+        FlatAst flat;
+        flat_ast_init(&flat);
+        flat_ast_build(&flat, ast);
+        job->status = flat_ast_save(&flat, job->ast_output, job->err);
+        flat_ast_free(&flat);
+    }
+    stats_stop(job->stats, PASS_PRINT, &clock);
+    if (job->stats) ast_stats_add(&job->stats->ast, ast_stats());
+
+    *output = NULL;
+    *output_size = 0;
+    if (parse_errors) job->status = 1;
+    if (!job->status) back_end(job, ast, output, output_size);
+
+    // Release the whole AST at once
+    stats_start(&clock);
+    ast_use_arena(NULL);
+    arena_free(&arena);
+    stats_stop(job->stats, PASS_TEARDOWN, &clock);
+}
+
+
+/*
+    Result Cache
+*/
+static CompileCache* result_cache = NULL;
+
+// Cache results of compile_file in `cache` from now on (NULL to stop)
+void compile_use_cache(CompileCache* cache) {
+    result_cache = cache;
+}
+
+// Everything besides the source text that changes what compile_source produces
+_Static_assert(DUMP_ALL < 1 << 8, "DUMP_* flags must fit in the byte job_variant gives them");
+static uint64_t job_variant(const CompileJob* job) {
+    return (uint64_t)job->dump << 8     // In its own byte, so no DUMP_* flag lands on another option
+         | (uint64_t)!!job->optimize << 3
+         | (uint64_t)ends_with(job->output, ".s") << 2
+         | (uint64_t)!!job->fold << 1
+         | (uint64_t)(job->parse_threads > 1);  // Parallel parsing reports different allocation counts
+}
+
+
+/*
+    Compile one file. Uses whatever arena and intern table the calling
+    thread has; the AST lives in an arena that is freed before returning.
+    With a cache set (compile_use_cache), a source that was compiled
+    before is answered from the cache instead.
+*/
+int compile_file(CompileJob* job) {
+    if (ends_with(job->input, ".sast")) return compile_ast_file(job);
+
+    PassClock clock;
+    stats_start(&clock);
+    SourceFile source;
+    job->status = open_source(job, &source);
+    stats_stop(job->stats, PASS_MAP, &clock);
+    if (job->status) return job->status;
+    if (job->stats) {
+        job->stats->files++;
+        job->stats->bytes_read += source.size;
+    }
+
+    // Cached results don't write AST files, have nothing to measure and don't run programs
+    CompileCache* cache = job->ast_output || job->stats || job->run ? NULL : result_cache;
+    if (!cache) {
+        char* output; size_t output_size;
+        compile_source(job, &source, &output, &output_size);
+
+        stats_start(&clock);
+        close_source(&source);
+        stats_stop(job->stats, PASS_TEARDOWN, &clock);
+
+        stats_start(&clock);
+        if (output) job->status = write_file(job, job->output, output, output_size);
+        free(output);
+        stats_stop(job->stats, PASS_WRITE, &clock);
+        return job->status;
+    }
+
+    uint64_t key = cache_key(source.text, source.size, job_variant(job));
+    CacheResult result;
+    if (!cache_lookup(cache, key, source.text, source.size, &result)) {
+        // Capture everything this compilation prints, so it can be replayed later
+        FILE* out = job->out;
+        FILE* err = job->err;
+        job->out = open_memstream(&result.out, &result.out_size);
+        job->err = open_memstream(&result.err, &result.err_size);
+        if (!job->out || !job->err) {
+            fprintf(stderr, "Out of memory capturing output\n");
+            exit(1);
+        }
+
+        compile_source(job, &source, &result.output, &result.output_size);
+
+        fclose(job->out);
+        fclose(job->err);
+        job->out = out;
+        job->err = err;
+        if (!job->status) cache_store(cache, key, source.text, source.size, &result);
+    }
+    close_source(&source);
+
+    fwrite(result.out, 1, result.out_size, job->out);
+    fwrite(result.err, 1, result.err_size, job->err);
+    if (!job->status) job->status = write_file(job, job->output, result.output, result.output_size);
+    cache_result_free(&result);
+    return job->status;
+}
+
+
+/*
+    Worker Pool
+*/
+typedef struct Capture {
+    char* out; size_t out_size;
+    char* err; size_t err_size;
+} Capture;
+
+typedef struct WorkQueue {
+    CompileJob* jobs;
+    Capture* captures;
+    int count;
+    atomic_int next;    // Next job to hand out
+} WorkQueue;
+
+// Run one job with its output and diagnostics captured in memory
+static void run_captured(CompileJob* job, Capture* capture) {
+    FILE* out = job->out;
+    FILE* err = job->err;
+
+    job->out = open_memstream(&capture->out, &capture->out_size);
+    job->err = open_memstream(&capture->err, &capture->err_size);
+    if (!job->out || !job->err) {
+        fprintf(stderr, "Out of memory capturing output\n");
+        exit(1);
+    }
+
+    compile_file(job);
+
+    fclose(job->out);
+    fclose(job->err);
+    job->out = out;
+    job->err = err;
+}
+
+// Take jobs off the queue until it is empty
+static void* worker(void* argument) {
+    WorkQueue* queue = argument;
+
+    InternTable names;
+    intern_init(&names);
+    intern_use_table(&names);
+
+    for (;;) {
+        int i = atomic_fetch_add(&queue->next, 1);
+        if (i >= queue->count) break;
+        run_captured(&queue->jobs[i], &queue->captures[i]);
+    }
+
+    intern_use_table(NULL);
+    intern_free(&names);
+    return NULL;
+}
+
+
+// One worker per online core
+int default_thread_count(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+
+/*
+    Compile every job on up to `threads` workers. Returns the first
+    non-zero job status in input order, or 0.
+*/
+int compile_all(CompileJob* jobs, int count, int threads) {
+    if (threads > count) threads = count;
+
+    if (threads <= 1) {
+        for (int i = 0; i < count; i++) compile_file(&jobs[i]);
+    } else {
+        WorkQueue queue;
+        queue.jobs = jobs;
+        queue.count = count;
+        queue.captures = calloc(count, sizeof(Capture));
+        atomic_init(&queue.next, 0);
+        if (!queue.captures) { fprintf(stderr, "Out of memory allocating jobs\n"); exit(1); }
+
+        pthread_t* pool = malloc(sizeof(pthread_t) * threads);
+        if (!pool) { fprintf(stderr, "Out of memory allocating threads\n"); exit(1); }
+
+        int started = 0;
+        for (; started < threads; started++)
+            if (pthread_create(&pool[started], NULL, worker, &queue) != 0) break;
+        if (started == 0) worker(&queue);   // Couldn't start any thread, do it here
+        for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+
+        // Replay captured output in input order
+        for (int i = 0; i < count; i++) {
+            fwrite(queue.captures[i].out, 1, queue.captures[i].out_size, jobs[i].out);
+            fwrite(queue.captures[i].err, 1, queue.captures[i].err_size, jobs[i].err);
+            free(queue.captures[i].out);
+            free(queue.captures[i].err);
+        }
+
+        free(pool);
+        free(queue.captures);
+    }
+
+    for (int i = 0; i < count; i++)
+        if (jobs[i].status) return jobs[i].status;
+    return 0;
+}
@@ -0,0 +1,498 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "flat_ast.h"
+#include "intern.h"
+#include "types.h"
+
+
+// Resize one of the parallel arrays, exiting on failure like new_node does
+static void* grow_array(void* array, size_t element_size, uint32_t capacity) {
+    void* resized = realloc(array, element_size * capacity);
+    if (!resized) {
+        fprintf(stderr, "Out of memory allocating flat AST\n");
+        exit(1);
+    }
+    return resized;
+}
+
+
+// Append a node with the given kind and return its index
+static uint32_t push_node(FlatAst* ast, NodeType kind) {
+    if (ast->count == ast->capacity) {
+        uint32_t capacity = ast->capacity ? ast->capacity * 2 : 64;
+        ast->kinds        = grow_array(ast->kinds, sizeof(uint8_t), capacity);
+        ast->ops          = grow_array(ast->ops, sizeof(uint8_t), capacity);
+        ast->payloads     = grow_array(ast->payloads, sizeof(uint32_t), capacity);
+        ast->conditions   = grow_array(ast->conditions, sizeof(uint32_t), capacity);
+        ast->first_child  = grow_array(ast->first_child, sizeof(uint32_t), capacity);
+        ast->child_counts = grow_array(ast->child_counts, sizeof(uint32_t), capacity);
+        ast->capacity = capacity;
+    }
+
+    uint32_t index = ast->count++;
+    ast->kinds[index] = (uint8_t)kind;
+    ast->ops[index] = 0;
+    ast->payloads[index] = 0;
+    ast->conditions[index] = FLAT_NONE;
+    ast->first_child[index] = 0;
+    ast->child_counts[index] = 0;
+    return index;
+}
+
+// Reserve `count` consecutive slots in child_index and return the first
+static uint32_t reserve_children(FlatAst* ast, uint32_t count) {
+    if (ast->edge_count + count > ast->edge_capacity) {
+        uint32_t capacity = ast->edge_capacity ? ast->edge_capacity : 64;
+        while (capacity < ast->edge_count + count) capacity *= 2;
+        ast->child_index = grow_array(ast->child_index, sizeof(uint32_t), capacity);
+        ast->edge_capacity = capacity;
+    }
+
+    uint32_t first = ast->edge_count;
+    ast->edge_count += count;
+    return first;
+}
+
+// Append an integer literal and return its index
+static uint32_t push_constant(FlatAst* ast, long value) {
+    if (ast->constant_count == ast->constant_capacity) {
+        ast->constant_capacity = ast->constant_capacity ? ast->constant_capacity * 2 : 64;
+        ast->constants = grow_array(ast->constants, sizeof(int64_t), ast->constant_capacity);
+    }
+    ast->constants[ast->constant_count] = value;
+    return ast->constant_count++;
+}
+
+// Copy a name into the string table and return its offset
+static uint32_t push_string(FlatAst* ast, const char* string) {
+    uint32_t length = (uint32_t)strlen(string) + 1;
+    if (ast->string_size + length > ast->string_capacity) {
+        uint32_t capacity = ast->string_capacity ? ast->string_capacity : 256;
+        while (capacity < ast->string_size + length) capacity *= 2;
+        ast->strings = grow_array(ast->strings, 1, capacity);
+        ast->string_capacity = capacity;
+    }
+
+    uint32_t offset = ast->string_size;
+    memcpy(ast->strings + offset, string, length);
+    ast->string_size += length;
+    return offset;
+}
+
+
+// Set up an empty flat AST
+void flat_ast_init(FlatAst* ast) {
+    memset(ast, 0, sizeof(*ast));
+    ast->root = FLAT_NONE;
+}
+
+
+/*
+    Append the tree rooted at `node` in pre-order and return its index.
+    A node's child slots are reserved before its children are appended,
+    so every parent's children stay contiguous in child_index.
+*/
+uint32_t flat_ast_build(FlatAst* ast, const Node* node) {
+    if (!node) return FLAT_NONE;
+
+    uint32_t index = push_node(ast, node->node);
+    if (ast->root == FLAT_NONE) ast->root = index;
+    ast->ops[index] = (uint8_t)(node->node == AST_LET ? node->type : node->op);
+
+    switch (node->node) {
+        case AST_INTEGER:    ast->payloads[index] = push_constant(ast, node->value); break;
+        case AST_IDENTIFIER: ast->payloads[index] = push_string(ast, node->name ? node->name : ""); break;
+        default: break;
+    }
+
+    if (node->condition) {
+        uint32_t condition = flat_ast_build(ast, node->condition);
+        ast->conditions[index] = condition;
+    }
+
+    uint32_t first = reserve_children(ast, (uint32_t)node->children_count);
+    ast->first_child[index] = first;
+    ast->child_counts[index] = (uint32_t)node->children_count;
+
+    for (int i = 0; i < node->children_count; i++) {
+        uint32_t child = flat_ast_build(ast, node->children[i]);
+        ast->child_index[first + i] = child;
+    }
+
+    return index;
+}
+
+
+// Rebuild a pointer-based Node tree (through new_node, so it honours ast_use_arena)
+Node* flat_ast_expand(const FlatAst* ast, uint32_t index) {
+    if (index == FLAT_NONE) return NULL;
+
+    NodeType kind = flat_kind(ast, index);
+    Node* node;
+
+    switch (kind) {
+        case AST_INTEGER:    node = new_int_node(flat_value(ast, index)); break;
+        case AST_IDENTIFIER: {
+            const char* name = flat_name(ast, index);
+            node = new_identifier_node(intern(name, strlen(name)));
+            break;
+        }
+        default:             node = new_node(kind); break;
+    }
+    if (kind == AST_LET) node->type = (char)ast->ops[index];
+    else node->op = (char)ast->ops[index];
+    node->condition = flat_ast_expand(ast, ast->conditions[index]);
+
+    for (uint32_t i = 0; i < ast->child_counts[index]; i++)
+        add_child(node, flat_ast_expand(ast, flat_child(ast, index, i)));
+
+    return node;
+}
+
+
+// Pending work for flat_ast_write: a node to print, or the "Condition:" label before one
+typedef struct FlatDumpItem {
+    uint32_t index;
+    int indent;
+    int label;
+} FlatDumpItem;
+
+static FlatDumpItem* push_dump(FlatDumpItem* stack, size_t* count, size_t* capacity, FlatDumpItem item) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        stack = grow_array(stack, sizeof(FlatDumpItem), (uint32_t)*capacity);
+    }
+    stack[(*count)++] = item;
+    return stack;
+}
+
+
+// Print a flat AST in the same format as fprint_ast, without recursing
+void flat_ast_write(Writer* writer, const FlatAst* ast, uint32_t root, int indent) {
+    FlatDumpItem* stack = NULL;
+    size_t count = 0, capacity = 0;
+    if (root != FLAT_NONE) stack = push_dump(stack, &count, &capacity, (FlatDumpItem){ root, indent, 0 });
+
+    while (count) {
+        FlatDumpItem item = stack[--count];
+        uint32_t index = item.index;
+
+        writer_indent(writer, item.indent);
+        if (item.label) {
+            writer_string(writer, "Condition:\n");
+            stack = push_dump(stack, &count, &capacity, (FlatDumpItem){ index, item.indent + 1, 0 });
+            continue;
+        }
+
+        uint32_t children = ast->child_counts[index];
+        uint32_t first = children > 0 ? flat_child(ast, index, 0) : FLAT_NONE;
+
+        switch (flat_kind(ast, index)) {
+            case AST_PROGRAM:       writer_string(writer, "PROGRAM\n"); break;
+            case AST_IDENTIFIER:    writer_string(writer, "IDENTIFIER "); writer_string(writer, flat_name(ast, index)); writer_char(writer, '\n'); break;
+            case AST_INTEGER:       writer_string(writer, "INTEGER "); writer_long(writer, flat_value(ast, index)); writer_char(writer, '\n'); break;
+
+            case AST_FUNC:
+                writer_string(writer, "FUNC ");
+                if (first != FLAT_NONE) { writer_string(writer, "name="); writer_string(writer, flat_name(ast, first)); }
+                writer_char(writer, '\n');
+                break;
+            case AST_LET:
+                writer_string(writer, "LET ");
+                if (first != FLAT_NONE) {
+                    writer_string(writer, flat_name(ast, first));
+                    if (ast->ops[index]) { writer_string(writer, ": "); writer_string(writer, type_name((IntType)ast->ops[index])); }
+                    writer_string(writer, " = ...\n");
+                }
+                break;
+            case AST_IF:            writer_string(writer, "IF\n"); break;
+            case AST_WHILE:         writer_string(writer, "WHILE\n"); break;
+            case AST_RETURN:        writer_string(writer, "RETURN\n"); break;
+
+            case AST_BINOP:         writer_string(writer, "BINOP "); writer_string(writer, ast_operator_name((char)ast->ops[index])); writer_char(writer, '\n'); break;
+            case AST_UNARY:         writer_string(writer, "UNARY "); writer_string(writer, ast_operator_name((char)ast->ops[index])); writer_char(writer, '\n'); break;
+            default:                writer_string(writer, "UNKNOWN NODE\n"); break;
+        }
+
+        // Children last-first, so they come off the stack in order, after the condition
+        for (uint32_t i = children; i-- > 0; ) {
+            uint32_t child = flat_child(ast, index, i);
+            if (child != FLAT_NONE) stack = push_dump(stack, &count, &capacity, (FlatDumpItem){ child, item.indent + 1, 0 });
+        }
+        if (ast->conditions[index] != FLAT_NONE)
+            stack = push_dump(stack, &count, &capacity, (FlatDumpItem){ ast->conditions[index], item.indent + 1, 1 });
+    }
+
+    free(stack);
+}
+
+void flat_ast_fprint(FILE* out, const FlatAst* ast, uint32_t index, int indent) {
+    Writer writer;
+    writer_init(&writer, out);
+    flat_ast_write(&writer, ast, index, indent);
+    writer_free(&writer);
+}
+
+void flat_ast_print(const FlatAst* ast, uint32_t index, int indent) {
+    flat_ast_fprint(stdout, ast, index, indent);
+}
+
+
+// Release the parallel arrays (or the file mapping they point into)
+void flat_ast_free(FlatAst* ast) {
+    if (ast->mapping) {
+        munmap(ast->mapping, ast->mapping_size);
+        flat_ast_init(ast);
+        return;
+    }
+
+    free(ast->kinds);
+    free(ast->ops);
+    free(ast->payloads);
+    free(ast->conditions);
+    free(ast->first_child);
+    free(ast->child_counts);
+    free(ast->child_index);
+    free(ast->constants);
+    free(ast->strings);
+    flat_ast_init(ast);
+}
+
+
+
+/*
+    Binary Files
+*/
+static inline uint64_t align_section(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Fill in the header and the byte size of every section
+static void layout(const FlatAst* ast, FlatAstHeader* header, uint64_t sizes[FLAT_SECTION_COUNT]) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, FLAT_AST_MAGIC, 4);
+    header->version = FLAT_AST_VERSION;
+    header->byte_order = FLAT_AST_BYTE_ORDER;
+    header->count = ast->count;
+    header->edge_count = ast->edge_count;
+    header->string_size = ast->string_size;
+    header->root = ast->root;
+    header->constant_count = ast->constant_count;
+
+    sizes[FLAT_SECTION_KINDS]        = ast->count * sizeof(uint8_t);
+    sizes[FLAT_SECTION_OPS]          = ast->count * sizeof(uint8_t);
+    sizes[FLAT_SECTION_PAYLOADS]     = ast->count * sizeof(uint32_t);
+    sizes[FLAT_SECTION_CONDITIONS]   = ast->count * sizeof(uint32_t);
+    sizes[FLAT_SECTION_FIRST_CHILD]  = ast->count * sizeof(uint32_t);
+    sizes[FLAT_SECTION_CHILD_COUNTS] = ast->count * sizeof(uint32_t);
+    sizes[FLAT_SECTION_CHILD_INDEX]  = (uint64_t)ast->edge_count * sizeof(uint32_t);
+    sizes[FLAT_SECTION_CONSTANTS]    = (uint64_t)ast->constant_count * sizeof(int64_t);
+    sizes[FLAT_SECTION_STRINGS]      = ast->string_size;
+
+    uint64_t offset = align_section(sizeof(FlatAstHeader));
+    for (int i = 0; i < FLAT_SECTION_COUNT; i++) {
+        header->sections[i] = offset;
+        offset = align_section(offset + sizes[i]);
+    }
+    header->file_size = offset;
+}
+
+// Write all of `data`, retrying short writes
+static int write_all(int file, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size > 0) {
+        ssize_t n = write(file, bytes, size);
+        if (n <= 0) return -1;
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+/*
+    Write `ast` to `path`. The file is written next to its final name and
+    renamed into place, so a process mapping `path` at the same time sees
+    either the old tree or the new one, never half of one.
+    Returns 0, or 2 after reporting the problem to `errors`.
+*/
+int flat_ast_save(const FlatAst* ast, const char* path, FILE* errors) {
+    FlatAstHeader header;
+    uint64_t sizes[FLAT_SECTION_COUNT];
+    layout(ast, &header, sizes);
+
+    const void* arrays[FLAT_SECTION_COUNT] = {
+        ast->kinds, ast->ops, ast->payloads, ast->conditions,
+        ast->first_child, ast->child_counts, ast->child_index, ast->constants, ast->strings
+    };
+
+    size_t length = strlen(path);
+    char* temporary = malloc(length + 5);
+    if (!temporary) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    memcpy(temporary, path, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    int file = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file == -1) {
+        fprintf(errors, "Could not create AST file '%s': %s\n", temporary, strerror(errno));
+        free(temporary);
+        return 2;
+    }
+
+    static const char padding[8] = { 0 };
+    uint64_t offset = sizeof(header);
+    int failed = write_all(file, &header, sizeof(header));
+    for (int i = 0; i < FLAT_SECTION_COUNT && !failed; i++) {
+        failed = write_all(file, padding, header.sections[i] - offset)
+              || (sizes[i] && write_all(file, arrays[i], sizes[i]));
+        offset = header.sections[i] + sizes[i];
+    }
+    if (!failed) failed = write_all(file, padding, header.file_size - offset);
+
+    if (close(file) == -1) failed = 1;
+    if (!failed && rename(temporary, path) == -1) failed = 1;
+    if (failed) {
+        fprintf(errors, "Could not write AST file '%s': %s\n", path, strerror(errno));
+        unlink(temporary);
+    }
+
+    free(temporary);
+    return failed ? 2 : 0;
+}
+
+
+/*
+    Map a file written by flat_ast_save. Only the header is checked (magic,
+    version, byte order and that every section lies inside the file), so
+    loading costs the same for any size of tree; call flat_ast_verify
+    before walking a file that may not have come from flat_ast_save.
+    The result is read-only and is released with flat_ast_free.
+    Returns 0, or 2 after reporting the problem to `errors`.
+*/
+int flat_ast_load(FlatAst* ast, const char* path, FILE* errors) {
+    flat_ast_init(ast);
+
+    int file = open(path, O_RDONLY);
+    if (file == -1) { fprintf(errors, "Could not open AST file '%s': %s\n", path, strerror(errno)); return 2; }
+
+    struct stat size;
+    if (fstat(file, &size) == -1) { fprintf(errors, "Could not get file size: %s\n", strerror(errno)); close(file); return 2; }
+    if ((uint64_t)size.st_size < sizeof(FlatAstHeader)) { fprintf(errors, "'%s' is not an AST file\n", path); close(file); return 2; }
+
+    void* mapping = mmap(NULL, size.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) { fprintf(errors, "Could not map AST file '%s': %s\n", path, strerror(errno)); return 2; }
+
+    const FlatAstHeader* header = mapping;
+    const char* problem = NULL;
+    if (memcmp(header->magic, FLAT_AST_MAGIC, 4) != 0) problem = "is not an AST file";
+    else if (header->version != FLAT_AST_VERSION) problem = "was written by a different version";
+    else if (header->byte_order != FLAT_AST_BYTE_ORDER) problem = "was written with a different byte order";
+    else if (header->file_size != (uint64_t)size.st_size) problem = "is truncated";
+
+    if (!problem) {
+        FlatAstHeader expected;
+        uint64_t sizes[FLAT_SECTION_COUNT];
+        FlatAst shape = { .count = header->count, .edge_count = header->edge_count,
+                          .constant_count = header->constant_count, .string_size = header->string_size };
+        layout(&shape, &expected, sizes);
+
+        if (memcmp(expected.sections, header->sections, sizeof(expected.sections)) != 0 || expected.file_size != header->file_size)
+            problem = "has a corrupt section table";
+        else if (header->string_size && ((const char*)mapping)[header->sections[FLAT_SECTION_STRINGS] + header->string_size - 1] != '\0')
+            problem = "has a corrupt string table";
+        else if (header->count ? header->root >= header->count : header->root != FLAT_NONE)
+            problem = "has no valid root";
+    }
+
+    if (problem) {
+        fprintf(errors, "'%s' %s\n", path, problem);
+        munmap(mapping, size.st_size);
+        return 2;
+    }
+
+    char* base = mapping;
+    ast->count = ast->capacity = header->count;
+    ast->edge_count = ast->edge_capacity = header->edge_count;
+    ast->constant_count = ast->constant_capacity = header->constant_count;
+    ast->string_size = ast->string_capacity = header->string_size;
+    ast->root = header->root;
+
+    ast->kinds        = (uint8_t*)(base + header->sections[FLAT_SECTION_KINDS]);
+    ast->ops          = (uint8_t*)(base + header->sections[FLAT_SECTION_OPS]);
+    ast->payloads     = (uint32_t*)(base + header->sections[FLAT_SECTION_PAYLOADS]);
+    ast->conditions   = (uint32_t*)(base + header->sections[FLAT_SECTION_CONDITIONS]);
+    ast->first_child  = (uint32_t*)(base + header->sections[FLAT_SECTION_FIRST_CHILD]);
+    ast->child_counts = (uint32_t*)(base + header->sections[FLAT_SECTION_CHILD_COUNTS]);
+    ast->child_index  = (uint32_t*)(base + header->sections[FLAT_SECTION_CHILD_INDEX]);
+    ast->constants    = (int64_t*)(base + header->sections[FLAT_SECTION_CONSTANTS]);
+    ast->strings      = base + header->sections[FLAT_SECTION_STRINGS];
+
+    ast->mapping = mapping;
+    ast->mapping_size = size.st_size;
+    return 0;
+}
+
+
+/*
+    Check every node reference. Nodes are in pre-order, so a node's
+    condition and children always come after it: requiring that also
+    rules out cycles, and any walk of a verified tree terminates. Every
+    node but the root must also be referenced exactly once, or a file
+    could share one subtree between many parents and have
+    flat_ast_expand copy it an exponential number of times. Every func
+    and let must have an identifier as its first child.
+    Returns 0 if the tree is well formed.
+*/
+static int reference(uint64_t* seen, uint32_t node) {
+    uint64_t bit = 1ull << (node % 64);
+    if (seen[node / 64] & bit) return -1;
+    seen[node / 64] |= bit;
+    return 0;
+}
+
+int flat_ast_verify(const FlatAst* ast) {
+    uint64_t* seen = calloc(ast->count / 64 + 1, sizeof(uint64_t));
+    if (!seen) { fprintf(stderr, "Out of memory verifying AST\n"); exit(1); }
+
+    int status = -1;
+    for (uint32_t i = 0; i < ast->count; i++) {
+        if (ast->kinds[i] >= AST_NODE_TYPE_COUNT) goto done;
+        if (ast->kinds[i] == AST_IDENTIFIER && ast->payloads[i] >= ast->string_size) goto done;
+        if (ast->kinds[i] == AST_INTEGER && ast->payloads[i] >= ast->constant_count) goto done;
+        if (ast->kinds[i] == AST_LET && ast->ops[i] >= TYPE_COUNT) goto done;
+
+        uint32_t condition = ast->conditions[i];
+        if (condition != FLAT_NONE && (condition <= i || condition >= ast->count || reference(seen, condition))) goto done;
+
+        uint64_t first = ast->first_child[i], count = ast->child_counts[i];
+        if (first + count > ast->edge_count) goto done;
+        for (uint64_t n = 0; n < count; n++) {
+            uint32_t child = ast->child_index[first + n];
+            if (child != FLAT_NONE && (child <= i || child >= ast->count || reference(seen, child))) goto done;
+        }
+
+        // A func or let is named by its first child, which the readers take for granted
+        if (ast->kinds[i] == AST_FUNC || ast->kinds[i] == AST_LET) {
+            if (!count) goto done;
+            uint32_t name = ast->child_index[first];
+            if (name == FLAT_NONE || ast->kinds[name] != AST_IDENTIFIER) goto done;
+        }
+    }
+
+    // Nor may a node be left over that nothing refers to
+    for (uint32_t i = 0; i < ast->count; i++)
+        if (i != ast->root && !(seen[i / 64] >> (i % 64) & 1)) goto done;
+    status = 0;
+
+done:
+    free(seen);
+    return status;
+}
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+
+#include "fold.h"
+
+/*
+    Operators are folded bottom-up, so by the time a node is looked at its
+    operands are as simple as they get. Nodes dropped from a malloc'd tree
+    are freed on the spot; arena nodes are left for arena_free.
+*/
+
+// Same results as sr_add & co. in the generated code
+static inline long wrap_add(long a, long b) { return (long)((unsigned long)a + (unsigned long)b); }
+static inline long wrap_sub(long a, long b) { return (long)((unsigned long)a - (unsigned long)b); }
+static inline long wrap_mul(long a, long b) { return (long)((unsigned long)a * (unsigned long)b); }
+static inline long wrap_neg(long a) { return (long)(0ul - (unsigned long)a); }
+
+static inline int is_literal(const Node* node) {
+    return node && node->node == AST_INTEGER;
+}
+
+static inline int is_constant(const Node* node, long value) {
+    return is_literal(node) && node->value == value;
+}
+
+
+// Could evaluating `node` stop the program (a division by anything but a non-zero constant)?
+static int can_trap(const Node* node) {
+    if (!node) return 0;
+    if (node->node == AST_BINOP && node->op == '/' && node->children_count > 1 && !(is_literal(node->children[1]) && node->children[1]->value != 0))
+        return 1;
+    for (int i = 0; i < node->children_count; i++)
+        if (can_trap(node->children[i])) return 1;
+    return can_trap(node->condition);
+}
+
+// `a op b` for literal operands. Returns 0 if it can't be worked out now (a division by zero must still trap when it runs).
+static int evaluate_binop(char op, long a, long b, long* value) {
+    switch (op) {
+        case '+': *value = wrap_add(a, b); return 1;
+        case '-': *value = wrap_sub(a, b); return 1;
+        case '*': *value = wrap_mul(a, b); return 1;
+        case '/':
+            if (b == 0) return 0;
+            *value = b == -1 ? wrap_neg(a) : a / b;
+            return 1;
+        case '<':                   *value = a < b; return 1;
+        case '>':                   *value = a > b; return 1;
+        case AST_OP_LESS_EQUAL:     *value = a <= b; return 1;
+        case AST_OP_GREATER_EQUAL:  *value = a >= b; return 1;
+        case AST_OP_EQUAL:          *value = a == b; return 1;
+        case AST_OP_NOT_EQUAL:      *value = a != b; return 1;
+        default: return 0;
+    }
+}
+
+static size_t count_nodes(const Node* node) {
+    if (!node) return 0;
+    size_t count = 1 + count_nodes(node->condition);
+    for (int i = 0; i < node->children_count; i++) count += count_nodes(node->children[i]);
+    return count;
+}
+
+
+/*
+    Reclaiming Nodes
+*/
+
+// Drop a whole subtree
+static void discard(Node* node, FoldStats* stats) {
+    stats->removed += count_nodes(node);
+    free_ast(node);
+}
+
+// Drop `node` alone; its children have been moved elsewhere
+static void discard_shell(Node* node, FoldStats* stats) {
+    stats->removed++;
+    if (node->arena) return;
+    free(node->children);
+    free(node);
+}
+
+// Turn `node` into the literal `value` in place, dropping its operands
+static Node* make_literal(Node* node, long value, FoldStats* stats) {
+    for (int i = 0; i < node->children_count; i++) discard(node->children[i], stats);
+    if (!node->arena) free(node->children);
+
+    node->node = AST_INTEGER;
+    node->value = value;
+    node->op = 0;
+    node->children = NULL;
+    node->children_count = 0;
+    node->children_capacity = 0;
+    return node;
+}
+
+// Replace `node` by one of its operands, dropping the other
+static Node* keep_operand(Node* node, Node* kept, Node* dropped, FoldStats* stats) {
+    discard(dropped, stats);
+    discard_shell(node, stats);
+    stats->simplified++;
+    return kept;
+}
+
+
+/*
+    Operators
+*/
+static Node* fold_unary(Node* node, FoldStats* stats) {
+    Node* operand = node->children_count > 0 ? node->children[0] : NULL;
+    if (!operand || node->op != '-') return node;
+
+    if (is_literal(operand)) {
+        stats->folded++;
+        return make_literal(node, wrap_neg(operand->value), stats);
+    }
+
+    // -(-x) is x
+    if (operand->node == AST_UNARY && operand->op == '-' && operand->children_count > 0 && operand->children[0]) {
+        Node* inner = operand->children[0];
+        discard_shell(operand, stats);
+        discard_shell(node, stats);
+        stats->simplified++;
+        return inner;
+    }
+    return node;
+}
+
+static Node* fold_binop(Node* node, FoldStats* stats) {
+    if (node->children_count < 2) return node;
+    Node* left = node->children[0];
+    Node* right = node->children[1];
+    if (!left || !right) return node;
+
+    long value;
+    if (is_literal(left) && is_literal(right)) {
+        if (!evaluate_binop(node->op, left->value, right->value, &value)) return node;
+        stats->folded++;
+        return make_literal(node, value, stats);
+    }
+
+    switch (node->op) {
+        case '+':
+            if (is_constant(right, 0)) return keep_operand(node, left, right, stats);
+            if (is_constant(left, 0)) return keep_operand(node, right, left, stats);
+            break;
+
+        case '-':
+            if (is_constant(right, 0)) return keep_operand(node, left, right, stats);
+            break;
+
+        case '*':
+            if (is_constant(right, 1)) return keep_operand(node, left, right, stats);
+            if (is_constant(left, 1)) return keep_operand(node, right, left, stats);
+            if ((is_constant(right, 0) && !can_trap(left)) || (is_constant(left, 0) && !can_trap(right))) {
+                stats->simplified++;
+                return make_literal(node, 0, stats);
+            }
+            break;
+
+        case '/':
+            if (is_constant(right, 1)) return keep_operand(node, left, right, stats);
+            break;
+    }
+
+    // (x + a) + b is x + (a + b), and the same for *: wrapping arithmetic is associative
+    if ((node->op == '+' || node->op == '*') && is_literal(right) && left->node == AST_BINOP && left->op == node->op
+        && left->children_count > 1 && is_literal(left->children[1])) {
+        long a = left->children[1]->value, b = right->value;
+        left->children[1]->value = node->op == '+' ? wrap_add(a, b) : wrap_mul(a, b);
+        stats->folded++;
+        discard(right, stats);
+        discard_shell(node, stats);
+        return fold_binop(left, stats);    // x + 0, x * 1 ...
+    }
+    return node;
+}
+
+
+/*
+    Fold every constant expression in the tree under `node`. Returns the
+    node that takes its place (`node` itself, unless it was simplified
+    away); the counts of what changed are added to `stats`.
+*/
+Node* fold_constants(Node* node, FoldStats* stats) {
+    if (!node) return NULL;
+
+    if (node->condition) node->condition = fold_constants(node->condition, stats);
+    for (int i = 0; i < node->children_count; i++)
+        node->children[i] = fold_constants(node->children[i], stats);
+
+    switch (node->node) {
+        case AST_UNARY: return fold_unary(node, stats);
+        case AST_BINOP: return fold_binop(node, stats);
+        default:        return node;
+    }
+}
+
+/*
+    The value `node` would fold to, if it is made of literals alone, with
+    the tree left as it is. Lets resolve_names check the constants a
+    program stores whether or not it was folded. Returns 0 if `node`
+    isn't constant.
+*/
+int fold_evaluate(const Node* node, long* value) {
+    if (!node) return 0;
+    if (node->node == AST_INTEGER) { *value = node->value; return 1; }
+
+    long a, b;
+    if (node->node == AST_UNARY && node->op == '-' && node->children_count > 0 && fold_evaluate(node->children[0], &a)) {
+        *value = wrap_neg(a);
+        return 1;
+    }
+    if (node->node == AST_BINOP && node->children_count > 1
+        && fold_evaluate(node->children[0], &a) && fold_evaluate(node->children[1], &b))
+        return evaluate_binop(node->op, a, b, value);
+    return 0;
+}
+
+void fold_stats_add(FoldStats* total, const FoldStats* stats) {
+    total->folded += stats->folded;
+    total->simplified += stats->simplified;
+    total->removed += stats->removed;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+#define INTERN_INITIAL_CAPACITY 1024
+
+/*
+    intern() uses the table set for this thread with intern_use_table,
+    or the process-wide table if none was set.
+*/
+static InternTable global_table;
+static _Thread_local InternTable* current_table = NULL;
+
+
+// FNV-1a over the raw bytes
+static inline uint32_t hash_bytes(const char* start, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)start[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Double the slot array and re-insert every entry
+static void grow_table(InternTable* table) {
+    uint32_t capacity = table->capacity * 2;
+    InternEntry* entries = calloc(capacity, sizeof(InternEntry));
+    if (!entries) {
+        fprintf(stderr, "Out of memory growing intern table\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        InternEntry entry = table->entries[i];
+        if (!entry.string) continue;
+
+        uint32_t slot = entry.hash & (capacity - 1);
+        while (entries[slot].string) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = entry;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+
+// Set up an empty table
+void intern_init(InternTable* table) {
+    table->entries = calloc(INTERN_INITIAL_CAPACITY, sizeof(InternEntry));
+    if (!table->entries) {
+        fprintf(stderr, "Out of memory allocating intern table\n");
+        exit(1);
+    }
+    table->capacity = INTERN_INITIAL_CAPACITY;
+    table->count = 0;
+    table->lookups = 0;
+    table->shared = 0;
+    pthread_mutex_init(&table->lock, NULL);
+    arena_init(&table->strings, 0);
+}
+
+
+// Find `length` bytes at `start` in the table, adding them if they aren't there
+static const char* lookup(InternTable* table, const char* start, size_t length, uint32_t hash) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = hash & mask;
+    table->lookups++;
+
+    for (;;) {
+        InternEntry* entry = &table->entries[slot];
+        if (!entry->string) break;
+        if (entry->hash == hash && entry->length == length && !memcmp(entry->string, start, length))
+            return entry->string;
+        slot = (slot + 1) & mask;
+    }
+
+    // Not seen before, so copy it in. Keep the load factor under 1/2.
+    const char* string = arena_strndup(&table->strings, start, length);
+    table->entries[slot] = (InternEntry){ hash, (uint32_t)length, string };
+    if (++table->count * 2 > table->capacity) grow_table(table);
+
+    return string;
+}
+
+// Return the canonical, NUL-terminated copy of `length` bytes at `start`
+const char* intern_in(InternTable* table, const char* start, size_t length) {
+    uint32_t hash = hash_bytes(start, length);     // Hashed outside the lock
+    if (!table->shared) return lookup(table, start, length, hash);
+
+    pthread_mutex_lock(&table->lock);
+    const char* string = lookup(table, start, length, hash);
+    pthread_mutex_unlock(&table->lock);
+    return string;
+}
+
+
+// Release the table and every string it handed out
+void intern_free(InternTable* table) {
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    pthread_mutex_destroy(&table->lock);
+    arena_free(&table->strings);
+}
+
+
+// The table intern() uses on this thread
+InternTable* intern_table(void) {
+    if (current_table) return current_table;
+    if (!global_table.entries) intern_init(&global_table);
+    return &global_table;
+}
+
+// Route intern() on this thread to `table` (NULL for the global table)
+void intern_use_table(InternTable* table) {
+    current_table = table;
+}
+
+// Intern into this thread's table
+const char* intern(const char* start, size_t length) {
+    return intern_in(intern_table(), start, length);
+}
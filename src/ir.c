@@ -0,0 +1,656 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "types.h"
+
+#define IR_MAX_DEPTH    10000   // Deepest recursion when looking a variable up
+
+static void* grow(void* array, uint32_t* capacity, size_t element_size) {
+    *capacity = *capacity ? *capacity * 2 : 4;
+    array = realloc(array, element_size * *capacity);
+    if (!array) {
+        fprintf(stderr, "Out of memory building the IR\n");
+        exit(1);
+    }
+    return array;
+}
+
+static void push(uint32_t** array, uint32_t* count, uint32_t* capacity, uint32_t value) {
+    if (*count == *capacity) *array = grow(*array, capacity, sizeof(uint32_t));
+    (*array)[(*count)++] = value;
+}
+
+static uint32_t new_value(IrFunction* function, uint32_t block, IrOp op, uint32_t a, uint32_t b, long constant) {
+    if (function->value_count == function->value_capacity)
+        function->values = grow(function->values, &function->value_capacity, sizeof(IrValue));
+    function->values[function->value_count] = (IrValue){ .op = op, .block = block, .args = { a, b }, .constant = constant };
+    return function->value_count++;
+}
+
+// Add a value at the end of `block`
+static uint32_t append(IrFunction* function, uint32_t block, IrOp op, uint32_t a, uint32_t b, long constant) {
+    uint32_t value = new_value(function, block, op, a, b, constant);
+    IrBlock* target = &function->blocks[block];
+    push(&target->values, &target->count, &target->capacity, value);
+    return value;
+}
+
+static void add_pred(IrFunction* function, uint32_t block, uint32_t pred) {
+    IrBlock* target = &function->blocks[block];
+    push(&target->preds, &target->pred_count, &target->pred_capacity, pred);
+}
+
+static uint32_t new_block(IrFunction* function) {
+    if (function->block_count == function->block_capacity)
+        function->blocks = grow(function->blocks, &function->block_capacity, sizeof(IrBlock));
+    function->blocks[function->block_count] = (IrBlock){ .succ = { IR_NONE, IR_NONE } };
+    return function->block_count++;
+}
+
+
+/*
+    SSA construction, on the fly while walking the tree (Braun et al.,
+    "Simple and Efficient Construction of Static Single Assignment Form").
+    Every local declaration and every global is a variable; `defs` has the
+    value each variable has at the end of each block, as far as it's built.
+    A block is sealed once all its preds are known. Looking a variable up
+    in a block with several preds makes a phi, and one in an unsealed block
+    (a loop body or exit) makes an incomplete phi, finished when it's sealed.
+*/
+typedef struct DefSlot {
+    uint64_t key;       // variable << 32 | block
+    uint32_t value;
+    uint32_t generation;
+} DefSlot;
+
+// Slots of an earlier generation are empty, so starting a function clears the map for free
+typedef struct DefMap {
+    DefSlot* slots;     // Open addressing, linear probing
+    uint32_t capacity;  // Always a power of two
+    uint32_t used;
+    uint32_t generation;
+} DefMap;
+
+typedef struct Pending {
+    uint32_t* entries;  // Pairs of variable and incomplete phi
+    uint32_t count;
+    uint32_t capacity;
+} Pending;
+
+typedef struct Builder {
+    IrProgram* program;
+    IrFunction* function;   // Function being built
+    FILE* errors;
+    int error_count;
+    int silent;             // Building something a second time, errors were already reported
+    int too_deep;           // A lookup recursed past IR_MAX_DEPTH
+
+    uint32_t block;         // Block being added to
+    DefMap defs;
+    Pending* pending;       // Per block: incomplete phis
+    uint32_t pending_capacity;
+    uint8_t* written;       // Per global: assigned by the function being built
+    int lookups;            // Depth of variable lookups
+    int top_level;
+} Builder;
+
+static void error(Builder* builder, const char* format, ...) {
+    if (builder->silent) return;
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(builder->errors, format, arguments);
+    va_end(arguments);
+    builder->error_count++;
+}
+
+static DefSlot* def_slot(DefMap* map, uint32_t variable, uint32_t block) {
+    if ((map->used + 1) * 2 > map->capacity) {
+        uint32_t capacity = map->capacity ? map->capacity * 2 : 1024;
+        DefSlot* slots = calloc(capacity, sizeof(DefSlot));
+        if (!slots) {
+            fprintf(stderr, "Out of memory building the IR\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < map->capacity; i++) {
+            if (map->slots[i].generation != map->generation) continue;
+            uint32_t slot = (uint32_t)((map->slots[i].key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+            while (slots[slot].generation == map->generation) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = map->slots[i];
+        }
+        free(map->slots);
+        map->slots = slots;
+        map->capacity = capacity;
+    }
+
+    uint64_t key = (uint64_t)variable << 32 | block;
+    uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (map->capacity - 1);
+    while (map->slots[slot].generation == map->generation && map->slots[slot].key != key)
+        slot = (slot + 1) & (map->capacity - 1);
+    if (map->slots[slot].generation != map->generation) {
+        map->slots[slot] = (DefSlot){ key, IR_NONE, map->generation };
+        map->used++;
+    }
+    return &map->slots[slot];
+}
+
+static void write_variable(Builder* builder, uint32_t variable, uint32_t block, uint32_t value) {
+    def_slot(&builder->defs, variable, block)->value = value;
+}
+
+// What a variable holds before anything assigns it: a global's value in memory, or 0
+static uint32_t initial_value(Builder* builder, uint32_t variable) {
+    IrFunction* function = builder->function;
+    uint32_t value = variable < builder->program->global_count && !builder->top_level
+        ? new_value(function, 0, IR_LOAD, IR_NONE, IR_NONE, variable)
+        : new_value(function, 0, IR_CONST, IR_NONE, IR_NONE, 0);
+
+    // Before the entry block's jump
+    IrBlock* entry = &function->blocks[0];
+    push(&entry->values, &entry->count, &entry->capacity, value);
+    entry->values[entry->count - 1] = entry->values[entry->count - 2];
+    entry->values[entry->count - 2] = value;
+    return value;
+}
+
+static uint32_t new_phi(Builder* builder, uint32_t block) {
+    IrFunction* function = builder->function;
+    uint32_t phi = new_value(function, block, IR_PHI, IR_NONE, IR_NONE, 0);
+    IrBlock* target = &function->blocks[block];
+    push(&target->phis, &target->phi_count, &target->phi_capacity, phi);
+    return phi;
+}
+
+// A phi of one value (besides itself) is that value; the phi becomes a copy of it
+uint32_t ir_remove_trivial_phi(IrFunction* function, uint32_t phi) {
+    IrValue* value = &function->values[phi];
+    uint32_t same = IR_NONE;
+    for (uint32_t i = 0; i < value->phi_count; i++) {
+        uint32_t operand = ir_resolve(function, value->phi[i]);
+        if (operand == same || operand == phi) continue;
+        if (same != IR_NONE) return phi;
+        same = operand;
+    }
+    if (same == IR_NONE) return phi;    // Unreachable
+
+    free(value->phi);
+    *value = (IrValue){ .op = IR_COPY, .block = value->block, .args = { same, IR_NONE } };
+    return same;
+}
+
+static uint32_t read_variable(Builder* builder, uint32_t variable, uint32_t block);
+
+static uint32_t add_phi_operands(Builder* builder, uint32_t variable, uint32_t phi) {
+    IrFunction* function = builder->function;
+    uint32_t block = function->values[phi].block;
+    for (uint32_t i = 0; i < function->blocks[block].pred_count; i++) {
+        uint32_t operand = read_variable(builder, variable, function->blocks[block].preds[i]);
+        IrValue* value = &function->values[phi];
+        push(&value->phi, &value->phi_count, &value->phi_capacity, operand);
+    }
+    return ir_remove_trivial_phi(function, phi);
+}
+
+static uint32_t read_variable(Builder* builder, uint32_t variable, uint32_t block) {
+    IrFunction* function = builder->function;
+    uint32_t value = def_slot(&builder->defs, variable, block)->value;
+    if (value != IR_NONE) return ir_resolve(function, value);
+
+    // Long chains of ifs recurse once per if; past the limit the IR isn't used
+    if (builder->lookups >= IR_MAX_DEPTH) {
+        builder->too_deep = 1;
+        return initial_value(builder, variable);
+    }
+    builder->lookups++;
+
+    IrBlock* target = &function->blocks[block];
+    if (!target->sealed) {
+        value = new_phi(builder, block);
+        Pending* pending = &builder->pending[block];
+        push(&pending->entries, &pending->count, &pending->capacity, variable);
+        push(&pending->entries, &pending->count, &pending->capacity, value);
+    } else if (target->pred_count == 0) {
+        value = initial_value(builder, variable);
+    } else if (target->pred_count == 1) {
+        value = read_variable(builder, variable, target->preds[0]);
+    } else {
+        value = new_phi(builder, block);
+        write_variable(builder, variable, block, value);    // Ends the cycle through a loop
+        value = add_phi_operands(builder, variable, value);
+    }
+
+    builder->lookups--;
+    write_variable(builder, variable, block, value);
+    return value;
+}
+
+static uint32_t add_block(Builder* builder) {
+    uint32_t block = new_block(builder->function);
+    if (block >= builder->pending_capacity) {
+        uint32_t old = builder->pending_capacity;
+        builder->pending = grow(builder->pending, &builder->pending_capacity, sizeof(Pending));
+        memset(builder->pending + old, 0, sizeof(Pending) * (builder->pending_capacity - old));
+    }
+    return block;
+}
+
+// All preds of `block` are known: finish its incomplete phis
+static void seal(Builder* builder, uint32_t block) {
+    Pending* pending = &builder->pending[block];
+    for (uint32_t i = 0; i < pending->count; i += 2)
+        add_phi_operands(builder, pending->entries[i], pending->entries[i + 1]);
+    free(pending->entries);
+    *pending = (Pending){ 0 };
+    builder->function->blocks[block].sealed = 1;
+}
+
+static void jump(Builder* builder, uint32_t to) {
+    IrFunction* function = builder->function;
+    append(function, builder->block, IR_JUMP, IR_NONE, IR_NONE, 0);
+    function->blocks[builder->block].succ[0] = to;
+    function->blocks[builder->block].succ_count = 1;
+    add_pred(function, to, builder->block);
+}
+
+static void branch(Builder* builder, uint32_t condition, uint32_t then, uint32_t otherwise) {
+    IrFunction* function = builder->function;
+    append(function, builder->block, IR_BRANCH, condition, IR_NONE, 0);
+    function->blocks[builder->block].succ[0] = then;
+    function->blocks[builder->block].succ[1] = otherwise;
+    function->blocks[builder->block].succ_count = 2;
+    add_pred(function, then, builder->block);
+    add_pred(function, otherwise, builder->block);
+}
+
+// Code after a return goes in a block nothing reaches
+static void unreachable(Builder* builder) {
+    builder->block = add_block(builder);
+    builder->function->blocks[builder->block].sealed = 1;
+}
+
+
+/*
+    Variables: the globals, then the local slots of the function (see
+    symbols.h)
+*/
+static uint32_t variable(Builder* builder, const Node* identifier) {
+    if (identifier->depth == 0) return (uint32_t)identifier->slot;
+    return builder->program->global_count + (uint32_t)identifier->slot;
+}
+
+// Store the globals this function assigned, for a callee or the caller to see
+static void store_globals(Builder* builder) {
+    for (uint32_t i = 0; i < builder->program->global_count; i++) {
+        if (!builder->written[i]) continue;
+        uint32_t value = read_variable(builder, i, builder->block);
+        append(builder->function, builder->block, IR_STORE, value, IR_NONE, i);
+    }
+}
+
+
+/*
+    Expressions and statements
+*/
+static uint32_t constant(Builder* builder, long value) {
+    return append(builder->function, builder->block, IR_CONST, IR_NONE, IR_NONE, value);
+}
+
+static uint32_t expression(Builder* builder, const Node* node) {
+    if (!node) {
+        error(builder, "Missing expression\n");
+        return constant(builder, 0);
+    }
+
+    switch (node->node) {
+        case AST_INTEGER:
+            return constant(builder, node->value);
+
+        case AST_IDENTIFIER:
+            return read_variable(builder, variable(builder, node), builder->block);
+
+        case AST_UNARY: {
+            uint32_t operand = expression(builder, node->children_count > 0 ? node->children[0] : NULL);
+            return append(builder->function, builder->block, IR_NEG, operand, IR_NONE, 0);
+        }
+
+        case AST_BINOP: {
+            IrOp op;
+            int swap = 0, is_unsigned = type_unsigned_operands(node);
+            switch (node->op) {
+                case '+': op = IR_ADD; break;
+                case '-': op = IR_SUB; break;
+                case '*': op = IR_MUL; break;
+                case '/': op = is_unsigned ? IR_DIVU : IR_DIV; break;
+                case '<':                   op = is_unsigned ? IR_LTU : IR_LT; break;
+                case '>':                   op = is_unsigned ? IR_LTU : IR_LT; swap = 1; break;
+                case AST_OP_LESS_EQUAL:     op = is_unsigned ? IR_LEU : IR_LE; break;
+                case AST_OP_GREATER_EQUAL:  op = is_unsigned ? IR_LEU : IR_LE; swap = 1; break;
+                case AST_OP_EQUAL:          op = IR_EQ; break;
+                case AST_OP_NOT_EQUAL:      op = IR_NE; break;
+                default:
+                    error(builder, "Unknown operator '%c'\n", node->op);
+                    return constant(builder, 0);
+            }
+            uint32_t left = expression(builder, node->children_count > 0 ? node->children[0] : NULL);
+            uint32_t right = expression(builder, node->children_count > 1 ? node->children[1] : NULL);
+            return append(builder->function, builder->block, op, swap ? right : left, swap ? left : right, 0);
+        }
+
+        default:
+            error(builder, "Expected an expression, found %s\n", ast_node_type_name(node->node));
+            return constant(builder, 0);
+    }
+}
+
+static void statement(Builder* builder, const Node* node);
+
+static void block(Builder* builder, const Node* node) {
+    for (int i = 0; i < node->children_count; i++) statement(builder, node->children[i]);
+}
+
+static void let(Builder* builder, const Node* node) {
+    const Node* target = node->children[0];
+    const Node* initializer = node->children_count > 1 ? node->children[1] : NULL;
+    uint32_t value = expression(builder, initializer);
+    if (type_narrows((IntType)target->type, initializer))
+        value = append(builder->function, builder->block, IR_NARROW, value, IR_NONE, target->type);
+    if (target->depth == 0) builder->written[target->slot] = 1;
+    write_variable(builder, variable(builder, target), builder->block, value);
+}
+
+static void statement(Builder* builder, const Node* node) {
+    if (!node) return;
+
+    switch (node->node) {
+        case AST_LET:
+            let(builder, node);
+            break;
+
+        case AST_IF: {
+            uint32_t condition = expression(builder, node->condition);
+            uint32_t then = add_block(builder);
+            uint32_t join = add_block(builder);
+            branch(builder, condition, then, join);
+            seal(builder, then);
+            builder->block = then;
+            block(builder, node);
+            jump(builder, join);
+            seal(builder, join);
+            builder->block = join;
+            break;
+        }
+
+        case AST_WHILE: {
+            // Tested before the first iteration and again at the bottom, so each one takes one branch
+            uint32_t condition = expression(builder, node->condition);
+            uint32_t body = add_block(builder);
+            uint32_t exit = add_block(builder);
+            branch(builder, condition, body, exit);
+            builder->block = body;
+            block(builder, node);
+            builder->silent++;
+            condition = expression(builder, node->condition);
+            builder->silent--;
+            branch(builder, condition, body, exit);
+            seal(builder, body);
+            seal(builder, exit);
+            builder->block = exit;
+            break;
+        }
+
+        case AST_RETURN: {
+            uint32_t value = expression(builder, node->children_count > 0 ? node->children[0] : NULL);
+            if (!builder->top_level) store_globals(builder);
+            append(builder->function, builder->block, IR_RETURN, value, IR_NONE, 0);
+            unreachable(builder);
+            break;
+        }
+
+        case AST_FUNC:
+            error(builder, "Function '%s' must be defined at the top level\n", node->children[0]->name);
+            break;
+
+        default:
+            expression(builder, node);     // Only for its effect (a division may trap)
+            break;
+    }
+}
+
+static void begin_function(Builder* builder, uint32_t index, const char* name) {
+    IrFunction* function = &builder->program->functions[index];
+    function->name = name;
+    builder->function = function;
+    builder->top_level = index == 0;
+    builder->defs.generation++;
+    builder->defs.used = 0;
+    memset(builder->written, 0, builder->program->global_count);
+
+    // The entry block, then the code
+    uint32_t entry = add_block(builder);
+    builder->block = entry;
+    builder->function->blocks[entry].sealed = 1;
+    uint32_t start = add_block(builder);
+    jump(builder, start);
+    seal(builder, start);
+    builder->block = start;
+}
+
+// Falling off the end returns 0
+static void end_function(Builder* builder) {
+    uint32_t zero = constant(builder, 0);
+    if (!builder->top_level) store_globals(builder);
+    append(builder->function, builder->block, IR_RETURN, zero, IR_NONE, 0);
+}
+
+
+/*
+    Build the IR for a whole program into `program`, once resolve_names has
+    gone over it without errors. Problems are reported to `errors` (the
+    same ones vm_compile reports); returns how many there
+    were, or -1 if the program has too many nested ifs to build the IR for.
+    The program can't be used unless 0; ir_free releases it either way.
+*/
+int ir_build(IrProgram* program, const Node* ast, FILE* errors) {
+    memset(program, 0, sizeof(*program));
+    Builder builder = { 0 };
+    builder.program = program;
+    builder.errors = errors;
+
+    // Functions and globals are numbered already; only their counts are needed
+    program->function_count = 1;
+    for (int i = 0; i < ast->children_count; i++) {
+        const Node* node = ast->children[i];
+        if (!node || (node->node != AST_FUNC && node->node != AST_LET)) continue;
+
+        uint32_t* count = node->node == AST_FUNC ? &program->function_count : &program->global_count;
+        if (node->children[0]->slot >= (int)*count) *count = (uint32_t)node->children[0]->slot + 1;
+    }
+
+    program->functions = calloc(program->function_count, sizeof(IrFunction));
+    builder.written = malloc(program->global_count + 1);
+    if (!program->functions || !builder.written) {
+        fprintf(stderr, "Out of memory building the IR\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < ast->children_count; i++) {
+        const Node* node = ast->children[i];
+        if (!node || node->node != AST_FUNC) continue;
+
+        const Node* name = node->children[0];
+        if (name->slot < 0) continue;   // A duplicate, already reported
+
+        begin_function(&builder, (uint32_t)name->slot, name->name);
+        for (int k = 1; k < node->children_count; k++) statement(&builder, node->children[k]);
+        end_function(&builder);
+    }
+
+    // The top level, then main
+    begin_function(&builder, 0, NULL);
+    for (int i = 0; i < ast->children_count; i++) {
+        const Node* node = ast->children[i];
+        if (node && node->node != AST_FUNC) statement(&builder, node);
+    }
+
+    if (ast->slot > 0) {    // main, found by resolve_names
+        store_globals(&builder);
+        uint32_t result = append(builder.function, builder.block, IR_CALL, IR_NONE, IR_NONE, ast->slot);
+        append(builder.function, builder.block, IR_RETURN, result, IR_NONE, 0);
+    } else {
+        end_function(&builder);
+    }
+
+    for (uint32_t i = 0; i < builder.pending_capacity; i++) free(builder.pending[i].entries);
+    free(builder.pending);
+    free(builder.defs.slots);
+    free(builder.written);
+    if (builder.too_deep && !builder.error_count) return -1;
+    return builder.error_count;
+}
+
+void ir_free(IrProgram* program) {
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        IrFunction* function = &program->functions[i];
+        for (uint32_t k = 0; k < function->value_count; k++) free(function->values[k].phi);
+        for (uint32_t k = 0; k < function->block_count; k++) {
+            free(function->blocks[k].phis);
+            free(function->blocks[k].values);
+            free(function->blocks[k].preds);
+        }
+        free(function->values);
+        free(function->blocks);
+    }
+    free(program->functions);
+    memset(program, 0, sizeof(*program));
+}
+
+
+/*
+    Dump, one value per line:
+
+        b1: <- b0 b2
+            v4 = phi v2 v9
+            v5 = add v4 v3
+            branch v5 b2 b3
+*/
+static const char* op_names[IR_OP_COUNT] = {
+    [IR_CONST]  = "const",
+    [IR_PHI]    = "phi",
+    [IR_COPY]   = "copy",
+    [IR_ADD]    = "add",
+    [IR_SUB]    = "sub",
+    [IR_MUL]    = "mul",
+    [IR_DIV]    = "div",
+    [IR_DIVU]   = "divu",
+    [IR_LT]     = "lt",
+    [IR_LE]     = "le",
+    [IR_EQ]     = "eq",
+    [IR_NE]     = "ne",
+    [IR_LTU]    = "ltu",
+    [IR_LEU]    = "leu",
+    [IR_NEG]    = "neg",
+    [IR_NARROW] = "narrow",
+    [IR_LOAD]   = "load",
+    [IR_STORE]  = "store",
+    [IR_CALL]   = "call",
+    [IR_JUMP]   = "jump",
+    [IR_BRANCH] = "branch",
+    [IR_RETURN] = "return",
+};
+
+static void dump_operand(Writer* out, char prefix, uint32_t index) {
+    writer_char(out, ' ');
+    writer_char(out, prefix);
+    writer_long(out, index);
+}
+
+static void dump_value(const IrProgram* program, const IrFunction* function, uint32_t index, Writer* out) {
+    const IrValue* value = &function->values[index];
+    writer_string(out, "    ");
+    if (value->op != IR_STORE && value->op != IR_JUMP && value->op != IR_BRANCH && value->op != IR_RETURN) {
+        writer_char(out, 'v');
+        writer_long(out, index);
+        writer_string(out, " = ");
+    }
+    writer_string(out, op_names[value->op]);
+
+    const IrBlock* block = &function->blocks[value->block];
+    switch ((IrOp)value->op) {
+        case IR_CONST:
+            writer_char(out, ' ');
+            writer_long(out, value->constant);
+            break;
+        case IR_PHI:
+            for (uint32_t i = 0; i < value->phi_count; i++) dump_operand(out, 'v', value->phi[i]);
+            break;
+        case IR_LOAD:
+            dump_operand(out, 'g', (uint32_t)value->constant);
+            break;
+        case IR_STORE:
+            dump_operand(out, 'g', (uint32_t)value->constant);
+            dump_operand(out, 'v', value->args[0]);
+            break;
+        case IR_CALL:
+            writer_char(out, ' ');
+            writer_string(out, program->functions[value->constant].name);
+            break;
+        case IR_JUMP:
+            dump_operand(out, 'b', block->succ[0]);
+            break;
+        case IR_BRANCH:
+            dump_operand(out, 'v', value->args[0]);
+            dump_operand(out, 'b', block->succ[0]);
+            dump_operand(out, 'b', block->succ[1]);
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_DIVU:
+        case IR_LT:
+        case IR_LE:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LTU:
+        case IR_LEU:
+            dump_operand(out, 'v', value->args[0]);
+            dump_operand(out, 'v', value->args[1]);
+            break;
+        case IR_NARROW:
+            dump_operand(out, 'v', value->args[0]);
+            writer_char(out, ' ');
+            writer_string(out, type_name((IntType)value->constant));
+            break;
+        default:
+            dump_operand(out, 'v', value->args[0]);
+            break;
+    }
+    writer_char(out, '\n');
+}
+
+void ir_dump(const IrProgram* program, Writer* out) {
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const IrFunction* function = &program->functions[f];
+        if (!function->blocks) continue;
+
+        if (f) writer_char(out, '\n');
+        writer_string(out, "func ");
+        writer_string(out, function->name ? function->name : "(top level)");
+        writer_string(out, ":\n");
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            if (block->dead) continue;
+            writer_char(out, 'b');
+            writer_long(out, b);
+            writer_char(out, ':');
+            if (block->pred_count) writer_string(out, " <-");
+            for (uint32_t i = 0; i < block->pred_count; i++) dump_operand(out, 'b', block->preds[i]);
+            writer_char(out, '\n');
+            for (uint32_t i = 0; i < block->phi_count; i++)
+                if (!function->values[block->phis[i]].dead) dump_value(program, function, block->phis[i], out);
+            for (uint32_t i = 0; i < block->count; i++)
+                if (!function->values[block->values[i]].dead) dump_value(program, function, block->values[i], out);
+        }
+    }
+}
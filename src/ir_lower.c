@@ -0,0 +1,558 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+/*
+    Out of SSA into bytecode. Every value that needs one gets its own
+    register, except that a loop's phi shares it with the value it takes on
+    the back edge when their lives don't overlap; there is one more scratch
+    register for breaking cycles among the copies that replace phis. Those copies go on the edges into the phis'
+    block: at the end of a pred with a single successor, and otherwise on
+    a path of their own (a critical edge). For a loop's back edge that path
+    is placed right before the loop body, so each iteration still takes a
+    single branch.
+
+    Blocks are laid out in reverse postorder, which puts the body of an if
+    or a while right after the test and lets most jumps fall through.
+*/
+typedef struct Fixup {
+    uint32_t at;        // Jump instruction
+    uint32_t block;     // Target block, or the pred whose pad is the target
+    int pad;
+} Fixup;
+
+typedef struct Emitter {
+    VmProgram* program;
+    const IrFunction* function;
+    VmFunction* out;
+
+    uint32_t* reg;          // Value -> register, IR_NONE if it has none
+    uint32_t scratch;
+    uint32_t* layout;       // Live blocks in the order they're written
+    uint32_t block_count;
+    uint32_t* position;     // Block -> index in `layout`
+    uint32_t* start;        // Block -> its first instruction
+    uint32_t* pad;          // Block -> first instruction of the copies on its back edge, IR_NONE if none
+    uint8_t* has_pads;      // Block has back-edge copies written right before it
+    uint32_t current;       // Index in `layout` of the block being written
+
+    Fixup* fixups;
+    uint32_t fixup_count;
+    uint32_t fixup_capacity;
+
+    uint32_t* moves;        // Pairs of destination and source register, for one edge
+    uint32_t move_capacity;
+} Emitter;
+
+static void* allocate(size_t size) {
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        fprintf(stderr, "Out of memory compiling bytecode\n");
+        exit(1);
+    }
+    return memory;
+}
+
+static uint32_t emit(Emitter* emitter, VmInstruction instruction) {
+    VmFunction* out = emitter->out;
+    if (out->count == out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 64;
+        out->code = realloc(out->code, sizeof(VmInstruction) * out->capacity);
+        if (!out->code) {
+            fprintf(stderr, "Out of memory compiling bytecode\n");
+            exit(1);
+        }
+    }
+    out->code[out->count] = instruction;
+    return out->count++;
+}
+
+static void jump(Emitter* emitter, VmOpcode op, uint32_t condition, uint32_t block, int pad) {
+    if (emitter->fixup_count == emitter->fixup_capacity) {
+        emitter->fixup_capacity = emitter->fixup_capacity ? emitter->fixup_capacity * 2 : 64;
+        emitter->fixups = realloc(emitter->fixups, sizeof(Fixup) * emitter->fixup_capacity);
+        if (!emitter->fixups) {
+            fprintf(stderr, "Out of memory compiling bytecode\n");
+            exit(1);
+        }
+    }
+    uint32_t at = emit(emitter, (VmInstruction){ .op = op, .a = (uint16_t)condition });
+    emitter->fixups[emitter->fixup_count++] = (Fixup){ at, block, pad };
+}
+
+static void load_constant(Emitter* emitter, uint32_t dest, long value) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        emit(emitter, (VmInstruction){ .op = OP_LOADI, .a = dest, .immediate = (int32_t)value });
+        return;
+    }
+
+    VmProgram* program = emitter->program;
+    uint32_t capacity = program->constant_count;
+    if ((capacity & (capacity - 1)) == 0) {     // Sizes go 0, 1, 2, 4, ...
+        capacity = capacity ? capacity * 2 : 1;
+        program->constants = realloc(program->constants, sizeof(long) * capacity);
+        if (!program->constants) {
+            fprintf(stderr, "Out of memory compiling bytecode\n");
+            exit(1);
+        }
+    }
+    program->constants[program->constant_count] = value;
+    emit(emitter, (VmInstruction){ .op = OP_LOADK, .a = dest, .index = program->constant_count++ });
+}
+
+// The operands of a binary operator, with a constant moved to the right when the operator allows it
+static void operands(const IrFunction* function, const IrValue* value, uint32_t* left, uint32_t* right) {
+    *left = value->args[0];
+    *right = value->args[1];
+    if ((value->op == IR_ADD || value->op == IR_MUL) && function->values[*left].op == IR_CONST
+        && function->values[*right].op != IR_CONST) {
+        *left = value->args[1];
+        *right = value->args[0];
+    }
+}
+
+// Whether `right` goes in the instruction (only + - * / have such a form; division only by a constant that can't trap or overflow)
+static int small_operand(const IrFunction* function, IrOp op, uint32_t right) {
+    const IrValue* value = &function->values[right];
+    if (op > IR_DIV || value->op != IR_CONST || value->constant < INT16_MIN || value->constant > INT16_MAX) return 0;
+    return !(op == IR_DIV && (value->constant == 0 || value->constant == -1));
+}
+
+static int has_result(IrOp op) {
+    return op != IR_STORE && op != IR_JUMP && op != IR_BRANCH && op != IR_RETURN;
+}
+
+/*
+    Where each value is used: in a block at an index, or (index IR_NONE)
+    as a phi operand, at the end of the pred it comes from.
+*/
+typedef struct Use {
+    uint32_t block;
+    uint32_t index;
+} Use;
+
+typedef struct Uses {
+    uint32_t* first;    // Value -> its uses, first[v] up to first[v + 1]
+    Use* uses;
+    uint32_t* index;    // Value -> its index in its block
+} Uses;
+
+static void find_uses(const IrFunction* function, Uses* uses) {
+    uint32_t values = function->value_count;
+    uses->first = allocate(sizeof(uint32_t) * (values + 1));
+    uses->index = allocate(sizeof(uint32_t) * values);
+    memset(uses->first, 0, sizeof(uint32_t) * (values + 1));
+
+    // Count, then fill
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t* fill = pass ? allocate(sizeof(uint32_t) * values) : NULL;
+        if (pass) {
+            for (uint32_t v = 0; v < values; v++) uses->first[v + 1] += uses->first[v];
+            memcpy(fill, uses->first, sizeof(uint32_t) * values);
+            uses->uses = allocate(sizeof(Use) * uses->first[values]);
+        }
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            if (block->dead) continue;
+            for (uint32_t i = 0; i < block->phi_count; i++) {
+                const IrValue* phi = &function->values[block->phis[i]];
+                for (uint32_t k = 0; k < phi->phi_count; k++) {
+                    if (pass) uses->uses[fill[phi->phi[k]]++] = (Use){ block->preds[k], IR_NONE };
+                    else uses->first[phi->phi[k] + 1]++;
+                }
+            }
+            for (uint32_t i = 0; i < block->count; i++) {
+                const IrValue* value = &function->values[block->values[i]];
+                uses->index[block->values[i]] = i;
+                for (int k = 0; k < ir_arg_count(value->op); k++) {
+                    if (pass) uses->uses[fill[value->args[k]]++] = (Use){ b, i };
+                    else uses->first[value->args[k] + 1]++;
+                }
+            }
+        }
+        free(fill);
+    }
+}
+
+/*
+    Whether `value`, defined in the pred a loop's back edge leaves, can have
+    the register of the header's `phi`, which takes it on that edge: the
+    phi must not be needed once the value exists, in the pred or anywhere
+    laid out after it. The copy on the back edge then disappears.
+*/
+static int can_share(Emitter* emitter, const Uses* uses, uint32_t phi, uint32_t value) {
+    const IrFunction* function = emitter->function;
+    uint32_t pred = function->values[value].block;
+    uint32_t defined = uses->index[value];
+    if (function->values[value].op == IR_PHI) return 0;
+
+    // The value is only live where it dominates, which never includes the header
+    for (uint32_t i = uses->first[phi]; i < uses->first[phi + 1]; i++) {
+        const Use* use = &uses->uses[i];
+        if (use->block == pred ? use->index == IR_NONE || use->index > defined
+                               : emitter->position[use->block] > emitter->position[pred]) return 0;
+    }
+    return 1;
+}
+
+/*
+    Give registers to the values that need them; constants only need one
+    when they can't go in the instruction using them. Returns -1 if the
+    function needs more than a register window holds.
+*/
+static int assign_registers(Emitter* emitter) {
+    const IrFunction* function = emitter->function;
+    uint8_t* needed = allocate(function->value_count);
+    memset(needed, 0, function->value_count);
+
+    for (uint32_t v = 0; v < function->value_count; v++) {
+        const IrValue* value = &function->values[v];
+        if (value->dead) continue;
+        if (value->op >= IR_ADD && value->op <= IR_LEU) {
+            uint32_t left, right;
+            operands(function, value, &left, &right);
+            needed[left] = 1;
+            if (!small_operand(function, value->op, right)) needed[right] = 1;
+        } else if (ir_arg_count(value->op)) {
+            needed[value->args[0]] = 1;
+        }
+        for (uint32_t i = 0; i < value->phi_count; i++)
+            if (function->values[value->phi[i]].op != IR_CONST) needed[value->phi[i]] = 1;
+    }
+
+    uint32_t registers = 0;
+    for (uint32_t v = 0; v < function->value_count; v++) {
+        const IrValue* value = &function->values[v];
+        int gets_one = !value->dead && has_result(value->op) && (value->op != IR_CONST || needed[v]);
+        emitter->reg[v] = gets_one ? registers++ : IR_NONE;
+    }
+    free(needed);
+
+    // Values computed for the next iteration of a loop go straight into the phi's register
+    Uses uses;
+    find_uses(function, &uses);
+    uint8_t* shared = allocate(function->value_count);
+    memset(shared, 0, function->value_count);
+    for (uint32_t i = 0; i < emitter->block_count; i++) {
+        const IrBlock* block = &function->blocks[emitter->layout[i]];
+        for (uint32_t k = 0; k < block->pred_count; k++) {
+            uint32_t pred = block->preds[k];
+            if (emitter->position[pred] < i) continue;
+            for (uint32_t p = 0; p < block->phi_count; p++) {
+                uint32_t phi = block->phis[p];
+                uint32_t value = function->values[phi].phi[k];
+                if (function->values[value].block != pred || emitter->reg[value] == IR_NONE || shared[value]) continue;
+                if (!can_share(emitter, &uses, phi, value)) continue;
+                emitter->reg[value] = emitter->reg[phi];
+                shared[value] = 1;
+            }
+        }
+    }
+    free(shared);
+    free(uses.first);
+    free(uses.uses);
+    free(uses.index);
+
+    emitter->scratch = registers++;
+    emitter->out->registers = registers;
+    return registers > VM_MAX_REGISTERS ? -1 : 0;
+}
+
+
+/*
+    Edges
+*/
+// Collect the copies for the edge from `from` to `to`; returns how many moves there are
+static uint32_t collect_moves(Emitter* emitter, uint32_t from, uint32_t to, uint32_t* constants) {
+    const IrFunction* function = emitter->function;
+    const IrBlock* target = &function->blocks[to];
+    uint32_t index = 0;
+    while (index < target->pred_count && target->preds[index] != from) index++;
+
+    if (emitter->move_capacity < target->phi_count * 2) {
+        emitter->move_capacity = target->phi_count * 2;
+        free(emitter->moves);
+        emitter->moves = allocate(sizeof(uint32_t) * emitter->move_capacity);
+    }
+
+    uint32_t count = 0;
+    *constants = 0;
+    for (uint32_t i = 0; i < target->phi_count; i++) {
+        uint32_t phi = target->phis[i];
+        uint32_t operand = function->values[phi].phi[index];
+        if (emitter->reg[operand] == IR_NONE) {
+            (*constants)++;
+            continue;
+        }
+        if (emitter->reg[operand] == emitter->reg[phi]) continue;
+        emitter->moves[count * 2] = emitter->reg[phi];
+        emitter->moves[count * 2 + 1] = emitter->reg[operand];
+        count++;
+    }
+    return count;
+}
+
+static int has_copies(Emitter* emitter, uint32_t from, uint32_t to) {
+    uint32_t constants;
+    return collect_moves(emitter, from, to, &constants) || constants;
+}
+
+// The phis of `to` take their values for coming from `from`, all at once
+static void edge_copies(Emitter* emitter, uint32_t from, uint32_t to) {
+    uint32_t constants;
+    uint32_t count = collect_moves(emitter, from, to, &constants);
+    uint32_t* moves = emitter->moves;
+
+    while (count) {
+        int progress = 0;
+        for (uint32_t i = 0; i < count; ) {
+            // A move can go once nothing else still reads its destination
+            uint32_t k = 0;
+            while (k < count && moves[k * 2 + 1] != moves[i * 2]) k++;
+            if (k < count) { i++; continue; }
+            emit(emitter, (VmInstruction){ .op = OP_MOVE, .a = moves[i * 2], .b = moves[i * 2 + 1] });
+            count--;
+            moves[i * 2] = moves[count * 2];
+            moves[i * 2 + 1] = moves[count * 2 + 1];
+            progress = 1;
+        }
+        if (progress) continue;
+
+        // Only cycles are left: save one destination and read it from the scratch register instead
+        uint32_t saved = moves[0];
+        emit(emitter, (VmInstruction){ .op = OP_MOVE, .a = emitter->scratch, .b = saved });
+        for (uint32_t i = 0; i < count; i++)
+            if (moves[i * 2 + 1] == saved) moves[i * 2 + 1] = emitter->scratch;
+    }
+
+    if (!constants) return;
+    const IrFunction* function = emitter->function;
+    const IrBlock* target = &function->blocks[to];
+    uint32_t index = 0;
+    while (index < target->pred_count && target->preds[index] != from) index++;
+    for (uint32_t i = 0; i < target->phi_count; i++) {
+        uint32_t phi = target->phis[i];
+        uint32_t operand = function->values[phi].phi[index];
+        if (emitter->reg[operand] == IR_NONE) load_constant(emitter, emitter->reg[phi], function->values[operand].constant);
+    }
+}
+
+// Whether the code of `block` comes right after the block being written
+static int falls_into(Emitter* emitter, uint32_t block) {
+    return emitter->position[block] == emitter->current + 1 && !emitter->has_pads[block];
+}
+
+static int is_back_edge(Emitter* emitter, uint32_t from, uint32_t to) {
+    return emitter->position[to] <= emitter->position[from];
+}
+
+// Copies for the edge to `to`, then a jump there unless it comes next
+static void leave_to(Emitter* emitter, uint32_t from, uint32_t to) {
+    edge_copies(emitter, from, to);
+    if (!falls_into(emitter, to)) jump(emitter, OP_JUMP, 0, to, 0);
+}
+
+static void branch(Emitter* emitter, uint32_t b, uint32_t condition) {
+    const IrBlock* block = &emitter->function->blocks[b];
+    uint32_t then = block->succ[0], otherwise = block->succ[1];
+
+    // The bottom of a loop: back to the body (through its copies), or on
+    if (is_back_edge(emitter, b, then)) {
+        jump(emitter, OP_JUMPNZ, condition, emitter->pad[b] != IR_NONE ? b : then, emitter->pad[b] != IR_NONE);
+        leave_to(emitter, b, otherwise);
+        return;
+    }
+
+    if (!has_copies(emitter, b, then) && falls_into(emitter, otherwise)) {
+        jump(emitter, OP_JUMPNZ, condition, then, 0);
+        leave_to(emitter, b, otherwise);
+        return;
+    }
+
+    if (!has_copies(emitter, b, otherwise)) {
+        jump(emitter, OP_JUMPZ, condition, otherwise, 0);
+        leave_to(emitter, b, then);
+        return;
+    }
+
+    // Both edges have copies: the one for `otherwise` goes after the one for `then`
+    uint32_t skip = emit(emitter, (VmInstruction){ .op = OP_JUMPZ, .a = (uint16_t)condition });
+    edge_copies(emitter, b, then);
+    jump(emitter, OP_JUMP, 0, then, 0);
+    emitter->out->code[skip].index = emitter->out->count;
+    leave_to(emitter, b, otherwise);
+}
+
+
+/*
+    Values
+*/
+static void value(Emitter* emitter, uint32_t v) {
+    const IrFunction* function = emitter->function;
+    const IrValue* value = &function->values[v];
+    uint32_t a = emitter->reg[v];
+
+    switch ((IrOp)value->op) {
+        case IR_CONST:
+            if (a != IR_NONE) load_constant(emitter, a, value->constant);
+            break;
+
+        case IR_COPY:
+            emit(emitter, (VmInstruction){ .op = OP_MOVE, .a = a, .b = emitter->reg[value->args[0]] });
+            break;
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_DIVU:
+        case IR_LT:
+        case IR_LE:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LTU:
+        case IR_LEU: {
+            static const VmOpcode ops[] = {
+                [IR_ADD] = OP_ADD, [IR_SUB] = OP_SUB, [IR_MUL] = OP_MUL, [IR_DIV] = OP_DIV, [IR_DIVU] = OP_DIVU,
+                [IR_LT] = OP_LT, [IR_LE] = OP_LE, [IR_EQ] = OP_EQ, [IR_NE] = OP_NE, [IR_LTU] = OP_LTU, [IR_LEU] = OP_LEU,
+            };
+            static const VmOpcode small_ops[] = { [IR_ADD] = OP_ADDI, [IR_SUB] = OP_SUBI, [IR_MUL] = OP_MULI, [IR_DIV] = OP_DIVI };
+            uint32_t left, right;
+            operands(function, value, &left, &right);
+            if (small_operand(function, value->op, right)) {
+                emit(emitter, (VmInstruction){ .op = small_ops[value->op], .a = a, .b = emitter->reg[left],
+                    .small = (int16_t)function->values[right].constant });
+            } else {
+                emit(emitter, (VmInstruction){ .op = ops[value->op], .a = a, .b = emitter->reg[left], .c = emitter->reg[right] });
+            }
+            break;
+        }
+
+        case IR_NEG:
+            emit(emitter, (VmInstruction){ .op = OP_NEG, .a = a, .b = emitter->reg[value->args[0]] });
+            break;
+
+        case IR_NARROW:
+            emit(emitter, (VmInstruction){ .op = OP_NARROW, .a = a, .b = emitter->reg[value->args[0]], .c = (uint16_t)value->constant });
+            break;
+
+        case IR_LOAD:
+            emit(emitter, (VmInstruction){ .op = OP_GETG, .a = a, .index = (uint32_t)value->constant });
+            break;
+
+        case IR_STORE:
+            emit(emitter, (VmInstruction){ .op = OP_SETG, .a = emitter->reg[value->args[0]], .index = (uint32_t)value->constant });
+            break;
+
+        case IR_CALL:
+            emit(emitter, (VmInstruction){ .op = OP_CALL, .a = a, .index = (uint32_t)value->constant });
+            break;
+
+        case IR_JUMP:
+            leave_to(emitter, value->block, function->blocks[value->block].succ[0]);
+            break;
+
+        case IR_BRANCH:
+            branch(emitter, value->block, emitter->reg[value->args[0]]);
+            break;
+
+        case IR_RETURN:
+            emit(emitter, (VmInstruction){ .op = OP_RETURN, .a = emitter->reg[value->args[0]] });
+            break;
+
+        default:
+            break;
+    }
+}
+
+static int lower_function(Emitter* emitter) {
+    const IrFunction* function = emitter->function;
+    uint32_t blocks = function->block_count;
+    emitter->reg = allocate(sizeof(uint32_t) * function->value_count);
+    emitter->layout = allocate(sizeof(uint32_t) * blocks);
+    emitter->position = allocate(sizeof(uint32_t) * blocks);
+    emitter->start = allocate(sizeof(uint32_t) * blocks);
+    emitter->pad = allocate(sizeof(uint32_t) * blocks);
+    emitter->has_pads = allocate(blocks);
+    emitter->fixup_count = 0;
+    memset(emitter->has_pads, 0, blocks);
+    emitter->block_count = ir_reverse_postorder(function, emitter->layout, emitter->position);
+
+    int status = assign_registers(emitter);
+    if (status == 0) {
+        // Back edges with copies get a pad before the loop body
+        for (uint32_t i = 0; i < emitter->block_count; i++) {
+            uint32_t b = emitter->layout[i];
+            const IrBlock* block = &function->blocks[b];
+            emitter->pad[b] = IR_NONE;
+            if (block->succ_count == 2 && is_back_edge(emitter, b, block->succ[0]) && has_copies(emitter, b, block->succ[0])) {
+                emitter->pad[b] = 0;
+                emitter->has_pads[block->succ[0]] = 1;
+            }
+        }
+
+        for (uint32_t i = 0; i < emitter->block_count; i++) {
+            uint32_t b = emitter->layout[i];
+            const IrBlock* block = &function->blocks[b];
+            emitter->current = i;
+            if (emitter->has_pads[b]) {
+                uint32_t pads = 0;
+                for (uint32_t k = 0; k < block->pred_count; k++) {
+                    uint32_t pred = block->preds[k];
+                    if (emitter->pad[pred] == IR_NONE || function->blocks[pred].succ[0] != b) continue;
+                    if (pads++) jump(emitter, OP_JUMP, 0, b, 0);
+                    emitter->pad[pred] = emitter->out->count;
+                    edge_copies(emitter, pred, b);
+                }
+            }
+            emitter->start[b] = emitter->out->count;
+            for (uint32_t k = 0; k < block->count; k++) value(emitter, block->values[k]);
+        }
+
+        for (uint32_t i = 0; i < emitter->fixup_count; i++) {
+            const Fixup* fixup = &emitter->fixups[i];
+            emitter->out->code[fixup->at].index = fixup->pad ? emitter->pad[fixup->block] : emitter->start[fixup->block];
+        }
+    }
+
+    free(emitter->reg);
+    free(emitter->layout);
+    free(emitter->position);
+    free(emitter->start);
+    free(emitter->pad);
+    free(emitter->has_pads);
+    return status;
+}
+
+
+/*
+    Lower an optimized program to bytecode in `bytecode`. Returns 0, or -1
+    if a function needs more registers than the VM has; vm_program_free
+    releases the bytecode either way.
+*/
+int ir_lower(const IrProgram* program, VmProgram* bytecode) {
+    memset(bytecode, 0, sizeof(*bytecode));
+    bytecode->function_count = program->function_count;
+    bytecode->global_count = program->global_count;
+    bytecode->functions = calloc(program->function_count, sizeof(VmFunction));
+    if (!bytecode->functions) {
+        fprintf(stderr, "Out of memory compiling bytecode\n");
+        exit(1);
+    }
+
+    Emitter emitter = { 0 };
+    emitter.program = bytecode;
+    int status = 0;
+    for (uint32_t i = 0; i < program->function_count && status == 0; i++) {
+        const IrFunction* function = &program->functions[i];
+        if (!function->blocks) continue;
+        emitter.function = function;
+        emitter.out = &bytecode->functions[i];
+        emitter.out->name = function->name;
+        status = lower_function(&emitter);
+    }
+    free(emitter.fixups);
+    free(emitter.moves);
+    return status;
+}
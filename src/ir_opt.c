@@ -0,0 +1,510 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "types.h"
+
+static void* allocate(size_t size) {
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        fprintf(stderr, "Out of memory optimizing the IR\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// Same results as the generated code (see fold.c)
+static inline long wrap_add(long a, long b) { return (long)((unsigned long)a + (unsigned long)b); }
+static inline long wrap_sub(long a, long b) { return (long)((unsigned long)a - (unsigned long)b); }
+static inline long wrap_mul(long a, long b) { return (long)((unsigned long)a * (unsigned long)b); }
+static inline long wrap_neg(long a) { return (long)(0ul - (unsigned long)a); }
+
+static inline int is_constant(const IrFunction* function, uint32_t value, long constant) {
+    return function->values[value].op == IR_CONST && function->values[value].constant == constant;
+}
+
+// Turn `value` into a copy of `of`, for copy propagation to clean up
+static void replace(IrFunction* function, uint32_t value, uint32_t of) {
+    IrValue* target = &function->values[value];
+    free(target->phi);
+    *target = (IrValue){ .op = IR_COPY, .block = target->block, .args = { of, IR_NONE } };
+}
+
+static void make_constant(IrFunction* function, uint32_t value, long constant) {
+    IrValue* target = &function->values[value];
+    free(target->phi);
+    *target = (IrValue){ .op = IR_CONST, .block = target->block, .args = { IR_NONE, IR_NONE }, .constant = constant };
+}
+
+
+/*
+    Copy propagation. Phis with a single incoming value become copies of
+    it, then every operand is pointed past the copies and the copies are
+    dropped.
+*/
+static void propagate_copies(IrFunction* function) {
+    int changed;
+    do {
+        changed = 0;
+        for (uint32_t b = 0; b < function->block_count; b++) {
+            const IrBlock* block = &function->blocks[b];
+            if (block->dead) continue;
+            for (uint32_t i = 0; i < block->phi_count; i++) {
+                uint32_t phi = block->phis[i];
+                if (function->values[phi].op == IR_PHI && ir_remove_trivial_phi(function, phi) != phi) changed = 1;
+            }
+        }
+    } while (changed);
+
+    for (uint32_t v = 0; v < function->value_count; v++) {
+        IrValue* value = &function->values[v];
+        if (value->dead) continue;
+        for (int i = 0; i < ir_arg_count(value->op); i++) value->args[i] = ir_resolve(function, value->args[i]);
+        for (uint32_t i = 0; i < value->phi_count; i++) value->phi[i] = ir_resolve(function, value->phi[i]);
+    }
+    for (uint32_t v = 0; v < function->value_count; v++)
+        if (function->values[v].op == IR_COPY) function->values[v].dead = 1;
+}
+
+
+/*
+    Dominators (Cooper, Harvey and Kennedy, "A Simple, Fast Dominance
+    Algorithm"), over the blocks reachable from the entry in reverse
+    postorder. `pre` and `post` number the dominator tree, so a block
+    dominates another when its interval contains the other's.
+*/
+typedef struct Dominators {
+    uint32_t* order;    // Reachable blocks in reverse postorder
+    uint32_t count;
+    uint32_t* position; // Block -> index in `order`, IR_NONE if unreachable
+    uint32_t* idom;
+    uint32_t* tree;     // Reachable blocks in dominator-tree preorder
+    uint32_t* pre;
+    uint32_t* post;
+} Dominators;
+
+// Blocks reachable from the entry, in reverse postorder (without recursion, CFGs get deep)
+uint32_t ir_reverse_postorder(const IrFunction* function, uint32_t* order, uint32_t* position) {
+    uint32_t* stack = allocate(sizeof(uint32_t) * 2 * function->block_count);
+    uint32_t depth = 0, count = 0;
+    for (uint32_t b = 0; b < function->block_count; b++) position[b] = IR_NONE;
+
+    position[0] = 0;
+    stack[depth++] = 0;
+    stack[depth++] = 0;
+    while (depth) {
+        uint32_t block = stack[depth - 2];
+        uint32_t next = stack[depth - 1]++;
+        if (next < function->blocks[block].succ_count) {
+            uint32_t succ = function->blocks[block].succ[next];
+            if (position[succ] == IR_NONE) {
+                position[succ] = 0;
+                stack[depth++] = succ;
+                stack[depth++] = 0;
+            }
+            continue;
+        }
+        order[count++] = block;
+        depth -= 2;
+    }
+    free(stack);
+
+    for (uint32_t i = 0; i < count / 2; i++) {
+        uint32_t swap = order[i];
+        order[i] = order[count - 1 - i];
+        order[count - 1 - i] = swap;
+    }
+    for (uint32_t i = 0; i < count; i++) position[order[i]] = i;
+    return count;
+}
+
+static uint32_t intersect(const Dominators* dominators, uint32_t a, uint32_t b) {
+    while (a != b) {
+        while (dominators->position[a] > dominators->position[b]) a = dominators->idom[a];
+        while (dominators->position[b] > dominators->position[a]) b = dominators->idom[b];
+    }
+    return a;
+}
+
+static void find_dominators(const IrFunction* function, Dominators* dominators) {
+    uint32_t blocks = function->block_count;
+    dominators->order = allocate(sizeof(uint32_t) * blocks);
+    dominators->position = allocate(sizeof(uint32_t) * blocks);
+    dominators->idom = allocate(sizeof(uint32_t) * blocks);
+    dominators->tree = allocate(sizeof(uint32_t) * blocks);
+    dominators->pre = allocate(sizeof(uint32_t) * blocks);
+    dominators->post = allocate(sizeof(uint32_t) * blocks);
+    dominators->count = ir_reverse_postorder(function, dominators->order, dominators->position);
+
+    for (uint32_t b = 0; b < blocks; b++) dominators->idom[b] = IR_NONE;
+    dominators->idom[0] = 0;
+    int changed;
+    do {
+        changed = 0;
+        for (uint32_t i = 1; i < dominators->count; i++) {
+            uint32_t block = dominators->order[i];
+            const IrBlock* target = &function->blocks[block];
+            uint32_t idom = IR_NONE;
+            for (uint32_t k = 0; k < target->pred_count; k++) {
+                uint32_t pred = target->preds[k];
+                if (dominators->idom[pred] == IR_NONE) continue;
+                idom = idom == IR_NONE ? pred : intersect(dominators, pred, idom);
+            }
+            if (idom != dominators->idom[block]) {
+                dominators->idom[block] = idom;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    // Walk the tree, numbering it
+    uint32_t* first = allocate(sizeof(uint32_t) * (blocks + 1));
+    uint32_t* children = allocate(sizeof(uint32_t) * blocks);
+    memset(first, 0, sizeof(uint32_t) * (blocks + 1));
+    for (uint32_t i = 1; i < dominators->count; i++) first[dominators->idom[dominators->order[i]] + 1]++;
+    for (uint32_t b = 0; b < blocks; b++) first[b + 1] += first[b];
+    uint32_t* fill = allocate(sizeof(uint32_t) * blocks);
+    memcpy(fill, first, sizeof(uint32_t) * blocks);
+    for (uint32_t i = 1; i < dominators->count; i++) {
+        uint32_t block = dominators->order[i];
+        children[fill[dominators->idom[block]]++] = block;
+    }
+
+    uint32_t* stack = allocate(sizeof(uint32_t) * 2 * (dominators->count + 1));
+    uint32_t depth = 0, clock = 0, visited = 0;
+    stack[depth++] = 0;
+    stack[depth++] = first[0];
+    dominators->tree[visited++] = 0;
+    dominators->pre[0] = clock++;
+    while (depth) {
+        uint32_t block = stack[depth - 2];
+        uint32_t next = stack[depth - 1]++;
+        if (next < first[block + 1]) {
+            uint32_t child = children[next];
+            dominators->tree[visited++] = child;
+            dominators->pre[child] = clock++;
+            stack[depth++] = child;
+            stack[depth++] = first[child];
+            continue;
+        }
+        dominators->post[block] = clock++;
+        depth -= 2;
+    }
+    free(stack);
+    free(fill);
+    free(children);
+    free(first);
+}
+
+static inline int dominates(const Dominators* dominators, uint32_t a, uint32_t b) {
+    return dominators->pre[a] <= dominators->pre[b] && dominators->post[b] <= dominators->post[a];
+}
+
+static void free_dominators(Dominators* dominators) {
+    free(dominators->order);
+    free(dominators->position);
+    free(dominators->idom);
+    free(dominators->tree);
+    free(dominators->pre);
+    free(dominators->post);
+}
+
+
+/*
+    Global value numbering. Blocks are visited in dominator-tree preorder,
+    and a value the same as one in a dominating block becomes a copy of it.
+    Operators on constants are folded on the way, with a few identities.
+    A division is numbered too: a dominating one with the same operands
+    has already trapped if it was going to.
+
+    The table holds values, keyed by their operator, operands and constant,
+    one entry per key. An entry from a block that doesn't dominate the
+    current one is from a finished subtree and can never match again, so
+    it's overwritten.
+*/
+typedef struct Number {
+    uint8_t op;
+    uint32_t args[2];   // In order for + * == !=, which don't care
+    long constant;
+} Number;
+
+static Number number_of(const IrValue* value) {
+    Number number = { value->op, { value->args[0], value->args[1] }, value->constant };
+    int commutes = number.op == IR_ADD || number.op == IR_MUL || number.op == IR_EQ || number.op == IR_NE;
+    if (commutes && number.args[0] > number.args[1]) {
+        number.args[0] = value->args[1];
+        number.args[1] = value->args[0];
+    }
+    if (ir_arg_count(number.op) < 2) number.args[1] = IR_NONE;
+    if (ir_arg_count(number.op) < 1) number.args[0] = IR_NONE;
+    return number;
+}
+
+static int is_pure(IrOp op) {
+    return op == IR_CONST || (op >= IR_ADD && op <= IR_NARROW);
+}
+
+// Fold or simplify `value` in place; returns 1 if it became a copy
+static int simplify(IrFunction* function, uint32_t v) {
+    IrValue* value = &function->values[v];
+    if (value->op < IR_ADD || value->op > IR_NARROW) return 0;
+
+    const IrValue* left = &function->values[value->args[0]];
+    if (value->op == IR_NEG) {
+        if (left->op == IR_CONST) make_constant(function, v, wrap_neg(left->constant));
+        else if (left->op == IR_NEG) { replace(function, v, left->args[0]); return 1; }
+        return 0;
+    }
+    if (value->op == IR_NARROW) {
+        IntType type = (IntType)value->constant;
+        if (left->op == IR_CONST) make_constant(function, v, type_wrap(type, left->constant));
+        else if (left->op == IR_NARROW && type_within((IntType)left->constant, type)) { replace(function, v, value->args[0]); return 1; }
+        return 0;
+    }
+
+    const IrValue* right = &function->values[value->args[1]];
+    if (left->op == IR_CONST && right->op == IR_CONST) {
+        long a = left->constant, b = right->constant;
+        switch ((IrOp)value->op) {
+            case IR_ADD: make_constant(function, v, wrap_add(a, b)); break;
+            case IR_SUB: make_constant(function, v, wrap_sub(a, b)); break;
+            case IR_MUL: make_constant(function, v, wrap_mul(a, b)); break;
+            case IR_DIV:
+                if (b == 0) break;  // Still traps at run time
+                make_constant(function, v, b == -1 ? wrap_neg(a) : a / b);
+                break;
+            case IR_DIVU:
+                if (b == 0) break;
+                make_constant(function, v, (long)((unsigned long)a / (unsigned long)b));
+                break;
+            case IR_LT:  make_constant(function, v, a < b); break;
+            case IR_LE:  make_constant(function, v, a <= b); break;
+            case IR_EQ:  make_constant(function, v, a == b); break;
+            case IR_NE:  make_constant(function, v, a != b); break;
+            case IR_LTU: make_constant(function, v, (unsigned long)a < (unsigned long)b); break;
+            case IR_LEU: make_constant(function, v, (unsigned long)a <= (unsigned long)b); break;
+            default: break;
+        }
+        return 0;
+    }
+
+    uint32_t x = value->args[0], y = value->args[1];
+    switch ((IrOp)value->op) {
+        case IR_ADD:
+            if (is_constant(function, y, 0)) { replace(function, v, x); return 1; }
+            if (is_constant(function, x, 0)) { replace(function, v, y); return 1; }
+            break;
+        case IR_SUB:
+            if (is_constant(function, y, 0)) { replace(function, v, x); return 1; }
+            if (x == y) make_constant(function, v, 0);
+            break;
+        case IR_MUL:
+            // Operands are values already computed, so x*0 is 0 even if x came from a division
+            if (is_constant(function, y, 1)) { replace(function, v, x); return 1; }
+            if (is_constant(function, x, 1)) { replace(function, v, y); return 1; }
+            if (is_constant(function, x, 0) || is_constant(function, y, 0)) make_constant(function, v, 0);
+            break;
+        case IR_DIV:
+        case IR_DIVU:
+            if (is_constant(function, y, 1)) { replace(function, v, x); return 1; }
+            break;
+        case IR_LT:
+        case IR_NE:
+        case IR_LTU:
+            if (x == y) make_constant(function, v, 0);
+            break;
+        case IR_LE:
+        case IR_EQ:
+        case IR_LEU:
+            if (x == y) make_constant(function, v, 1);
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static inline uint32_t hash_number(const Number* number) {
+    uint64_t hash = (uint64_t)number->op * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ number->args[0]) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ number->args[1]) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (uint64_t)number->constant) * 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(hash >> 32);
+}
+
+static void number_values(IrFunction* function, const Dominators* dominators) {
+    uint32_t capacity = 64;
+    while (capacity < function->value_count * 2) capacity *= 2;
+    uint32_t* table = allocate(sizeof(uint32_t) * capacity);
+    memset(table, 0xff, sizeof(uint32_t) * capacity);    // IR_NONE
+
+    for (uint32_t i = 0; i < dominators->count; i++) {
+        uint32_t b = dominators->tree[i];
+        const IrBlock* block = &function->blocks[b];
+        for (uint32_t k = 0; k < block->count; k++) {
+            uint32_t v = block->values[k];
+            IrValue* value = &function->values[v];
+            if (value->dead) continue;
+            for (int a = 0; a < ir_arg_count(value->op); a++) value->args[a] = ir_resolve(function, value->args[a]);
+            if (simplify(function, v) || !is_pure(value->op)) continue;
+
+            Number key = number_of(value);
+            uint32_t slot = hash_number(&key) & (capacity - 1);
+            while (table[slot] != IR_NONE) {
+                Number entry = number_of(&function->values[table[slot]]);
+                if (entry.op == key.op && entry.args[0] == key.args[0] && entry.args[1] == key.args[1]
+                    && entry.constant == key.constant) break;
+                slot = (slot + 1) & (capacity - 1);
+            }
+            uint32_t found = table[slot];
+            if (found != IR_NONE && dominates(dominators, function->values[found].block, b)) replace(function, v, found);
+            else table[slot] = v;
+        }
+    }
+    free(table);
+}
+
+
+/*
+    Branches on a constant become jumps, and blocks nothing reaches any
+    more are removed, along with their operands of phis.
+*/
+static void remove_pred(IrFunction* function, uint32_t block, uint32_t pred) {
+    IrBlock* target = &function->blocks[block];
+    uint32_t index = 0;
+    while (index < target->pred_count && target->preds[index] != pred) index++;
+    if (index == target->pred_count) return;
+
+    memmove(target->preds + index, target->preds + index + 1, sizeof(uint32_t) * (target->pred_count - index - 1));
+    target->pred_count--;
+    for (uint32_t i = 0; i < target->phi_count; i++) {
+        IrValue* phi = &function->values[target->phis[i]];
+        if (phi->op != IR_PHI || index >= phi->phi_count) continue;
+        memmove(phi->phi + index, phi->phi + index + 1, sizeof(uint32_t) * (phi->phi_count - index - 1));
+        phi->phi_count--;
+    }
+}
+
+static void fold_branches(IrFunction* function) {
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        if (block->dead || !block->count) continue;
+        IrValue* last = &function->values[block->values[block->count - 1]];
+        if (last->op != IR_BRANCH) continue;
+
+        const IrValue* condition = &function->values[ir_resolve(function, last->args[0])];
+        if (condition->op != IR_CONST) continue;
+        uint32_t taken = condition->constant ? block->succ[0] : block->succ[1];
+        uint32_t skipped = condition->constant ? block->succ[1] : block->succ[0];
+        if (skipped != taken) remove_pred(function, skipped, b);
+        *last = (IrValue){ .op = IR_JUMP, .block = b, .args = { IR_NONE, IR_NONE } };
+        block->succ[0] = taken;
+        block->succ[1] = IR_NONE;
+        block->succ_count = 1;
+    }
+}
+
+static void remove_unreachable(IrFunction* function) {
+    uint32_t* order = allocate(sizeof(uint32_t) * function->block_count);
+    uint32_t* position = allocate(sizeof(uint32_t) * function->block_count);
+    ir_reverse_postorder(function, order, position);
+
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        if (block->dead || position[b] != IR_NONE) continue;
+        for (uint32_t i = 0; i < block->succ_count; i++)
+            if (position[block->succ[i]] != IR_NONE) remove_pred(function, block->succ[i], b);
+        for (uint32_t i = 0; i < block->phi_count; i++) function->values[block->phis[i]].dead = 1;
+        for (uint32_t i = 0; i < block->count; i++) function->values[block->values[i]].dead = 1;
+        block->dead = 1;
+    }
+    free(order);
+    free(position);
+}
+
+
+/*
+    Dead-code elimination: everything stores, calls, control flow and
+    divisions that may trap don't depend on is removed.
+*/
+static int has_effect(const IrFunction* function, const IrValue* value) {
+    switch ((IrOp)value->op) {
+        case IR_STORE:
+        case IR_CALL:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RETURN:
+            return 1;
+        case IR_DIV:
+        case IR_DIVU: {
+            const IrValue* divisor = &function->values[value->args[1]];
+            return divisor->op != IR_CONST || divisor->constant == 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+static void compact(IrFunction* function, uint32_t* list, uint32_t* count) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < *count; i++)
+        if (!function->values[list[i]].dead) list[kept++] = list[i];
+    *count = kept;
+}
+
+static void eliminate_dead_code(IrFunction* function) {
+    uint8_t* live = allocate(function->value_count);
+    uint32_t* work = allocate(sizeof(uint32_t) * function->value_count);
+    uint32_t pending = 0;
+    memset(live, 0, function->value_count);
+
+    for (uint32_t v = 0; v < function->value_count; v++) {
+        const IrValue* value = &function->values[v];
+        if (!value->dead && has_effect(function, value)) {
+            live[v] = 1;
+            work[pending++] = v;
+        }
+    }
+    while (pending) {
+        const IrValue* value = &function->values[work[--pending]];
+        for (int i = 0; i < ir_arg_count(value->op); i++) {
+            uint32_t arg = value->args[i];
+            if (!live[arg]) { live[arg] = 1; work[pending++] = arg; }
+        }
+        for (uint32_t i = 0; i < value->phi_count; i++) {
+            uint32_t arg = value->phi[i];
+            if (!live[arg]) { live[arg] = 1; work[pending++] = arg; }
+        }
+    }
+
+    for (uint32_t v = 0; v < function->value_count; v++)
+        if (!live[v]) function->values[v].dead = 1;
+    for (uint32_t b = 0; b < function->block_count; b++) {
+        IrBlock* block = &function->blocks[b];
+        compact(function, block->phis, &block->phi_count);
+        compact(function, block->values, &block->count);
+    }
+    free(live);
+    free(work);
+}
+
+
+static void optimize_function(IrFunction* function) {
+    // A second round picks up what folding branches exposed
+    for (int round = 0; round < 2; round++) {
+        propagate_copies(function);
+        Dominators dominators;
+        find_dominators(function, &dominators);
+        number_values(function, &dominators);
+        free_dominators(&dominators);
+        fold_branches(function);
+        remove_unreachable(function);
+    }
+    propagate_copies(function);
+    eliminate_dead_code(function);
+}
+
+void ir_optimize(IrProgram* program) {
+    for (uint32_t i = 0; i < program->function_count; i++)
+        if (program->functions[i].blocks) optimize_function(&program->functions[i]);
+}
@@ -0,0 +1,506 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "regalloc.h"
+#include "types.h"
+
+#define JIT_STACK_REGISTERS (1 << 20)   // Register stack shared by all calls
+
+#define JIT_TRAP_DIVIDE 1
+#define JIT_TRAP_CALLS  2
+
+/*
+    What generated code gets in rsi. It keeps it in r12, the register
+    window in rbx and the globals in r13.
+*/
+typedef struct JitContext {
+    long* limit;        // End of the register stack
+    int32_t trap;       // JIT_TRAP_*, or 0
+    int32_t unused;
+    long* globals;
+} JitContext;
+
+_Static_assert(offsetof(JitContext, limit) == 0, "generated code reads limit at [r12]");
+_Static_assert(offsetof(JitContext, trap) == 8, "generated code reads trap at [r12 + 8]");
+_Static_assert(offsetof(JitContext, globals) == 16, "generated code reads globals at [r12 + 16]");
+
+typedef long (*JitFunction)(long* registers, JitContext* context);
+
+// Values can live in these: the ones calls change first, then rbp, r14 and r15, which calls preserve
+static const char* const machine_names[] = { "rsi", "rdi", "r8", "r9", "r10", "r11", "rbp", "r14", "r15" };
+const RegisterSet jit_registers = { machine_names, sizeof(machine_names) / sizeof(*machine_names), 6 };
+
+
+void jit_free(JitProgram* jit) {
+    if (jit->memory) munmap(jit->memory, jit->size);
+    free(jit->entries);
+    memset(jit, 0, sizeof(*jit));
+}
+
+
+/*
+    Run a program compiled by jit_compile. Same contract as vm_run: the
+    result goes to `result` and 0 is returned, or a trap is reported to
+    `errors` and 1 returned.
+*/
+int jit_run(const JitProgram* jit, long* result, FILE* errors) {
+    long* stack = malloc(sizeof(long) * JIT_STACK_REGISTERS);
+    long* globals = calloc(jit->global_count ? jit->global_count : 1, sizeof(long));
+    if (!stack || !globals) {
+        fprintf(stderr, "Out of memory running compiled code\n");
+        exit(1);
+    }
+
+    JitContext context = { stack + JIT_STACK_REGISTERS, 0, 0, globals };
+    JitFunction entry = (JitFunction)(void*)(jit->memory + jit->entries[0]);
+    long value = entry(stack, &context);
+
+    free(stack);
+    free(globals);
+    switch (context.trap) {
+        case JIT_TRAP_DIVIDE: fputs("serrate: division by zero\n", errors); return 1;
+        case JIT_TRAP_CALLS:  fputs("serrate: too many nested calls\n", errors); return 1;
+    }
+    *result = value;
+    return 0;
+}
+
+
+#if defined(__x86_64__)
+
+/*
+    Assembly
+*/
+typedef struct Code {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} Code;
+
+typedef struct Fixup {
+    size_t at;          // Position of a rel32
+    uint32_t target;    // Instruction index (jumps) or function index (calls)
+} Fixup;
+
+typedef struct Fixups {
+    Fixup* items;
+    size_t count;
+    size_t capacity;
+} Fixups;
+
+static void reserve(Code* code, size_t size) {
+    if (code->length + size <= code->capacity) return;
+    while (code->length + size > code->capacity) code->capacity = code->capacity ? code->capacity * 2 : 4096;
+    code->bytes = realloc(code->bytes, code->capacity);
+    if (!code->bytes) {
+        fprintf(stderr, "Out of memory compiling code\n");
+        exit(1);
+    }
+}
+
+static void put(Code* code, const uint8_t* bytes, size_t size) {
+    reserve(code, size);
+    memcpy(code->bytes + code->length, bytes, size);
+    code->length += size;
+}
+
+#define PUT(code, ...) do { static const uint8_t bytes[] = { __VA_ARGS__ }; put(code, bytes, sizeof(bytes)); } while (0)
+
+static void put8(Code* code, uint8_t value) {
+    put(code, &value, 1);
+}
+
+static void put32(Code* code, uint32_t value) {
+    uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    put(code, bytes, 4);
+}
+
+static void put64(Code* code, uint64_t value) {
+    put32(code, (uint32_t)value);
+    put32(code, (uint32_t)(value >> 32));
+}
+
+static void patch32(Code* code, size_t at, uint32_t value) {
+    uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    memcpy(code->bytes + at, bytes, 4);
+}
+
+// Leave a rel32 to be patched once `target` is known
+static void fixup(Fixups* fixups, Code* code, uint32_t target) {
+    if (fixups->count == fixups->capacity) {
+        fixups->capacity = fixups->capacity ? fixups->capacity * 2 : 64;
+        fixups->items = realloc(fixups->items, sizeof(Fixup) * fixups->capacity);
+        if (!fixups->items) {
+            fprintf(stderr, "Out of memory compiling code\n");
+            exit(1);
+        }
+    }
+    fixups->items[fixups->count++] = (Fixup){ code->length, target };
+    put32(code, 0);
+}
+
+static void resolve(Code* code, const Fixups* fixups, const uint32_t* offsets) {
+    for (size_t i = 0; i < fixups->count; i++) {
+        const Fixup* f = &fixups->items[i];
+        patch32(code, f->at, (uint32_t)((int64_t)offsets[f->target] - (int64_t)(f->at + 4)));
+    }
+}
+
+
+/*
+    Instructions. A VM register lives in the machine register the
+    allocator gave it (see regalloc.h), or else in its slot of the window.
+    rax, rcx and rdx are scratch: results the destination can't hold go
+    through rax, and division uses all three.
+*/
+#define RAX 0
+#define RCX 1
+#define RBX 3
+#define R13 13
+
+// Numbers of the registers in jit_registers
+static const uint8_t machine[] = { 6, 7, 8, 9, 10, 11, 5, 14, 15 };
+_Static_assert(sizeof(machine) == sizeof(machine_names) / sizeof(*machine_names), "one number per register");
+
+typedef struct Emitter {
+    Code* code;
+    const uint8_t* location;    // From the RegisterAssignment
+} Emitter;
+
+static inline uint32_t slot(int reg) { return (uint32_t)reg * 8; }
+
+// REX.W, `opcode` (two bytes if above 0xFF) and ModRM: `reg` with `rm`, or [rm + disp32] when `memory`
+static void encode(Code* code, uint16_t opcode, int reg, int rm, int memory, uint32_t displacement) {
+    uint8_t bytes[4];
+    size_t length = 0;
+    bytes[length++] = 0x48 | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+    if (opcode > 0xFF) bytes[length++] = opcode >> 8;
+    bytes[length++] = opcode & 0xFF;
+    bytes[length++] = (memory ? 0x80 : 0xC0) | (reg & 7) << 3 | (rm & 7);
+    put(code, bytes, length);
+    if (memory) put32(code, displacement);
+}
+
+// The machine register VM register `vm` lives in, or -1
+static int where(const Emitter* e, int vm) {
+    uint8_t location = e->location[vm];
+    return location == REGALLOC_SPILLED ? -1 : machine[location];
+}
+
+// `opcode` with `reg` and VM register `vm` as the r/m operand
+static void operand(Emitter* e, uint16_t opcode, int reg, int vm) {
+    int rm = where(e, vm);
+    if (rm < 0) encode(e->code, opcode, reg, RBX, 1, slot(vm));
+    else encode(e->code, opcode, reg, rm, 0, 0);
+}
+
+static void load(Emitter* e, int reg, int vm) {
+    if (where(e, vm) != reg) operand(e, 0x8B, reg, vm);    // mov reg, vm
+}
+
+static void store(Emitter* e, int vm, int reg) {
+    if (where(e, vm) != reg) operand(e, 0x89, reg, vm);    // mov vm, reg
+}
+
+// Where to compute a result for `vm`: its own register, or rax
+static int target(const Emitter* e, int vm) {
+    int reg = where(e, vm);
+    return reg < 0 ? RAX : reg;
+}
+
+static void epilogue(Code* code, uint32_t saved) {
+    for (int i = sizeof(machine) - 1; i >= 0; i--) {
+        if (!(saved & (1u << i))) continue;
+        if (machine[i] & 8) PUT(code, 0x41);
+        put8(code, 0x58 + (machine[i] & 7));                        // pop
+    }
+    PUT(code, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);                  // pop r13; pop r12; pop rbx; ret
+}
+
+
+/*
+    Translate one function. Jumps inside it are resolved here; calls are
+    left in `calls` until every function has an address.
+*/
+static int translate(Code* code, const VmProgram* program, const VmFunction* function, Fixups* calls) {
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (function->count + 1));
+    if (!offsets) {
+        fprintf(stderr, "Out of memory compiling code\n");
+        exit(1);
+    }
+
+    RegisterAssignment assignment;
+    regalloc(&assignment, function, &jit_registers);
+    Fixups jumps = { 0 }, divide = { 0 }, calls_out = { 0 }, bail = { 0 };
+    Emitter e = { code, assignment.location };
+    int supported = 1;
+
+    // push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi; mov r13, [r12 + 16]; then the preserved registers used
+    PUT(code, 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x4D, 0x8B, 0x6C, 0x24, 0x10);
+    for (uint32_t i = 0; i < sizeof(machine); i++) {
+        if (!(assignment.saved & (1u << i))) continue;
+        if (machine[i] & 8) PUT(code, 0x41);
+        put8(code, 0x50 + (machine[i] & 7));                        // push
+    }
+
+    for (uint32_t i = 0; i < function->count && supported; i++) {
+        const VmInstruction* in = &function->code[i];
+        offsets[i] = (uint32_t)code->length;
+
+        switch ((VmOpcode)in->op) {
+            case OP_MOVE: {
+                int reg = where(&e, in->a) >= 0 ? where(&e, in->a) : target(&e, in->b);
+                load(&e, reg, in->b);
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_LOADI:
+                operand(&e, 0xC7, 0, in->a); put32(code, (uint32_t)in->immediate);       // mov vm, imm32
+                break;
+
+            case OP_LOADK: {
+                int reg = target(&e, in->a);
+                put8(code, 0x48 | (reg & 8 ? 1 : 0));
+                put8(code, 0xB8 + (reg & 7)); put64(code, (uint64_t)program->constants[in->index]);   // mov reg, imm64
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_GETG: {
+                if (in->index >= (1u << 28)) { supported = 0; break; }
+                int reg = target(&e, in->a);
+                encode(code, 0x8B, reg, R13, 1, in->index * 8);            // mov reg, [r13 + 8*index]
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_SETG: {
+                if (in->index >= (1u << 28)) { supported = 0; break; }
+                int reg = target(&e, in->a);
+                load(&e, reg, in->a);
+                encode(code, 0x89, reg, R13, 1, in->index * 8);            // mov [r13 + 8*index], reg
+                break;
+            }
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL: {
+                int reg = target(&e, in->a);
+                if (reg == where(&e, in->c) && in->b != in->c) reg = RAX;
+                load(&e, reg, in->b);
+                operand(&e, in->op == OP_ADD ? 0x03 : in->op == OP_SUB ? 0x2B : 0x0FAF, reg, in->c);   // add, sub, imul reg, vm
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_DIV:
+                load(&e, RCX, in->c);
+                PUT(code, 0x48, 0x85, 0xC9, 0x0F, 0x84);                    // test rcx, rcx; jz divide
+                fixup(&divide, code, 0);
+                load(&e, RAX, in->b);
+                PUT(code, 0x48, 0x83, 0xF9, 0xFF, 0x74, 0x07,               // cmp rcx, -1; je +7
+                          0x48, 0x99, 0x48, 0xF7, 0xF9, 0xEB, 0x03,         // cqo; idiv rcx; jmp +3
+                          0x48, 0xF7, 0xD8);                                // neg rax
+                store(&e, in->a, RAX);
+                break;
+
+            case OP_DIVU:
+                load(&e, RCX, in->c);
+                PUT(code, 0x48, 0x85, 0xC9, 0x0F, 0x84);                    // test rcx, rcx; jz divide
+                fixup(&divide, code, 0);
+                load(&e, RAX, in->b);
+                PUT(code, 0x31, 0xD2, 0x48, 0xF7, 0xF1);                    // xor edx, edx; div rcx
+                store(&e, in->a, RAX);
+                break;
+
+            case OP_LT:
+            case OP_LE:
+            case OP_EQ:
+            case OP_NE:
+            case OP_LTU:
+            case OP_LEU: {
+                static const uint8_t conditions[OP_COUNT] = {
+                    [OP_LT] = 0x9C, [OP_LE] = 0x9E, [OP_EQ] = 0x94, [OP_NE] = 0x95, [OP_LTU] = 0x92, [OP_LEU] = 0x96,
+                };
+                int reg = where(&e, in->b);
+                if (reg < 0) load(&e, reg = RCX, in->b);
+                PUT(code, 0x31, 0xC0);                                      // xor eax, eax
+                operand(&e, 0x3B, reg, in->c);                              // cmp reg, vm
+                PUT(code, 0x0F); put8(code, conditions[in->op]); PUT(code, 0xC0);   // setl, setle, ... al
+                store(&e, in->a, RAX);
+                break;
+            }
+
+            case OP_ADDI:
+            case OP_SUBI: {
+                int reg = target(&e, in->a);
+                load(&e, reg, in->b);
+                encode(code, 0x81, in->op == OP_ADDI ? 0 : 5, reg, 0, 0); put32(code, (uint32_t)(int32_t)in->small);   // add, sub reg, imm32
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_MULI: {
+                int reg = target(&e, in->a);
+                operand(&e, 0x69, reg, in->b); put32(code, (uint32_t)(int32_t)in->small);     // imul reg, vm, imm32
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_DIVI:
+                load(&e, RAX, in->b);
+                PUT(code, 0x48, 0xC7, 0xC1); put32(code, (uint32_t)(int32_t)in->small);       // mov rcx, imm32
+                PUT(code, 0x48, 0x99, 0x48, 0xF7, 0xF9);                                     // cqo; idiv rcx
+                store(&e, in->a, RAX);
+                break;
+
+            case OP_NEG: {
+                int reg = target(&e, in->a);
+                load(&e, reg, in->b);
+                encode(code, 0xF7, 3, reg, 0, 0);                           // neg reg
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_NARROW: {
+                int reg = target(&e, in->a);
+                uint8_t shift = (uint8_t)(64 - type_bits((IntType)in->c));
+                load(&e, reg, in->b);
+                encode(code, 0xC1, 4, reg, 0, 0); put8(code, shift);       // shl reg, shift
+                encode(code, 0xC1, type_is_unsigned((IntType)in->c) ? 5 : 7, reg, 0, 0); put8(code, shift);  // shr, sar reg, shift
+                store(&e, in->a, reg);
+                break;
+            }
+
+            case OP_JUMP:
+                PUT(code, 0xE9);
+                fixup(&jumps, code, in->index);
+                break;
+
+            case OP_JUMPZ:
+            case OP_JUMPNZ: {
+                int reg = where(&e, in->a);
+                if (reg >= 0) encode(code, 0x85, reg, reg, 0, 0);            // test reg, reg
+                else { operand(&e, 0x83, 7, in->a); PUT(code, 0x00); }      // cmp vm, 0
+                if (in->op == OP_JUMPZ) PUT(code, 0x0F, 0x84);              // jz
+                else PUT(code, 0x0F, 0x85);                                 // jnz
+                fixup(&jumps, code, in->index);
+                break;
+            }
+
+            case OP_CALL: {
+                const VmFunction* callee = &program->functions[in->index];
+                PUT(code, 0x48, 0x8D, 0xBB); put32(code, slot(function->registers));   // lea rdi, [rbx + window]
+                PUT(code, 0x48, 0x8D, 0x87); put32(code, slot(callee->registers));     // lea rax, [rdi + callee window]
+                PUT(code, 0x49, 0x3B, 0x04, 0x24, 0x0F, 0x87);              // cmp rax, [r12]; ja calls
+                fixup(&calls_out, code, 0);
+                PUT(code, 0x4C, 0x89, 0xE6, 0xE8);                          // mov rsi, r12; call
+                fixup(calls, code, in->index);
+                PUT(code, 0x41, 0x83, 0x7C, 0x24, 0x08, 0x00, 0x0F, 0x85);  // cmp dword [r12 + 8], 0; jne bail
+                fixup(&bail, code, 0);
+                store(&e, in->a, RAX);
+                break;
+            }
+
+            case OP_RETURN:
+                load(&e, RAX, in->a);
+                epilogue(code, assignment.saved);
+                break;
+
+            default:
+                supported = 0;
+                break;
+        }
+    }
+
+    if (supported) {
+        // Trap exits: set the trap and return, callers see it and return too
+        uint32_t stubs[3];
+        stubs[0] = (uint32_t)code->length;
+        PUT(code, 0x41, 0xC7, 0x44, 0x24, 0x08); put32(code, JIT_TRAP_CALLS);    // mov dword [r12 + 8], trap
+        PUT(code, 0xEB, 0x09);                                                  // jmp bail
+        stubs[1] = (uint32_t)code->length;
+        PUT(code, 0x41, 0xC7, 0x44, 0x24, 0x08); put32(code, JIT_TRAP_DIVIDE);
+        stubs[2] = (uint32_t)code->length;
+        PUT(code, 0x31, 0xC0);                                                  // xor eax, eax
+        epilogue(code, assignment.saved);
+
+        offsets[function->count] = (uint32_t)code->length;
+        resolve(code, &jumps, offsets);
+        for (size_t i = 0; i < calls_out.count; i++) calls_out.items[i].target = 0;
+        for (size_t i = 0; i < divide.count; i++) divide.items[i].target = 1;
+        for (size_t i = 0; i < bail.count; i++) bail.items[i].target = 2;
+        resolve(code, &calls_out, stubs);
+        resolve(code, &divide, stubs);
+        resolve(code, &bail, stubs);
+    }
+
+    free(jumps.items);
+    free(divide.items);
+    free(calls_out.items);
+    free(bail.items);
+    free(offsets);
+    regalloc_free(&assignment);
+    return supported ? 0 : -1;
+}
+
+
+/*
+    Translate every function of `program`. Returns 0 with the code in
+    `jit`, or -1 (with `jit` empty) if the program should run on the VM.
+*/
+int jit_compile(JitProgram* jit, const VmProgram* program) {
+    memset(jit, 0, sizeof(*jit));
+    jit->entries = calloc(program->function_count, sizeof(uint32_t));
+    if (!jit->entries) {
+        fprintf(stderr, "Out of memory compiling code\n");
+        exit(1);
+    }
+
+    Code code = { 0 };
+    Fixups calls = { 0 };
+    int status = 0;
+    for (uint32_t i = 0; i < program->function_count && status == 0; i++) {
+        jit->entries[i] = (uint32_t)code.length;
+        if (program->functions[i].code) status = translate(&code, program, &program->functions[i], &calls);
+        if (code.length > INT32_MAX) status = -1;
+    }
+    if (status == 0) resolve(&code, &calls, jit->entries);
+
+    // Copy into fresh pages, then flip them from writable to executable
+    if (status == 0) {
+        jit->size = code.length;
+        void* memory = mmap(NULL, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            status = -1;
+        } else {
+            memcpy(memory, code.bytes, code.length);
+            jit->memory = memory;
+            if (mprotect(memory, jit->size, PROT_READ | PROT_EXEC) != 0) status = -1;
+        }
+    }
+
+    free(code.bytes);
+    free(calls.items);
+    if (status != 0) {
+        jit_free(jit);
+        return -1;
+    }
+    jit->function_count = program->function_count;
+    jit->global_count = program->global_count;
+    return 0;
+}
+
+#else
+
+int jit_compile(JitProgram* jit, const VmProgram* program) {
+    (void)program;
+    memset(jit, 0, sizeof(*jit));
+    return -1;
+}
+
+#endif
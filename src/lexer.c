@@ -1,28 +1,66 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "lexer.h"
 
 // Forward Declarations
-static char Lexer_peek_char(Lexer* lexer);
 static char Lexer_advance(Lexer* lexer);
 static void skip_whitespace(Lexer* lexer);
 static Token make_token(Lexer* lexer, TokenType type);
 static Token identifier(Lexer* lexer);
 static Token number(Lexer* lexer);
+static inline int match_char(Lexer* lexer, char expected);
 
 // Helper Declarations
-static inline void increment_newline(Lexer* lexer);
 static inline int is_alpha(char c);
 static inline int is_digit(char c);
+static inline int is_space(char c);
+
+
+static LexerScanLevel scan_level = LEXER_SCAN_AVX2;   // Clamped to the CPU by lexer_scanner
+
+/*
+    Keywords, placed by a perfect hash of (first byte, length). The slot of
+    each keyword is computed by the compiler from KEYWORD_HASH, and the
+    static assert below fails the build if two keywords ever collide
+    (the OR of distinct powers of two equals their sum).
+*/
+typedef struct Keyword {
+    const char* text;
+    int length;
+    TokenType type;
+} Keyword;
+
+#define KEYWORD_SLOTS 16
+#define KEYWORD_HASH(first, length) ((unsigned)((unsigned char)(first) + (length) * 3) & (KEYWORD_SLOTS - 1))
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+    [KEYWORD_HASH('f', 4)] = { "func",   4, TOKEN_FUNC },
+    [KEYWORD_HASH('i', 2)] = { "if",     2, TOKEN_IF },
+    [KEYWORD_HASH('w', 5)] = { "while",  5, TOKEN_WHILE },
+    [KEYWORD_HASH('r', 6)] = { "return", 6, TOKEN_RETURN },
+    [KEYWORD_HASH('e', 3)] = { "end",    3, TOKEN_END },
+    [KEYWORD_HASH('l', 3)] = { "let",    3, TOKEN_LET },
+};
+
+#define KEYWORD_BIT(first, length) (1u << KEYWORD_HASH(first, length))
+_Static_assert(
+    (KEYWORD_BIT('f', 4) | KEYWORD_BIT('i', 2) | KEYWORD_BIT('w', 5) |
+     KEYWORD_BIT('r', 6) | KEYWORD_BIT('e', 3) | KEYWORD_BIT('l', 3)) ==
+    (KEYWORD_BIT('f', 4) + KEYWORD_BIT('i', 2) + KEYWORD_BIT('w', 5) +
+     KEYWORD_BIT('r', 6) + KEYWORD_BIT('e', 3) + KEYWORD_BIT('l', 3)),
+    "keyword hash collision, adjust KEYWORD_HASH"
+);
+
+// Runs are walked inline for this many bytes before handing off to a scanner.
+// Most whitespace and names are shorter than this, and a vector scan doesn't pay off on them.
+#define INLINE_RUN 8
 
 
 /* 
     Helper Functions 
 */
-// Increment line and reset column
-inline void increment_newline(Lexer* lexer) {
-    lexer->column = 0; lexer->line++;
-}
-
 // Check if the character is a unicode latin alphabet character
 static inline int is_alpha(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');
@@ -33,6 +71,11 @@ static inline int is_digit(char c) {
     return (c >= '0') && (c <= '9');
 }
 
+// Check if the character is whitespace (space, \t, \n, \v, \f, \r)
+static inline int is_space(char c) {
+    return (c == ' ') || (c >= '\t' && c <= '\r');
+}
+
 
 /*
     Start and Current allow the Lexer to return the full token. For example, 
@@ -40,64 +83,52 @@ static inline int is_digit(char c) {
     (after looping through the keyword) would be 'c', which will let us know 
     the full token is 'func'.
 
-    Line: Starts at 1, because that's the beginning of the file, duh
-    Column: Starts at 0 in Serrate
+    The lexer doesn't track lines or columns. Tokens only know where they
+    start, and a LineIndex (lines.h) turns that into a line and column
+    when a diagnostic actually needs one.
 */
-// Set up the lexer with pointers into the source, reset line/column counters, and prepare to start tokenizing.
+// Set up the lexer with pointers into the source and prepare to start tokenizing.
 void Lexer_init(Lexer* lexer, const char* source) {
+    lexer->source = source;     // Offsets in a TokenBuffer are relative to this
     lexer->start = source;      // Set start to current character
     lexer->current = source;    // Set current to current character
-    lexer->line = 1;            // Set line to 1
-    lexer->column = 0;          // Set column to 0
+    lexer->scanner = lexer_scanner(scan_level);
 }
 
 
 /*
-    If the next character is '\0', aka EndOfFile, then return '\0'. If not, 
-    then return whatever the next character is.
+    Whitespace, comments, identifiers and numbers are consumed as whole
+    runs by the scanners in lexer_simd.c. By default the widest one the
+    CPU supports is used; LEXER_SCAN_SCALAR gives the byte-at-a-time
+    reference behaviour. Returns the level that will actually be used.
 */
-// Look at the current character without consuming it.
-static char Lexer_peek_char(Lexer* lexer) {
-    if (*lexer->current== '\0') return '\0';    // Return '\0' if EndOfFile
-    return *lexer->current;                     // Return next character if not
-}
-
-// Consume the current character and move the pointer forward. Also updates line/column tracking.
-static char Lexer_advance(Lexer* lexer) {
-    char c = *lexer->current++; // Set C to next current character
-    switch (c) {                // Check if C is a newline.
-        case '\n': increment_newline(lexer);
-        case '\r': increment_newline(lexer);
-        // case '\r\n': increment_newline(lexer);
-        // case '\n\r': increment_newline(lexer);
-        // case '\036 ': increment_newline(lexer);
-        // case '\025 ': increment_newline(lexer);
-
-        default: lexer->column++;   // If not a newline, increment column by 1
-    }
-    return c;   // Return C
+LexerScanLevel Lexer_set_scan_level(LexerScanLevel level) {
+    scan_level = level;
+    return lexer_scanner(level)->level;
+}
+
+
+// Consume the current character and move the pointer forward.
+static inline char Lexer_advance(Lexer* lexer) {
+    return *lexer->current++;
+}
+
+// Consume the current character only if it is `expected` (one character of lookahead)
+static inline int match_char(Lexer* lexer, char expected) {
+    if (*lexer->current != expected) return 0;
+    Lexer_advance(lexer);
+    return 1;
 }
 
 // Ignore characters that are irrelevant to syntax (spaces, tabs, newlines, comments). This keeps the actual tokenizer clean and fast.
 static void skip_whitespace(Lexer* lexer) {
     for (;;) {
-        char c = Lexer_peek_char(lexer);
-        switch (c) {
-            case ' ':   // Space
-            case '\t':  // Tab
-            case '\v':  // Vertical Tab
-            case '\f':  // Form Feed (Page Break)
-            case '\r':  // Carriage Return
-                Lexer_advance(lexer);
-                break;
-            case '\n':  // Newline
-                Lexer_advance(lexer);
-                break;
-            case '#':   // Comment
-                while (Lexer_peek_char(lexer) != '\n' && Lexer_peek_char(lexer) != '\0') Lexer_advance(lexer);
-                break;
-            default: return;
-        }
+        int n = 0;
+        while (n < INLINE_RUN && is_space(*lexer->current)) { lexer->current++; n++; }
+        if (n == INLINE_RUN) lexer->current = lexer->scanner->skip_space(lexer->current);
+
+        if (*lexer->current != '#') return;
+        lexer->current = lexer->scanner->skip_comment(lexer->current);     // Comment, up to the newline
     }
 }
 
@@ -107,8 +138,7 @@ static Token make_token(Lexer* lexer, TokenType type) {
     token.length = (int)(lexer->current - lexer->start);
     token.type = type;              // One of the Enum values of TokenType
     token.start = lexer->start;     // The beginning character of the token
-    token.line = lexer->line;       // What line the token is on
-    token.column = lexer->column;   // What column the token is on
+    token.value = 0;                // Filled in by number()
     return token;
 }
 
@@ -132,9 +162,10 @@ Token Lexer_next(Lexer* lexer) {
         case ':': return make_token(lexer, TOKEN_COLON);
 
         // Operators
-        case '=': return make_token(lexer, TOKEN_ASSIGN);
-        case '>': return make_token(lexer, TOKEN_GREATER_THAN);
-        case '<': return make_token(lexer, TOKEN_LESS_THAN);
+        case '=': return make_token(lexer, match_char(lexer, '=') ? TOKEN_EQUAL : TOKEN_ASSIGN);
+        case '!': return make_token(lexer, match_char(lexer, '=') ? TOKEN_NOT_EQUAL : TOKEN_UNKNOWN);
+        case '>': return make_token(lexer, match_char(lexer, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER_THAN);
+        case '<': return make_token(lexer, match_char(lexer, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS_THAN);
 
         case '+': return make_token(lexer, TOKEN_PLUS);
         case '-': return make_token(lexer, TOKEN_MINUS);
@@ -151,63 +182,112 @@ Token Lexer_next(Lexer* lexer) {
 // Then decide if it’s a keyword or IDENTIFIER.
 static Token identifier(Lexer* lexer) {
     // Keep advancing while he current character is alphanumeric or underscore
-    while (is_alpha(Lexer_peek_char(lexer)) || is_digit(Lexer_peek_char(lexer))) Lexer_advance(lexer);
+    const char* end = lexer->current;
+    int n = 0;
+    while (n < INLINE_RUN && (is_alpha(*end) || is_digit(*end))) { end++; n++; }
+    if (n == INLINE_RUN) end = lexer->scanner->skip_identifier(end);
+    lexer->current = end;
 
     int length = (int)(lexer->current - lexer->start);
 
-    // Check for keywords (bare minimum)
-    switch (lexer->start[0]) {
-        case 'f': 
-            if (length == 4 &&
-                lexer->start[1] == 'u' &&
-                lexer->start[2] == 'n' &&
-                lexer->start[3] == 'c'
-            ) return make_token(lexer, TOKEN_FUNC); break;
-
-        case 'i': 
-            if (length == 2 &&
-                lexer->start[1] == 'f'
-            ) return make_token(lexer, TOKEN_IF);
-
-        case 'w': 
-            if (length == 5 &&
-                lexer->start[1] == 'h' &&
-                lexer->start[2] == 'i' &&
-                lexer->start[3] == 'l' &&
-                lexer->start[4] == 'e'
-            ) return make_token(lexer, TOKEN_WHILE);
-
-        case 'r': 
-            if (length == 6 &&
-                lexer->start[1] == 'e' &&
-                lexer->start[2] == 't' &&
-                lexer->start[3] == 'u' &&
-                lexer->start[4] == 'r' &&
-                lexer->start[5] == 'n'
-            ) return make_token(lexer, TOKEN_RETURN);
-
-        case 'e': 
-            if (length == 3 &&
-                lexer->start[1] == 'n' &&
-                lexer->start[2] == 'd'
-            ) return make_token(lexer, TOKEN_END);
-
-        case 'l': 
-            if (length == 3 &&
-                lexer->start[1] == 'e' &&
-                lexer->start[2] == 't'
-            ) return make_token(lexer, TOKEN_LET);
-        
-        default: return make_token(lexer, TOKEN_IDENTIFIER);
-    }
+    // Check for keywords: one table probe, then one compare
+    const Keyword* keyword = &keywords[KEYWORD_HASH(lexer->start[0], length)];
+    if (keyword->length == length && !memcmp(keyword->text, lexer->start, length))
+        return make_token(lexer, keyword->type);
 
-    return make_token(lexer, TOKEN_UNKNOWN);
+    return make_token(lexer, TOKEN_IDENTIFIER);
 }
 
 // Consume a sequence of digits and return an INTEGER token.
 static Token number(Lexer* lexer) {
-    while (is_digit(Lexer_peek_char(lexer))) Lexer_advance(lexer);
-    return make_token(lexer, TOKEN_INTEGER);
+    const char* end = lexer->current;
+    int n = 0;
+    while (n < INLINE_RUN && is_digit(*end)) { end++; n++; }
+    if (n == INLINE_RUN) end = lexer->scanner->skip_digits(end);
+    lexer->current = end;
+
+    // Decode the value here so the parser never has to re-read the digits.
+    // Out of range values saturate to LONG_MAX, like strtol.
+    Token token = make_token(lexer, TOKEN_INTEGER);
+    unsigned long value = 0;
+    for (int i = 0; i < token.length; i++) {
+        int digit = token.start[i] - '0';
+        if (value > (unsigned long)(LONG_MAX - digit) / 10) { value = LONG_MAX; break; }
+        value = value * 10 + digit;
+    }
+    token.value = (long)value;
+    return token;
+}
+
+
+/*
+    Lex the whole input up front into a packed buffer, ending with the
+    TOKEN_EOF token. This keeps lexing and parsing as two separate passes
+    over contiguous memory.
+*/
+void Lexer_tokenize_all(Lexer* lexer, TokenBuffer* buffer) {
+    buffer->source = lexer->source;
+    buffer->tokens = NULL;
+    buffer->count = 0;
+    buffer->capacity = 0;
+    buffer->literals = NULL;
+    buffer->literal_count = 0;
+    buffer->literal_capacity = 0;
+
+    for (;;) {
+        Token token = Lexer_next(lexer);
+
+        if (buffer->count == buffer->capacity) {
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+            buffer->tokens = realloc(buffer->tokens, sizeof(PackedToken) * buffer->capacity);
+            if (!buffer->tokens) {
+                fprintf(stderr, "Out of memory allocating tokens\n");
+                exit(1);
+            }
+        }
+
+        PackedToken* packed = &buffer->tokens[buffer->count++];
+        packed->offset = (uint32_t)(token.start - lexer->source);
+        packed->length = (uint32_t)token.length;
+        packed->literal = 0;
+        packed->type = (uint8_t)token.type;
+
+        if (token.type == TOKEN_INTEGER) {
+            if (buffer->literal_count == buffer->literal_capacity) {
+                buffer->literal_capacity = buffer->literal_capacity ? buffer->literal_capacity * 2 : 256;
+                buffer->literals = realloc(buffer->literals, sizeof(long) * buffer->literal_capacity);
+                if (!buffer->literals) {
+                    fprintf(stderr, "Out of memory allocating literals\n");
+                    exit(1);
+                }
+            }
+            packed->literal = buffer->literal_count;
+            buffer->literals[buffer->literal_count++] = token.value;
+        }
+
+        if (token.type == TOKEN_EOF) break;
+    }
+}
+
+// Unpack a buffered token
+Token token_buffer_get(const TokenBuffer* buffer, uint32_t index) {
+    const PackedToken* packed = &buffer->tokens[index];
+    Token token;
+    token.type = (TokenType)packed->type;
+    token.start = buffer->source + packed->offset;
+    token.length = (int)packed->length;
+    token.value = packed->type == TOKEN_INTEGER ? buffer->literals[packed->literal] : 0;
+    return token;
+}
+
+// Release a buffer filled by Lexer_tokenize_all
+void token_buffer_free(TokenBuffer* buffer) {
+    free(buffer->tokens);
+    free(buffer->literals);
+    buffer->tokens = NULL;
+    buffer->literals = NULL;
+    buffer->count = 0;
+    buffer->literal_count = 0;
 }
 
 // Convert Token Type to a string for debugging
@@ -233,6 +313,10 @@ const char* token_type_name(TokenType type) {
         case TOKEN_ASSIGN:        return "ASSIGN";
         case TOKEN_GREATER_THAN:  return "GREATER_THAN";
         case TOKEN_LESS_THAN:     return "LESS_THAN";
+        case TOKEN_EQUAL:         return "EQUAL";
+        case TOKEN_NOT_EQUAL:     return "NOT_EQUAL";
+        case TOKEN_GREATER_EQUAL: return "GREATER_EQUAL";
+        case TOKEN_LESS_EQUAL:    return "LESS_EQUAL";
         case TOKEN_PLUS:          return "PLUS";
         case TOKEN_MINUS:         return "MINUS";
         case TOKEN_ASTERISK:      return "ASTERISK";
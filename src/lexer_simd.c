@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lexer_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEXER_X86 1
+#include <immintrin.h>
+#endif
+
+
+/*
+    Scalar scanners. These define the behaviour, the vector versions
+    below must return exactly the same pointers.
+*/
+static inline int is_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int is_ident(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static const char* scalar_skip_space(const char* p) {
+    while (is_space((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char* scalar_skip_comment(const char* p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char* scalar_skip_identifier(const char* p) {
+    while (is_ident((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char* scalar_skip_digits(const char* p) {
+    while (*p >= '0' && *p <= '9') p++;
+    return p;
+}
+
+
+#ifdef LEXER_X86
+
+/*
+    Vector scanners. A run is scanned one aligned block at a time: the
+    block holding `p` is loaded with the bytes before `p` masked off, and
+    the next block is only loaded when every byte of the current one was
+    part of the run (so none of them was the terminating '\0').
+*/
+#define DEFINE_RUN_SCANNER(name, isa, vector, width, load, classify)                 \
+    __attribute__((target(isa)))                                                       \
+    static const char* name(const char* p) {                                            \
+        const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)(width - 1));      \
+        uint64_t full = (1ull << width) - 1;                                            \
+        uint64_t stop = ~(uint64_t)classify(load((const vector*)block)) & full;         \
+        stop &= full << (p - block);                                                    \
+        while (!stop) {                                                                 \
+            block += width;                                                             \
+            stop = ~(uint64_t)classify(load((const vector*)block)) & full;               \
+        }                                                                               \
+        return block + __builtin_ctzll(stop);                                           \
+    }
+
+
+/*
+    SSE2 (16 bytes per step)
+*/
+// Bytes of x in [lo, hi], as a 0x00/0xFF mask
+__attribute__((target("sse2")))
+static inline __m128i sse2_in_range(__m128i x, char lo, char hi) {
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8((char)(hi - lo))), shifted);
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t sse2_space(__m128i x) {
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), sse2_in_range(x, '\t', '\r'));
+    return (uint32_t)_mm_movemask_epi8(space);
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t sse2_comment(__m128i x) {
+    __m128i end = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+    return ~(uint32_t)_mm_movemask_epi8(end) & 0xFFFF;
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t sse2_identifier(__m128i x) {
+    __m128i letter = sse2_in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i digit = sse2_in_range(x, '0', '9');
+    __m128i under = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), under));
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t sse2_digits(__m128i x) {
+    return (uint32_t)_mm_movemask_epi8(sse2_in_range(x, '0', '9'));
+}
+
+DEFINE_RUN_SCANNER(sse2_skip_space,      "sse2", __m128i, 16, _mm_load_si128, sse2_space)
+DEFINE_RUN_SCANNER(sse2_skip_comment,    "sse2", __m128i, 16, _mm_load_si128, sse2_comment)
+DEFINE_RUN_SCANNER(sse2_skip_identifier, "sse2", __m128i, 16, _mm_load_si128, sse2_identifier)
+DEFINE_RUN_SCANNER(sse2_skip_digits,     "sse2", __m128i, 16, _mm_load_si128, sse2_digits)
+
+
+/*
+    AVX2 (32 bytes per step)
+*/
+__attribute__((target("avx2")))
+static inline __m256i avx2_in_range(__m256i x, char lo, char hi) {
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8((char)(hi - lo))), shifted);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_space(__m256i x) {
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), avx2_in_range(x, '\t', '\r'));
+    return (uint32_t)_mm256_movemask_epi8(space);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_comment(__m256i x) {
+    __m256i end = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+    return ~(uint32_t)_mm256_movemask_epi8(end);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_identifier(__m256i x) {
+    __m256i letter = avx2_in_range(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+    __m256i digit = avx2_in_range(x, '0', '9');
+    __m256i under = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(letter, digit), under));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_digits(__m256i x) {
+    return (uint32_t)_mm256_movemask_epi8(avx2_in_range(x, '0', '9'));
+}
+
+DEFINE_RUN_SCANNER(avx2_skip_space,      "avx2", __m256i, 32, _mm256_load_si256, avx2_space)
+DEFINE_RUN_SCANNER(avx2_skip_comment,    "avx2", __m256i, 32, _mm256_load_si256, avx2_comment)
+DEFINE_RUN_SCANNER(avx2_skip_identifier, "avx2", __m256i, 32, _mm256_load_si256, avx2_identifier)
+DEFINE_RUN_SCANNER(avx2_skip_digits,     "avx2", __m256i, 32, _mm256_load_si256, avx2_digits)
+
+#endif
+
+
+static const LexerScanner scanners[] = {
+    { LEXER_SCAN_SCALAR, "scalar", scalar_skip_space, scalar_skip_comment,
+      scalar_skip_identifier, scalar_skip_digits },
+#ifdef LEXER_X86
+    { LEXER_SCAN_SSE2, "sse2", sse2_skip_space, sse2_skip_comment,
+      sse2_skip_identifier, sse2_skip_digits },
+    { LEXER_SCAN_AVX2, "avx2", avx2_skip_space, avx2_skip_comment,
+      avx2_skip_identifier, avx2_skip_digits },
+#endif
+};
+
+
+// The widest scanner this CPU can run
+LexerScanLevel lexer_best_scan_level(void) {
+#ifdef LEXER_X86
+    if (__builtin_cpu_supports("avx2")) return LEXER_SCAN_AVX2;
+    if (__builtin_cpu_supports("sse2")) return LEXER_SCAN_SSE2;
+#endif
+    return LEXER_SCAN_SCALAR;
+}
+
+// Scanner for `level`, clamped to what this CPU supports
+const LexerScanner* lexer_scanner(LexerScanLevel level) {
+    LexerScanLevel best = lexer_best_scan_level();
+    if (level > best) level = best;
+    return &scanners[level];
+}
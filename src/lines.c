@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lines.h"
+
+
+// Record that a line starts at `offset`
+static void push_line(LineIndex* index, uint32_t* capacity, uint32_t offset) {
+    if (index->count == *capacity) {
+        *capacity *= 2;
+        index->starts = realloc(index->starts, sizeof(uint32_t) * *capacity);
+        if (!index->starts) {
+            fprintf(stderr, "Out of memory allocating line index\n");
+            exit(1);
+        }
+    }
+    index->starts[index->count++] = offset;
+}
+
+/*
+    Find every line start. Files without '\r' (the usual case) only need
+    memchr for '\n'. Otherwise the next '\n' and next '\r' are both kept
+    and whichever comes first ends the line, with "\r\n" counted once.
+*/
+static void build(LineIndex* index) {
+    uint32_t capacity = 256;
+    index->starts = malloc(sizeof(uint32_t) * capacity);
+    if (!index->starts) {
+        fprintf(stderr, "Out of memory allocating line index\n");
+        exit(1);
+    }
+    index->count = 0;
+    push_line(index, &capacity, 0);
+
+    const char* source = index->source;
+    const char* end = source + index->length;
+    const char* p = source;
+
+    if (!memchr(source, '\r', index->length)) {
+        while ((p = memchr(p, '\n', (size_t)(end - p)))) {
+            p++;
+            push_line(index, &capacity, (uint32_t)(p - source));
+        }
+        return;
+    }
+
+    const char* newline = memchr(p, '\n', (size_t)(end - p));
+    const char* carriage = memchr(p, '\r', (size_t)(end - p));
+    while (newline || carriage) {
+        if (carriage && (!newline || carriage < newline)) {
+            p = carriage + 1;
+            if (p == newline) {     // "\r\n" ends one line
+                p++;
+                newline = memchr(p, '\n', (size_t)(end - p));
+            }
+        } else {
+            p = newline + 1;
+            newline = memchr(p, '\n', (size_t)(end - p));
+        }
+        if (carriage && carriage < p) carriage = memchr(p, '\r', (size_t)(end - p));
+        push_line(index, &capacity, (uint32_t)(p - source));
+    }
+}
+
+
+// Set up an index over `length` bytes of source. Nothing is scanned yet.
+void line_index_init(LineIndex* index, const char* source, size_t length) {
+    index->source = source;
+    index->length = length;
+    index->starts = NULL;
+    index->count = 0;
+}
+
+
+// Line (from 1) and column (from 0) of a byte offset
+void line_index_position(LineIndex* index, uint32_t offset, int* line, int* column) {
+    if (!index->starts) build(index);
+
+    // Last line start <= offset
+    uint32_t low = 0, high = index->count;
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (index->starts[middle] <= offset) low = middle;
+        else high = middle;
+    }
+
+    *line = (int)low + 1;
+    *column = (int)(offset - index->starts[low]);
+}
+
+
+// Release the line table
+void line_index_free(LineIndex* index) {
+    free(index->starts);
+    index->starts = NULL;
+    index->count = 0;
+}
@@ -10,124 +10,371 @@ Language: C99 <—— For compatibility with most systems
 
 */
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> 
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
-#include "lexer.h"
-#include "ast.h"
-#include "parser.h"
+#include "daemon.h"
+#include "driver.h"
+#include "intern.h"
+#include "stats.h"
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) { fprintf(stderr, "Usage: %s <filename>\n", argv[0]); return 1; }
 
-    // Information Flags
-    const char *version_flags[2] = {"v", "version"};
-    const char *help_flags[2] = {"h", "help"};
-    
-    // Set argument values
-    char *flag1 = argc > 1 ? argv[1] : NULL;
-    char *output_file_name = argc > 2 ? argv[2] : "output.c";
-
-    // Check if first argument is an information flag
-    if (argc > 1) {
-        while (flag1 && *flag1 == '-') flag1++;
-        for (int i = 0; i < 2; i++) {
-            if (!strcmp(flag1, help_flags[i])) {
-                printf(
-                    "Help: idk yet lol\n"
-                );
-                return 0;
-            } else if (!strcmp(flag1, version_flags[i])) {
-                printf(
-                    "Version: 0.0.1\n"
-                );
-                return 0;
-            }
-        }
-    }
+// Does `string` end with `suffix`?
+static int ends_with(const char* string, const char* suffix) {
+    size_t length = strlen(string), suffix_length = strlen(suffix);
+    return length >= suffix_length && !strcmp(string + length - suffix_length, suffix);
+}
 
+// `input` with its extension replaced by `extension` (foo.sr -> foo.c)
+static char* derive_output_name(const char* input, const char* extension) {
+    const char* slash = strrchr(input, '/');
+    const char* dot = strrchr(input, '.');
+    size_t stem = (dot && (!slash || dot > slash)) ? (size_t)(dot - input) : strlen(input);
 
+    size_t length = strlen(extension);
+    char* name = malloc(stem + length + 1);
+    if (!name) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    memcpy(name, input, stem);
+    memcpy(name + stem, extension, length + 1);
+    return name;
+}
 
-    /*
-        Start the process to compile the file
-    */
+/*
+    Files a compile reads and writes, so no two jobs write the same file
+    and none writes over a source (x.sr and x.s both give x.c, and
+    foo.sr's foo.c may itself be an input). A file is told apart by its
+    device and inode if it exists, and otherwise by its directory's and
+    its own name, so foo.c and ./foo.c are the same file either way.
+*/
+typedef struct FileUse {
+    dev_t device;
+    ino_t inode;
+    const char* name;       // Name within the directory, "" for an existing file
+    const char* path;
+    int job;
+    int written;
+} FileUse;
+
+static FileUse file_use(const char* path, int job, int written) {
+    FileUse use = { 0, 0, "", path, job, written };
+    struct stat info;
+    if (stat(path, &info) == 0) {
+        use.device = info.st_dev;
+        use.inode = info.st_ino;
+        return use;
+    }
 
-    // Get source file
-    
-    int file = open(flag1, O_RDONLY);
+    const char* slash = strrchr(path, '/');
+    char* directory = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : NULL;
+    if (slash && !directory) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    if (stat(directory ? directory : ".", &info) == 0) {
+        use.device = info.st_dev;
+        use.inode = info.st_ino;
+        use.name = slash ? slash + 1 : path;
+    } else {
+        use.name = path;    // Can't be written anyway
+    }
+    free(directory);
+    return use;
+}
+
+// Orders uses by file, writers of a file before its readers
+static int compare_file_uses(const void* a, const void* b) {
+    const FileUse* x = a;
+    const FileUse* y = b;
+    if (x->device != y->device) return x->device < y->device ? -1 : 1;
+    if (x->inode != y->inode) return x->inode < y->inode ? -1 : 1;
+    int names = strcmp(x->name, y->name);
+    if (names) return names;
+    return y->written - x->written;
+}
+
+static int same_file(const FileUse* a, const FileUse* b) {
+    return a->device == b->device && a->inode == b->inode && !strcmp(a->name, b->name);
+}
+
+// Report every file written twice or written over an input. Returns the number found.
+static int check_outputs(const CompileJob* jobs, int count, FILE* err) {
+    FileUse* uses = malloc(sizeof(FileUse) * count * 3);
+    if (!uses) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        uses[n++] = file_use(jobs[i].input, i, 0);
+        if (!jobs[i].run) uses[n++] = file_use(jobs[i].output, i, 1);
+        if (jobs[i].ast_output) uses[n++] = file_use(jobs[i].ast_output, i, 1);
+    }
+    qsort(uses, n, sizeof(FileUse), compare_file_uses);
+
+    // Sorted, each file's uses are together: any after a writer collide with it
+    int collisions = 0;
+    for (int first = 0, i; first < n; first = i) {
+        const FileUse* writer = &uses[first];
+        for (i = first + 1; i < n && same_file(writer, &uses[i]); i++) {
+            const FileUse* use = &uses[i];
+            if (!writer->written) continue;
+
+            collisions++;
+            if (use->written) fprintf(err, "'%s' and '%s' would both write '%s'\n", jobs[writer->job].input, jobs[use->job].input, use->path);
+            else if (use->job == writer->job) fprintf(err, "'%s' would be overwritten by its own output\n", use->path);
+            else fprintf(err, "'%s' would be overwritten by the output of '%s'\n", use->path, jobs[writer->job].input);
+        }
+    }
+    free(uses);
+    return collisions;
+}
 
-    if (file == -1) { fprintf(stderr, "Could not open file\n"); return 2; }
+// Read a response file into `contents` and split it into whitespace-separated paths
+static int read_response_file(const char* path, char** contents, char*** inputs, int* count, int* capacity, FILE* err) {
+    int file = open(path, O_RDONLY);
+    if (file == -1) { fprintf(err, "Could not open response file '%s'\n", path); return 2; }
 
-    // Get file size
     struct stat size;
-    if (fstat(file, &size) == -1) { perror("Could not get file size\n"); close(file); return 2; }
-    size_t file_size = size.st_size;
-
-    // Allocate exact memory needed, and get content of source file
-    char *source_code = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, file, 0);
-    if (source_code == MAP_FAILED) { fprintf(stderr, "Could not allocate memory\n"); close(file); return -1; }
-
-    write(STDOUT_FILENO, source_code, file_size); // Print source file contents
-    printf("\n");
-    
+    if (fstat(file, &size) == -1) { fprintf(err, "Could not get file size: %s\n", strerror(errno)); close(file); return 2; }
 
+    char* text = malloc(size.st_size + 1);
+    if (!text) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    size_t total = 0;
+    while (total < (size_t)size.st_size) {
+        ssize_t n = read(file, text + total, size.st_size - total);
+        if (n <= 0) break;
+        total += n;
+    }
+    text[total] = '\0';
+    close(file);
+    *contents = text;
+
+    for (char* p = text; *p; ) {
+        while (*p && isspace((unsigned char)*p)) *p++ = '\0';
+        if (!*p) break;
+        if (*count == *capacity) {
+            *capacity *= 2;
+            *inputs = realloc(*inputs, sizeof(char*) * *capacity);
+            if (!*inputs) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        }
+        (*inputs)[(*count)++] = p;
+        while (*p && !isspace((unsigned char)*p)) p++;
+    }
+    return 0;
+}
 
 
+/*
+    One invocation: parse the arguments and compile. Everything goes to
+    `out` and `err`, so the daemon can run this for its clients.
+*/
+static int run(int argc, char *argv[], FILE *out, FILE *err) {
+    if (argc < 2) { fprintf(err, "Usage: %s <filename>... [-o output] [-j jobs]\n", argv[0]); return 1; }
 
-    // Initialize Lexer & Parser
-    Lexer lexer;
-    Lexer_init(&lexer, source_code);
+    // Information Flags
+    const char *version_flags[2] = {"v", "version"};
+    const char *help_flags[2] = {"h", "help"};
+    const char *output_flags[2] = {"o", "output"};
+    const char *jobs_flags[2] = {"j", "jobs"};
+    const char *emit_ast_flag = "emit-ast";
 
-    Parser parser;
-    parser_init(&parser, &lexer);
+    // Set argument values
+    char *output_file_name = NULL;
+    int threads = default_thread_count();
+    int emit_ast = 0;
+    int dump = 0;
+    int fold = 1;
+    int optimize = 1;
+    int run_program = 0;
+    int report = 0, json = 0;   // STATS_* flags for --time-passes / --stats, and --json
+    int status = 0;
+    CompileJob *jobs = NULL;
+    CompileStats *stats = NULL;
+
+    int input_count = 0, input_capacity = 16;
+    char **inputs = malloc(sizeof(char*) * input_capacity);
+    char **response_files = calloc(argc, sizeof(char*));
+    if (!inputs || !response_files) { fprintf(err, "Out of memory\n"); exit(1); }
+
+    // Sort arguments into flags, @response files and source files
+    for (int a = 1; a < argc; a++) {
+        char *argument = argv[a];
+
+        if (*argument == '-') {
+            char *flag = argument;
+            while (*flag == '-') flag++;
+
+            if (!strcmp(flag, emit_ast_flag)) { emit_ast = 1; continue; }
+            if (!strcmp(flag, "time-passes")) { report |= STATS_TIMES; continue; }
+            if (!strcmp(flag, "stats")) { report |= STATS_COUNTERS; continue; }
+            if (!strcmp(flag, "json")) { json = 1; continue; }
+            if (!strcmp(flag, "dump-tokens")) { dump |= DUMP_TOKENS; continue; }
+            if (!strcmp(flag, "dump-ast")) { dump |= DUMP_AST; continue; }
+            if (!strcmp(flag, "no-fold")) { fold = 0; continue; }
+            if (!strcmp(flag, "run")) { run_program = RUN_VM; continue; }
+            if (!strcmp(flag, "jit")) { run_program = RUN_JIT; continue; }
+            if (!strcmp(flag, "dump-bytecode")) { dump |= DUMP_BYTECODE; continue; }
+            if (!strcmp(flag, "dump-ir")) { dump |= DUMP_IR; continue; }
+            if (!strcmp(flag, "dump-registers")) { dump |= DUMP_REGISTERS; continue; }
+            if (!strcmp(flag, "no-opt")) { optimize = 0; continue; }
+
+            for (int i = 0; i < 2; i++) {
+                if (!strcmp(flag, help_flags[i])) {
+                    fprintf(out,
+                        "Help: idk yet lol\n"
+                        "Usage: %s <filename>... [-o output] [-j jobs]\n"
+                        "  @file      Read more source file names from `file`\n"
+                        "  -o output  Output file name (one source file only, default output.c); a name\n"
+                        "             ending in .s gets x86-64 assembly instead of C\n"
+                        "  -j jobs    Number of threads: files compiled at once, or parse threads\n"
+                        "             for a single large file (default: one per core)\n"
+                        "  --dump-tokens  Print every token (line:column TYPE text)\n"
+                        "  --dump-ast Print the syntax tree and allocation counts\n"
+                        "  --run      Run the program on the bytecode VM instead of writing C; the exit\n"
+                        "             status is the program's\n"
+                        "  --jit      Like --run, but compile the bytecode to x86-64 machine code first\n"
+                        "             (falls back to the VM where that isn't possible)\n"
+                        "  --dump-bytecode  Print the bytecode --run executes\n"
+                        "  --dump-ir  Print the optimized SSA IR the bytecode is lowered from\n"
+                        "  --dump-registers  Print where --jit or .s output keeps each VM register\n"
+                        "  --no-opt   Lower the tree straight to bytecode, without the SSA IR and its\n"
+                        "             optimizations (for --run, --jit and .s output)\n"
+                        "  --no-fold  Don't fold constant expressions before generating code\n"
+                        "  --emit-ast Also write each parsed tree to a binary AST file (foo.sr -> foo.sast),\n"
+                        "             which can be given back as an input to skip lexing and parsing\n"
+                        "  --time-passes  Report wall and CPU time of every compiler pass\n"
+                        "  --stats    Report bytes read, tokens and nodes by type, allocations and peak RSS\n"
+                        "  --json     Print those reports as JSON (per file and in total)\n"
+                        "  --daemon   Keep running and serve --client invocations over a Unix socket\n"
+                        "  --client   Have the daemon do this compilation (compiles locally if none runs)\n"
+                        "  --socket path  Socket for --daemon / --client (default $SERRATE_SOCKET,\n"
+                        "             or /tmp/serrate-<uid>.sock)\n",
+                        argv[0]
+                    );
+                    goto done;
+                } else if (!strcmp(flag, version_flags[i])) {
+                    fprintf(out,
+                        "Version: 0.0.1\n"
+                    );
+                    goto done;
+                } else if (!strcmp(flag, output_flags[i]) || !strcmp(flag, jobs_flags[i])) {
+                    if (a + 1 >= argc) { fprintf(err, "Missing value for %s\n", argument); status = 1; goto done; }
+                    if (!strcmp(flag, output_flags[i])) output_file_name = argv[++a];
+                    else threads = atoi(argv[++a]);
+                    flag = NULL;
+                    break;
+                }
+            }
+            if (flag) { fprintf(err, "Unknown option: %s\n", argument); status = 1; goto done; }
+            continue;
+        }
 
-    Node* ast = parse_program(&parser);
+        if (*argument == '@') {
+            status = read_response_file(argument + 1, &response_files[a], &inputs, &input_count, &input_capacity, err);
+            if (status) goto done;
+            continue;
+        }
 
-    print_ast(ast, 0);
-    free_ast(ast);
+        if (input_count == input_capacity) {
+            input_capacity *= 2;
+            inputs = realloc(inputs, sizeof(char*) * input_capacity);
+            if (!inputs) { fprintf(err, "Out of memory\n"); exit(1); }
+        }
+        inputs[input_count++] = argument;
+    }
 
+    // `serrate file.sr out.c` (or out.s) still names the output file
+    if (!output_file_name && input_count == 2 && (ends_with(inputs[1], ".c") || ends_with(inputs[1], ".s"))
+        && !ends_with(inputs[0], ".c") && !ends_with(inputs[0], ".s"))
+        output_file_name = inputs[--input_count];
 
+    if (input_count == 0) { fprintf(err, "No source files given\n"); status = 1; goto done; }
+    if (output_file_name && input_count > 1) { fprintf(err, "-o can only be used with one source file\n"); status = 1; goto done; }
+    if (threads < 1) threads = 1;
 
-    // Clear allocated memory and close the file
 
-    munmap(source_code, file_size);
-    close(file);
 
+    /*
+        Compile every file. A single file keeps the old default output
+        name; with several, each one gets its own (foo.sr -> foo.c).
+    */
+    jobs = calloc(input_count, sizeof(CompileJob));
+    if (!jobs) { fprintf(err, "Out of memory\n"); exit(1); }
+    if (json && !report) report = STATS_TIMES | STATS_COUNTERS;
+    if (report) {
+        stats = calloc(input_count, sizeof(CompileStats));
+        if (!stats) { fprintf(err, "Out of memory\n"); exit(1); }
+    }
 
+    for (int i = 0; i < input_count; i++) {
+        jobs[i].input = inputs[i];
+        jobs[i].out = out;
+        jobs[i].err = err;
+        jobs[i].parse_threads = input_count == 1 ? threads : 1;   // A lone file gets the threads to itself
+        jobs[i].dump = dump;
+        jobs[i].fold = fold;
+        jobs[i].run = run_program;
+        jobs[i].optimize = optimize;
+        if (input_count == 1) jobs[i].output = output_file_name ? output_file_name : "output.c";
+        else jobs[i].output = derive_output_name(inputs[i], ".c");
+        if (emit_ast) jobs[i].ast_output = derive_output_name(inputs[i], ".sast");
+        if (stats) jobs[i].stats = &stats[i];
+    }
 
+    // Jobs run in parallel, so two writing one file (or one reading it) have to be refused up front
+    if (check_outputs(jobs, input_count, err)) status = 1;
 
+    if (!status) {
+        status = compile_all(jobs, input_count, threads);
 
+        if (report) {
+            CompileStats total = { 0 };
+            for (int i = 0; i < input_count; i++) stats_add(&total, &stats[i]);
+            if (json) stats_print_json(out, stats, (const char* const*)inputs, input_count, &total, report);
+            else stats_print(out, &total, report);
+        }
+    }
 
-    /*
-        Write output from compilation to output file
-    */
+    if (input_count > 1)
+        for (int i = 0; i < input_count; i++) free((char*)jobs[i].output);
+    for (int i = 0; i < input_count; i++) free((char*)jobs[i].ast_output);
 
-    // Get size of output file's soon-to-be data
-    const char *output_data = "int main() { return 0; }\n";
-    size_t output_size = strlen(output_data);
+done:
+    for (int a = 0; a < argc; a++) free(response_files[a]);
+    free(response_files);
+    free(jobs);
+    free(stats);
+    free(inputs);
+    return status;
+}
 
-    // Create / find output file to write to
-    int output_file = open(output_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (output_file == -1) { perror("Could not create output file"); return 2; }
 
-    // Loop through output file until all of data is written
-    size_t total = 0;
-    while (total < output_size) {
-        ssize_t n = write(output_file, output_data + total, output_size - total);
-        if (n <= 0) { perror("write"); close(output_file); return 1; }
-        total += n;
+int main(int argc, char *argv[]) {
+    // --daemon, --client and --socket are handled here, everything else is up to run()
+    int daemon = 0, client = 0;
+    const char *socket_path = daemon_socket_path();
+
+    int kept = 1;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--daemon")) daemon = 1;
+        else if (!strcmp(argv[a], "--client")) client = 1;
+        else if (!strcmp(argv[a], "--socket") && a + 1 < argc) socket_path = argv[++a];
+        else argv[kept++] = argv[a];
     }
+    argc = kept;
+    argv[argc] = NULL;
 
+    if (daemon) return daemon_serve(socket_path, run);
 
+    if (client) {
+        int status = daemon_forward(socket_path, argc, argv);
+        if (status >= 0) return status;
+    }
 
+    int status = run(argc, argv, stdout, stderr);
 
     // Exit program
-    close(output_file);
-
-    return 0;
-}
\ No newline at end of file
+    intern_free(intern_table());
+    return status;
+}
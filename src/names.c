@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "names.h"
+
+static inline uint32_t hash_pointer(const char* name) {
+    uint64_t bits = (uint64_t)(uintptr_t)name;
+    return (uint32_t)((bits * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Make room for `count` names in all, so adding them doesn't rehash along the way
+void name_map_reserve(NameMap* map, uint32_t count) {
+    uint32_t capacity = map->capacity ? map->capacity : 256;
+    while (count * 2 > capacity) capacity *= 2;
+    if (capacity == map->capacity) return;
+
+    NameSlot* slots = calloc(capacity, sizeof(NameSlot));
+    if (!slots) {
+        fprintf(stderr, "Out of memory allocating a name map\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < map->capacity; i++) {
+        if (!map->slots[i].name) continue;
+        uint32_t slot = hash_pointer(map->slots[i].name) & (capacity - 1);
+        while (slots[slot].name) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = map->slots[i];
+    }
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = capacity;
+}
+
+// The slot for `name` (value -1 if it was just added)
+NameSlot* name_slot(NameMap* map, const char* name) {
+    if ((map->used + 1) * 2 > map->capacity) name_map_reserve(map, map->used + 1);
+
+    uint32_t slot = hash_pointer(name) & (map->capacity - 1);
+    while (map->slots[slot].name && map->slots[slot].name != name) slot = (slot + 1) & (map->capacity - 1);
+    if (!map->slots[slot].name) {
+        map->slots[slot] = (NameSlot){ name, -1 };
+        map->used++;
+    }
+    return &map->slots[slot];
+}
+
+void name_map_free(NameMap* map) {
+    free(map->slots);
+    map->slots = NULL;
+    map->capacity = map->used = 0;
+}
@@ -1,23 +1,41 @@
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "parser.h"
 #include "ast.h"
+#include "intern.h"
+#include "types.h"
+#include "writer.h"
 
 
 // Forward Declarations
 static void advance(Parser* parser);
 static int match(Parser* parser, TokenType type);
+static void error(Parser* parser, const char* format, ...);
+
+
+// Token at `position`, or an EOF token once past the end of this parser's slice
+static Token token_at(const Parser* parser, uint32_t position) {
+    if (position < parser->end) return token_buffer_get(parser->tokens, position);
+
+    Token eof = token_buffer_get(parser->tokens, parser->end < parser->tokens->count ? parser->end : parser->tokens->count - 1);
+    eof.type = TOKEN_EOF;
+    eof.length = 0;
+    return eof;
+}
 
 
 /*
     Advance the parser to the next token.
-    Updates previous <— current, current <— Lexer_next()
+    Updates previous <— current, current <— next token in the buffer
 */
 static void advance(Parser* parser) {
     parser->previous = parser->current;
-    parser->current = Lexer_next(parser->lexer);
+    if (parser->position < parser->end) parser->position++;
+    parser->current = token_at(parser, parser->position);
 }
 
 
@@ -34,81 +52,149 @@ static int match(Parser* parser, TokenType type) {
 }
 
 
-// Initializes parser with the lexer.
+/*
+    Report a syntax error at the current token, prefixed with its
+    line:column. The line index is only built when the first error
+    is reported.
+*/
+static void error(Parser* parser, const char* format, ...) {
+    parser->error_count++;
+    if (!parser->errors) return;    // Counting only
+
+    int line, column;
+    line_index_position(&parser->lines, (uint32_t)(parser->current.start - parser->tokens->source), &line, &column);
+    fprintf(parser->errors, "%d:%d: ", line, column);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(parser->errors, format, args);
+    va_end(args);
+}
+
+
+// Initializes parser with the lexer. The whole input is tokenized up front.
 void parser_init(Parser* parser, Lexer* lexer) {
-    parser->lexer = lexer;
-    parser->current = Lexer_next(lexer);
+    Lexer_tokenize_all(lexer, &parser->owned);
+    parser_init_tokens(parser, &parser->owned, 0, parser->owned.count);
+}
+
+
+// Initializes parser over tokens[begin, end) of an existing buffer (not owned).
+void parser_init_tokens(Parser* parser, const TokenBuffer* tokens, uint32_t begin, uint32_t end) {
+    if (tokens != &parser->owned) parser->owned = (TokenBuffer){ 0 };
+    parser->tokens = tokens;
+    parser->position = begin;
+    parser->end = end;
+    parser->current = token_at(parser, begin);
     parser->previous = parser->current;
+    parser->errors = stderr;
+    parser->error_count = 0;
+
+    // The EOF token sits at the end of the source
+    uint32_t length = tokens->count ? tokens->tokens[tokens->count - 1].offset : 0;
+    line_index_init(&parser->lines, tokens->source, length);
+}
+
+
+// Releases the token buffer made by parser_init (if any) and the line index.
+void parser_free(Parser* parser) {
+    token_buffer_free(&parser->owned);
+    line_index_free(&parser->lines);
+}
+
+
+// Type of the token `distance` tokens after the current one (0 is current).
+TokenType parser_peek(const Parser* parser, uint32_t distance) {
+    uint32_t position = parser->position + distance;
+    if (position >= parser->end) return TOKEN_EOF;
+    return (TokenType)parser->tokens->tokens[position].type;
 }
 
 
-// 
+/*
+    Expressions are parsed by precedence climbing, from these tables:
+    an infix operator binds its operands with its power (higher binds
+    tighter, 0 is not an operator), all of them to the left; a prefix
+    operator binds tighter than any infix one.
+*/
+typedef struct Operator {
+    uint8_t power;
+    char op;        // As stored in the node (see ast.h)
+} Operator;
+
+static const Operator infix[TOKEN_TYPE_COUNT] = {
+    [TOKEN_EQUAL]         = { 1, AST_OP_EQUAL },
+    [TOKEN_NOT_EQUAL]     = { 1, AST_OP_NOT_EQUAL },
+    [TOKEN_LESS_THAN]     = { 2, '<' },
+    [TOKEN_GREATER_THAN]  = { 2, '>' },
+    [TOKEN_LESS_EQUAL]    = { 2, AST_OP_LESS_EQUAL },
+    [TOKEN_GREATER_EQUAL] = { 2, AST_OP_GREATER_EQUAL },
+    [TOKEN_PLUS]          = { 3, '+' },
+    [TOKEN_MINUS]         = { 3, '-' },
+    [TOKEN_ASTERISK]      = { 4, '*' },
+    [TOKEN_DIVISION]      = { 4, '/' },
+};
+
+static const char prefix[TOKEN_TYPE_COUNT] = {
+    [TOKEN_MINUS] = '-',
+};
+
+
+// An operand: a literal, a name, a parenthesized expression, or a prefix operator and its operand
 Node* parse_factor(Parser* parser) {
     if (parser->current.type == TOKEN_INTEGER) {
-        char* numstr = strndup(parser->current.start, parser->current.length);
-        long value = strtol(numstr, NULL, 10);
-        free(numstr);
+        long value = parser->current.value;    // Decoded by the lexer
         advance(parser);
-        return new_int_node((int)value);
+        return new_int_node(value);
     } 
     // If token is an identifier
     else if (parser->current.type == TOKEN_IDENTIFIER) {
-        char* name = strndup(parser->current.start, parser->current.length);
+        const char* name = intern(parser->current.start, parser->current.length);
         advance(parser);
-        Node* id = new_identifier_node(name);
-        free(name);
-        return id;
+        return new_identifier_node(name);
     }
     // If token is a '('
     else if (parser->current.type == TOKEN_LEFT_PAREN) {
         advance(parser);
         Node* expression = parse_expression(parser);
         if (!match(parser, TOKEN_RIGHT_PAREN)) {
-            fprintf(stderr, "Expected ')' after expression\n");
+            error(parser, "Expected ')' after expression\n");
             return NULL;
         }
         return expression;
     }
-    else if (parser->current.type == TOKEN_MINUS) {
+    else if (prefix[parser->current.type]) {
+        char op = prefix[parser->current.type];
         advance(parser);
         Node* child = parse_factor(parser);
         Node* unary_node = new_node(AST_UNARY);
-        unary_node->op = '-';
+        unary_node->op = op;
         add_child(unary_node, child);
         return unary_node;
     } else {
-        fprintf(stderr, "Expected token '%.*s'\n", parser->current.length, parser->current.start);
+        error(parser, "Expected token '%.*s'\n", parser->current.length, parser->current.start);
         advance(parser);
         return NULL;
     }
 }
 
 
-// Handles Operators
-Node* parse_term(Parser* parser) {
+// An expression of operators binding tighter than `power`
+static Node* parse_binary(Parser* parser, int power) {
     Node* left = parse_factor(parser);
-    while (parser->current.type == TOKEN_ASTERISK || parser->current.type == TOKEN_DIVISION) {
-        char op = parser->current.type == TOKEN_ASTERISK ? '*' : '/';
+    for (;;) {
+        Operator next = infix[parser->current.type];
+        if (next.power <= power) return left;
         advance(parser);
-        Node* right = parse_factor(parser);
-        Node* binop_node = new_binop_node(op, left, right);
-        left = binop_node;
+        Node* right = parse_binary(parser, next.power);
+        left = new_binop_node(next.op, left, right);
     }
-    return left;
 }
 
 
 //Parse a single expression to check what kind of token it is
 Node* parse_expression(Parser* parser) {
-    Node* left = parse_term(parser);  // handle *, / first
-    while (parser->current.type == TOKEN_PLUS || parser->current.type == TOKEN_MINUS) {
-        char op = parser->current.type == TOKEN_PLUS ? '+' : '-';
-        advance(parser);
-        Node* right = parse_term(parser);  // right side of +/-
-        Node* binop_node = new_binop_node(op, left, right);
-        left = binop_node;
-    }
-    return left;
+    return parse_binary(parser, 0);
 }
 
 
@@ -120,32 +206,35 @@ Node* parse_statement(Parser* parser) {
         case TOKEN_LET: {
             advance(parser);
             if (parser->current.type != TOKEN_IDENTIFIER) {
-                fprintf(stderr, "Expected identifier after: `let`\n");
+                error(parser, "Expected identifier after: `let`\n");
                 return NULL;
             }
-            char* name = strndup(parser->current.start, parser->current.length);
+            const char* name = intern(parser->current.start, parser->current.length);
             advance(parser);
 
             // optional type annotation: : Type
+            IntType type = TYPE_NONE;
             if (parser->current.type == TOKEN_COLON) {
                 advance(parser);
                 if (parser->current.type == TOKEN_IDENTIFIER) {
-                    // consume type identifier (we don't currently store it)
+                    type = type_named(parser->current.start, parser->current.length);
+                    if (type == TYPE_NONE) error(parser, "Unknown type '%.*s'\n", parser->current.length, parser->current.start);
                     advance(parser);
+                } else {
+                    error(parser, "Expected a type after ':'\n");
                 }
             }
 
             if (!match(parser, TOKEN_ASSIGN)) {
-                fprintf(stderr, "Expected '=' after identifier\n");
-                free(name);
+                error(parser, "Expected '=' after identifier\n");
                 return NULL;
             }
 
             Node* expression = parse_expression(parser);
 
             node = new_node(AST_LET);
+            node->type = (char)type;
             add_child(node, new_identifier_node(name));
-            free(name);
             add_child(node, expression);
             break;
         }
@@ -154,11 +243,11 @@ Node* parse_statement(Parser* parser) {
             advance(parser);
 
             if (parser->current.type != TOKEN_IDENTIFIER) {
-                fprintf(stderr, "Expected function name after `func`\n");
+                error(parser, "Expected function name after `func`\n");
                 return NULL;
             }
 
-            char* name = strndup(parser->current.start, parser->current.length);
+            const char* name = intern(parser->current.start, parser->current.length);
             advance(parser);
 
             // optional parameter list: ( ... )
@@ -175,7 +264,6 @@ Node* parse_statement(Parser* parser) {
 
             node = new_node(AST_FUNC);
             add_child(node, new_identifier_node(name)); // store function name
-            free(name);
 
             while (parser->current.type != TOKEN_END && parser->current.type != TOKEN_EOF) {
                 Node* statement = parse_statement(parser);
@@ -255,45 +343,278 @@ Node* parse_program(Parser* parser) {
 }
 
 
+/*
+    Parallel parsing. Only a `func` at nesting depth 0 can start a chunk,
+    so every chunk is a run of whole top-level statements and parsing the
+    chunks one after the other is the same as parsing the whole file.
+    The pre-scan tracks depth with func/if/while ... end (comments are
+    already gone after lexing), skipping a func's parameter list.
+
+    The scan trusts the input to be well formed. If any chunk reports an
+    error the parallel result is thrown away and the file is parsed again
+    serially, so diagnostics and error recovery are exactly the serial ones.
+*/
+#define PARALLEL_MIN_TOKENS (1u << 16)     // Smaller inputs aren't worth the threads
+
+typedef struct ParseChunk {
+    const TokenBuffer* tokens;
+    uint32_t begin, end;
+    InternTable* names;     // Shared with the calling thread
+    Arena arena;            // This chunk's nodes
+    AstStats stats;
+    Node* statements;       // Scratch AST_PROGRAM holding the chunk's statements
+    int error_count;
+} ParseChunk;
+
+// Parse one chunk on its own thread, into its own arena
+static void* parse_chunk(void* argument) {
+    ParseChunk* chunk = argument;
+
+    arena_init(&chunk->arena, 0);
+    ast_use_arena(&chunk->arena);
+    intern_use_table(chunk->names);
+    *ast_stats() = (AstStats){ 0 };
+
+    Parser parser;
+    parser_init_tokens(&parser, chunk->tokens, chunk->begin, chunk->end);
+    parser.errors = NULL;
+
+    chunk->statements = parse_program(&parser);
+    chunk->error_count = parser.error_count;
+    chunk->stats = *ast_stats();
+
+    parser_free(&parser);
+    ast_use_arena(NULL);
+    intern_use_table(NULL);
+    return NULL;
+}
+
+// Position of the first depth-0 `func` at or after `from`, or `end` if there is none
+static uint32_t next_top_level_func(const TokenBuffer* tokens, uint32_t from, uint32_t end, int* depth, uint32_t* scanned) {
+    uint32_t i = *scanned;
+    for (; i < end; i++) {
+        TokenType type = (TokenType)tokens->tokens[i].type;
+        if (type == TOKEN_FUNC) {
+            if (*depth == 0 && i >= from) break;
+            (*depth)++;
+            // Skip `name ( ... )`, the parser ignores whatever is in there
+            if (i + 2 < end && tokens->tokens[i + 1].type == TOKEN_IDENTIFIER && tokens->tokens[i + 2].type == TOKEN_LEFT_PAREN) {
+                i += 2;
+                while (i + 1 < end && tokens->tokens[i + 1].type != TOKEN_RIGHT_PAREN && tokens->tokens[i + 1].type != TOKEN_EOF) i++;
+            }
+        }
+        else if (type == TOKEN_IF || type == TOKEN_WHILE) (*depth)++;
+        else if (type == TOKEN_END && *depth > 0) (*depth)--;
+    }
+    *scanned = i;
+    return i;
+}
+
+
+/*
+    Parse the rest of the input like parse_program, on up to `threads`
+    threads. The result is identical to parse_program. Each chunk's nodes
+    are built in its own arena, which is then handed to the calling
+    thread's arena, so this needs ast_use_arena to have been called
+    (otherwise it just parses serially).
+*/
+Node* parse_program_parallel(Parser* parser, int threads) {
+    uint32_t begin = parser->position, end = parser->end;
+    if (end > parser->tokens->count) end = parser->tokens->count;
+    if (end > begin && parser->tokens->tokens[end - 1].type == TOKEN_EOF) end--;
+
+    uint32_t total = end > begin ? end - begin : 0;
+    if ((uint32_t)threads > total / PARALLEL_MIN_TOKENS) threads = (int)(total / PARALLEL_MIN_TOKENS);
+    if (threads <= 1 || !ast_arena()) return parse_program(parser);
+
+    // Cut at the first top-level func after each 1/threads of the tokens
+    ParseChunk* chunks = calloc(threads, sizeof(ParseChunk));
+    pthread_t* pool = malloc(sizeof(pthread_t) * threads);
+    if (!chunks || !pool) { fprintf(stderr, "Out of memory allocating parse chunks\n"); exit(1); }
+
+    int count = 0, depth = 0;
+    uint32_t start = begin, scanned = begin;
+    for (int t = 1; t <= threads && start < end; t++) {
+        uint32_t cut = t == threads ? end : next_top_level_func(parser->tokens, begin + (uint32_t)((uint64_t)total * t / threads), end, &depth, &scanned);
+        if (cut <= start) continue;
+        chunks[count].tokens = parser->tokens;
+        chunks[count].begin = start;
+        chunks[count].end = cut;
+        chunks[count].names = intern_table();
+        count++;
+        start = cut;
+    }
+
+    InternTable* names = intern_table();
+    names->shared = 1;
+    int started = 0;
+    for (; started < count; started++)
+        if (pthread_create(&pool[started], NULL, parse_chunk, &chunks[started]) != 0) break;
+    for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    names->shared = 0;
+
+    int errors = started < count;
+    for (int i = 0; i < started; i++) errors |= chunks[i].error_count != 0;
+
+    Node* root = NULL;
+    if (!errors) {
+        // Stitch the chunks together in source order
+        root = new_node(AST_PROGRAM);
+        for (int i = 0; i < count; i++)
+            for (int k = 0; k < chunks[i].statements->children_count; k++)
+                add_child(root, chunks[i].statements->children[k]);
+
+        parser->position = end;
+        parser->previous = parser->current;
+        parser->current = token_at(parser, end);
+    }
+
+    AstStats* stats = ast_stats();
+    for (int i = 0; i < started; i++) {
+        if (errors) {
+            arena_free(&chunks[i].arena);
+            continue;
+        }
+        // The chunk's Arena goes away with `chunks`, so its nodes have to belong to ours (see ast.h)
+        for (int k = 0; k < chunks[i].statements->children_count; k++)
+            ast_move_arena(chunks[i].statements->children[k], &chunks[i].arena, ast_arena());
+        arena_adopt(ast_arena(), &chunks[i].arena);
+        ast_stats_add(stats, &chunks[i].stats);     // Not after an error: parse_program counts everything again
+    }
+
+    free(pool);
+    free(chunks);
+    return root ? root : parse_program(parser);
+}
+
+
 // Print out AST information
 void print_ast(Node* node, int indent) {
-    if (!node) return;
+    fprint_ast(stdout, node, indent);
+}
 
-    for (int i = 0; i < indent; i++) printf("  "); // nicer indentation
+// Print out AST information to `out`
+void fprint_ast(FILE* out, Node* node, int indent) {
+    Writer writer;
+    writer_init(&writer, out);
+    write_ast(&writer, node, indent);
+    writer_free(&writer);
+}
 
-    switch (node->node) {
-        case AST_PROGRAM:       printf("PROGRAM\n"); break;
-        case AST_IDENTIFIER:    printf("IDENTIFIER %s\n", node->name); break;
-        case AST_INTEGER:       printf("INTEGER %d\n", node->value); break;
 
-        case AST_FUNC:          
-            printf("FUNC "); 
-            if (node->children_count > 0 && node->children[0])
-                printf("name=%s", node->children[0]->name);
-            printf("\n");
-            break;
-        case AST_LET:           
-            printf("LET "); 
-            if (node->children_count > 0 && node->children[0])
-                printf("%s = ...\n", node->children[0]->name);
-            break;
-        case AST_IF:            printf("IF\n"); break;
-        case AST_WHILE:         printf("WHILE\n"); break;
-        case AST_RETURN:        printf("RETURN\n"); break;
+// Pending work for write_ast: a node to print, or the "Condition:" label before one
+typedef struct DumpItem {
+    const Node* node;
+    int indent;
+    int label;
+} DumpItem;
+
+typedef struct DumpStack {
+    DumpItem* items;
+    size_t count;
+    size_t capacity;
+} DumpStack;
+
+static void push_item(DumpStack* stack, const Node* node, int indent, int label) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items = realloc(stack->items, sizeof(DumpItem) * stack->capacity);
+        if (!stack->items) {
+            fprintf(stderr, "Out of memory printing AST\n");
+            exit(1);
+        }
+    }
+    stack->items[stack->count++] = (DumpItem){ node, indent, label };
+}
+
+static void write_name(Writer* writer, const char* name) {
+    writer_string(writer, name ? name : "(null)");
+}
 
-        case AST_BINOP:         printf("BINOP %c\n", node->op); break;
-        case AST_UNARY:         printf("UNARY %c\n", node->op); break;
-        default:                printf("UNKNOWN NODE\n"); break;
+
+/*
+    Print the tree in print_ast's format. Walks with an explicit stack
+    instead of recursing, so arbitrarily deep trees are fine.
+*/
+void write_ast(Writer* writer, const Node* root, int indent) {
+    DumpStack stack = { 0 };
+    if (root) push_item(&stack, root, indent, 0);
+
+    while (stack.count) {
+        DumpItem item = stack.items[--stack.count];
+        const Node* node = item.node;
+
+        writer_indent(writer, item.indent);
+        if (item.label) {
+            writer_string(writer, "Condition:\n");
+            push_item(&stack, node, item.indent + 1, 0);
+            continue;
+        }
+
+        switch (node->node) {
+            case AST_PROGRAM:       writer_string(writer, "PROGRAM\n"); break;
+            case AST_IDENTIFIER:    writer_string(writer, "IDENTIFIER "); write_name(writer, node->name); writer_char(writer, '\n'); break;
+            case AST_INTEGER:       writer_string(writer, "INTEGER "); writer_long(writer, node->value); writer_char(writer, '\n'); break;
+
+            case AST_FUNC:
+                writer_string(writer, "FUNC ");
+                if (node->children_count > 0 && node->children[0]) {
+                    writer_string(writer, "name=");
+                    write_name(writer, node->children[0]->name);
+                }
+                writer_char(writer, '\n');
+                break;
+            case AST_LET:
+                writer_string(writer, "LET ");
+                if (node->children_count > 0 && node->children[0]) {
+                    write_name(writer, node->children[0]->name);
+                    if (node->type) { writer_string(writer, ": "); writer_string(writer, type_name((IntType)node->type)); }
+                    writer_string(writer, " = ...\n");
+                }
+                break;
+            case AST_IF:            writer_string(writer, "IF\n"); break;
+            case AST_WHILE:         writer_string(writer, "WHILE\n"); break;
+            case AST_RETURN:        writer_string(writer, "RETURN\n"); break;
+
+            case AST_BINOP:         writer_string(writer, "BINOP "); writer_string(writer, ast_operator_name(node->op)); writer_char(writer, '\n'); break;
+            case AST_UNARY:         writer_string(writer, "UNARY "); writer_string(writer, ast_operator_name(node->op)); writer_char(writer, '\n'); break;
+            default:                writer_string(writer, "UNKNOWN NODE\n"); break;
+        }
+
+        // Children last-first, so they come off the stack in order, after the condition
+        for (int i = node->children_count - 1; i >= 0; i--)
+            if (node->children[i]) push_item(&stack, node->children[i], item.indent + 1, 0);
+        if (node->condition) push_item(&stack, node->condition, item.indent + 1, 1);
     }
 
-    // Print condition if present
-    if (node->condition) {
-        for (int i = 0; i < indent + 1; i++) printf("  ");
-        printf("Condition:\n");
-        print_ast(node->condition, indent + 2);
+    free(stack.items);
+}
+
+
+/*
+    Print every token of `tokens` as `line:column TYPE text`, one per line.
+*/
+void write_tokens(Writer* writer, const TokenBuffer* tokens) {
+    LineIndex lines;
+    uint32_t length = tokens->count ? tokens->tokens[tokens->count - 1].offset : 0;
+    line_index_init(&lines, tokens->source, length);
+
+    for (uint32_t i = 0; i < tokens->count; i++) {
+        Token token = token_buffer_get(tokens, i);
+        int line, column;
+        line_index_position(&lines, (uint32_t)(token.start - tokens->source), &line, &column);
+
+        writer_long(writer, line);
+        writer_char(writer, ':');
+        writer_long(writer, column);
+        writer_char(writer, ' ');
+        writer_string(writer, token_type_name(token.type));
+        if (token.length) {
+            writer_char(writer, ' ');
+            writer_write(writer, token.start, token.length);
+        }
+        writer_char(writer, '\n');
     }
 
-    // Print children (expressions/statements)
-    for (int i = 0; i < node->children_count; i++)
-        print_ast(node->children[i], indent + 1);
-}
\ No newline at end of file
+    line_index_free(&lines);
+}
@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "regalloc.h"
+
+#define REGALLOC_MAX_DEPTH 6    // Loop levels that still raise a use's weight
+#define NONE UINT32_MAX
+
+typedef struct Loop {
+    uint32_t top;       // Target of the backward jump
+    uint32_t bottom;    // The jump
+} Loop;
+
+static void* allocate(size_t size) {
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        fprintf(stderr, "Out of memory allocating registers\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// The registers `in` reads into `reads` (returns how many), and the one it writes into `write` (or NONE)
+static int operands(const VmInstruction* in, uint32_t* reads, uint32_t* write) {
+    *write = NONE;
+    switch ((VmOpcode)in->op) {
+        case OP_LOADI:
+        case OP_LOADK:
+        case OP_GETG:
+        case OP_CALL:
+            *write = in->a;
+            return 0;
+        case OP_SETG:
+        case OP_JUMPZ:
+        case OP_JUMPNZ:
+        case OP_RETURN:
+            reads[0] = in->a;
+            return 1;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_DIVU:
+        case OP_LT:
+        case OP_LE:
+        case OP_EQ:
+        case OP_NE:
+        case OP_LTU:
+        case OP_LEU:
+            *write = in->a;
+            reads[0] = in->b;
+            reads[1] = in->c;
+            return 2;
+        case OP_MOVE:
+        case OP_ADDI:
+        case OP_SUBI:
+        case OP_MULI:
+        case OP_DIVI:
+        case OP_NEG:
+        case OP_NARROW:
+            *write = in->a;
+            reads[0] = in->b;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+/*
+    Max over a range of instructions of the bottom of the loops starting
+    there, in a segment tree: finds the loops an interval runs into.
+*/
+typedef struct Bottoms {
+    uint32_t* tree;     // Leaves at [size, 2 * size)
+    uint32_t size;
+} Bottoms;
+
+static void bottoms_init(Bottoms* bottoms, const Loop* loops, uint32_t loop_count, uint32_t size) {
+    bottoms->size = size;
+    bottoms->tree = allocate(sizeof(uint32_t) * 2 * size);
+    memset(bottoms->tree, 0, sizeof(uint32_t) * 2 * size);
+    for (uint32_t i = 0; i < loop_count; i++) {
+        uint32_t* leaf = &bottoms->tree[size + loops[i].top];
+        if (loops[i].bottom > *leaf) *leaf = loops[i].bottom;
+    }
+    for (uint32_t i = size - 1; i > 0; i--)
+        bottoms->tree[i] = bottoms->tree[2 * i] > bottoms->tree[2 * i + 1] ? bottoms->tree[2 * i] : bottoms->tree[2 * i + 1];
+}
+
+// Furthest bottom of a loop starting in [from, to]
+static uint32_t bottoms_max(const Bottoms* bottoms, uint32_t from, uint32_t to) {
+    uint32_t best = 0;
+    for (from += bottoms->size, to += bottoms->size + 1; from < to; from /= 2, to /= 2) {
+        if (from & 1) { if (bottoms->tree[from] > best) best = bottoms->tree[from]; from++; }
+        if (to & 1) { to--; if (bottoms->tree[to] > best) best = bottoms->tree[to]; }
+    }
+    return best;
+}
+
+
+// One interval per VM register the function mentions, in order of start
+static void build_intervals(RegisterAssignment* assignment, const VmFunction* function) {
+    uint32_t count = function->count;
+    Loop* loops = allocate(sizeof(Loop) * count);
+    uint32_t loop_count = 0;
+    int32_t* depth = allocate(sizeof(int32_t) * (count + 1));
+    uint32_t* calls = allocate(sizeof(uint32_t) * (count + 1));    // CALLs before each instruction
+    memset(depth, 0, sizeof(int32_t) * (count + 1));
+
+    calls[0] = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const VmInstruction* in = &function->code[i];
+        int jumps = in->op == OP_JUMP || in->op == OP_JUMPZ || in->op == OP_JUMPNZ;
+        if (jumps && in->index <= i) {
+            loops[loop_count++] = (Loop){ in->index, i };
+            depth[in->index]++;
+            depth[i + 1]--;
+        }
+        calls[i + 1] = calls[i] + (in->op == OP_CALL);
+    }
+    for (uint32_t i = 1; i < count; i++) depth[i] += depth[i - 1];
+
+    // First and last mention of every register, and its uses
+    LiveInterval* by_register = allocate(sizeof(LiveInterval) * (function->registers ? function->registers : 1));
+    for (uint32_t r = 0; r < function->registers; r++) by_register[r] = (LiveInterval){ r, NONE, 0, 0, 0, 0 };
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t reads[2], write;
+        int read_count = operands(&function->code[i], reads, &write);
+        uint64_t weight = 1ull << (3 * (depth[i] < REGALLOC_MAX_DEPTH ? depth[i] : REGALLOC_MAX_DEPTH));
+        for (int k = 0; k <= read_count; k++) {
+            uint32_t reg = k < read_count ? reads[k] : write;
+            if (reg == NONE) continue;
+            LiveInterval* interval = &by_register[reg];
+            if (interval->start == NONE) {
+                interval->start = i;
+                interval->live_in = k < read_count;
+            }
+            interval->end = i;
+            interval->weight += weight;
+        }
+    }
+
+    /*
+        A register live into a loop's top from before it, or read there
+        before it's written (so around the backward jump), is live in the
+        whole loop. Either can grow the interval into further loops.
+    */
+    Bottoms bottoms;
+    bottoms_init(&bottoms, loops, loop_count, count ? count : 1);
+    for (uint32_t r = 0; r < function->registers; r++) {
+        LiveInterval* interval = &by_register[r];
+        if (interval->start == NONE) continue;
+        for (int changed = 1; changed;) {
+            changed = 0;
+            if (interval->live_in) {
+                for (uint32_t i = 0; i < loop_count; i++) {
+                    const Loop* loop = &loops[i];
+                    if (loop->top > interval->start || loop->bottom < interval->start) continue;
+                    if (loop->top < interval->start) { interval->start = loop->top; changed = 1; }
+                    if (loop->bottom > interval->end) { interval->end = loop->bottom; changed = 1; }
+                }
+            }
+            if (interval->start < interval->end) {
+                uint32_t bottom = bottoms_max(&bottoms, interval->start + 1, interval->end);
+                if (bottom > interval->end) { interval->end = bottom; changed = 1; }
+            }
+        }
+        interval->calls = interval->start < interval->end && calls[interval->end] > calls[interval->start + 1];
+    }
+
+    // Counting sort by start
+    uint32_t* first = allocate(sizeof(uint32_t) * (count + 1));
+    memset(first, 0, sizeof(uint32_t) * (count + 1));
+    assignment->interval_count = 0;
+    for (uint32_t r = 0; r < function->registers; r++) {
+        if (by_register[r].start == NONE) continue;
+        first[by_register[r].start + 1]++;
+        assignment->interval_count++;
+    }
+    for (uint32_t i = 0; i < count; i++) first[i + 1] += first[i];
+    assignment->intervals = allocate(sizeof(LiveInterval) * assignment->interval_count);
+    for (uint32_t r = 0; r < function->registers; r++)
+        if (by_register[r].start != NONE) assignment->intervals[first[by_register[r].start]++] = by_register[r];
+
+    free(first);
+    free(bottoms.tree);
+    free(by_register);
+    free(calls);
+    free(depth);
+    free(loops);
+}
+
+
+// Whether `a` is cheaper to leave in memory than `b`: fewer weighted uses for the instructions it holds a register over
+static int cheaper(const LiveInterval* a, const LiveInterval* b) {
+    uint64_t left = a->weight * (b->end - b->start + 1), right = b->weight * (a->end - a->start + 1);
+    return left < right || (left == right && a->end > b->end);
+}
+
+void regalloc(RegisterAssignment* assignment, const VmFunction* function, const RegisterSet* set) {
+    assignment->location = allocate(function->registers ? function->registers : 1);
+    memset(assignment->location, REGALLOC_SPILLED, function->registers);
+    assignment->saved = 0;
+    build_intervals(assignment, function);
+
+    uint32_t everything = set->count == 32 ? UINT32_MAX : (1u << set->count) - 1;
+    uint32_t preserved = everything & ~((1u << set->scratch_count) - 1);
+    uint32_t available = everything;
+    uint32_t active[32];    // Intervals holding a register
+    uint32_t active_count = 0;
+
+    for (uint32_t i = 0; i < assignment->interval_count; i++) {
+        const LiveInterval* interval = &assignment->intervals[i];
+
+        // Registers of intervals that ended free up; one read here can be reused for a write here
+        for (uint32_t k = 0; k < active_count;) {
+            const LiveInterval* old = &assignment->intervals[active[k]];
+            if (old->end < interval->start || (old->end == interval->start && !interval->live_in)) {
+                available |= 1u << assignment->location[old->reg];
+                active[k] = active[--active_count];
+            } else {
+                k++;
+            }
+        }
+
+        // A free register, scratch ones first; else the cheapest to spill
+        uint32_t allowed = interval->calls ? preserved : everything;
+        uint8_t chosen = REGALLOC_SPILLED;
+        if (available & allowed) {
+            chosen = (uint8_t)__builtin_ctz(available & allowed);
+            available &= ~(1u << chosen);
+            active[active_count++] = i;
+        } else {
+            uint32_t victim = NONE;
+            for (uint32_t k = 0; k < active_count; k++) {
+                const LiveInterval* old = &assignment->intervals[active[k]];
+                if (!(allowed & (1u << assignment->location[old->reg]))) continue;
+                const LiveInterval* best = victim == NONE ? interval : &assignment->intervals[active[victim]];
+                if (cheaper(old, best)) victim = k;
+            }
+            if (victim != NONE) {
+                const LiveInterval* old = &assignment->intervals[active[victim]];
+                chosen = assignment->location[old->reg];
+                assignment->location[old->reg] = REGALLOC_SPILLED;
+                active[victim] = i;
+            }
+        }
+        assignment->location[interval->reg] = chosen;
+    }
+
+    for (uint32_t r = 0; r < function->registers; r++)
+        if (assignment->location[r] != REGALLOC_SPILLED) assignment->saved |= (1u << assignment->location[r]) & preserved;
+}
+
+void regalloc_free(RegisterAssignment* assignment) {
+    free(assignment->location);
+    free(assignment->intervals);
+    memset(assignment, 0, sizeof(*assignment));
+}
+
+
+// Every function's intervals and where they went
+void regalloc_dump(const VmProgram* program, const RegisterSet* set, Writer* out) {
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const VmFunction* function = &program->functions[f];
+        if (!function->code) continue;
+
+        RegisterAssignment assignment;
+        regalloc(&assignment, function, set);
+        writer_string(out, "function ");
+        writer_string(out, function->name ? function->name : "(top level)");
+        if (assignment.saved) {
+            writer_string(out, ", saves");
+            for (uint32_t i = 0; i < set->count; i++) {
+                if (!(assignment.saved & (1u << i))) continue;
+                writer_string(out, " %");
+                writer_string(out, set->names[i]);
+            }
+        }
+        writer_char(out, '\n');
+
+        for (uint32_t i = 0; i < assignment.interval_count; i++) {
+            const LiveInterval* interval = &assignment.intervals[i];
+            uint8_t location = assignment.location[interval->reg];
+            writer_indent(out, 1);
+            writer_char(out, 'r');
+            writer_long(out, interval->reg);
+            writer_char(out, '\t');
+            if (location == REGALLOC_SPILLED) {
+                writer_string(out, "spilled");
+            } else {
+                writer_char(out, '%');
+                writer_string(out, set->names[location]);
+            }
+            writer_char(out, '\t');
+            writer_long(out, interval->start);
+            writer_string(out, "..");
+            writer_long(out, interval->end);
+            writer_string(out, " weight ");
+            writer_long(out, (long)interval->weight);
+            if (interval->calls) writer_string(out, ", across calls");
+            writer_char(out, '\n');
+        }
+        regalloc_free(&assignment);
+    }
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+
+static const char* pass_names[PASS_COUNT] = {
+    [PASS_MAP]      = "map",
+    [PASS_LEX]      = "lex",
+    [PASS_PARSE]    = "parse",
+    [PASS_FOLD]     = "fold",
+    [PASS_RESOLVE]  = "resolve",
+    [PASS_PRINT]    = "print",
+    [PASS_CODEGEN]  = "codegen",
+    [PASS_IR]       = "ir",
+    [PASS_BYTECODE] = "bytecode",
+    [PASS_JIT]      = "jit",
+    [PASS_RUN]      = "run",
+    [PASS_TEARDOWN] = "teardown",
+    [PASS_WRITE]    = "write",
+};
+
+
+static double seconds(clockid_t id) {
+    struct timespec time;
+    clock_gettime(id, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Start timing a pass
+void stats_start(PassClock* clock) {
+    clock->wall = seconds(CLOCK_MONOTONIC);
+    clock->cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+// Charge the time since stats_start to `pass`. Does nothing if `stats` is NULL.
+void stats_stop(CompileStats* stats, CompilePass pass, const PassClock* clock) {
+    if (!stats) return;
+    stats->wall[pass] += seconds(CLOCK_MONOTONIC) - clock->wall;
+    stats->cpu[pass] += seconds(CLOCK_THREAD_CPUTIME_ID) - clock->cpu;
+}
+
+
+// Count the buffer's tokens by type (including the final EOF)
+void stats_count_tokens(CompileStats* stats, const TokenBuffer* tokens) {
+    for (uint32_t i = 0; i < tokens->count; i++) stats->tokens[tokens->tokens[i].type]++;
+}
+
+// Add the counters and times in `stats` to `total`
+void stats_add(CompileStats* total, const CompileStats* stats) {
+    total->files += stats->files;
+    for (int i = 0; i < PASS_COUNT; i++) {
+        total->wall[i] += stats->wall[i];
+        total->cpu[i] += stats->cpu[i];
+    }
+    total->bytes_read += stats->bytes_read;
+    for (int i = 0; i < TOKEN_TYPE_COUNT; i++) total->tokens[i] += stats->tokens[i];
+    ast_stats_add(&total->ast, &stats->ast);
+    fold_stats_add(&total->fold, &stats->fold);
+}
+
+
+// Largest resident set size of the process so far, in KiB
+static long peak_rss(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) return 0;
+    return usage.ru_maxrss;
+}
+
+static size_t sum(const size_t* counts, int count) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += counts[i];
+    return total;
+}
+
+
+/*
+    Table
+*/
+void stats_print(FILE* out, const CompileStats* total, int what) {
+    if (what & STATS_TIMES) {
+        double wall = 0, cpu = 0;
+        for (int i = 0; i < PASS_COUNT; i++) { wall += total->wall[i]; cpu += total->cpu[i]; }
+
+        fprintf(out, "%-12s %12s %12s %7s\n", "Pass", "Wall ms", "CPU ms", "Wall %");
+        for (int i = 0; i < PASS_COUNT; i++) {
+            fprintf(out, "%-12s %12.3f %12.3f %6.1f%%\n", pass_names[i],
+                total->wall[i] * 1e3, total->cpu[i] * 1e3, wall > 0 ? total->wall[i] / wall * 100 : 0.0);
+        }
+        fprintf(out, "%-12s %12.3f %12.3f\n", "total", wall * 1e3, cpu * 1e3);
+    }
+
+    if (what & STATS_COUNTERS) {
+        if (what & STATS_TIMES) fprintf(out, "\n");
+
+        fprintf(out, "%-20s %12d\n", "Files", total->files);
+        fprintf(out, "%-20s %12zu\n", "Bytes read", total->bytes_read);
+        fprintf(out, "%-20s %12ld KiB\n", "Peak RSS", peak_rss());
+        fprintf(out, "%-20s %12zu\n", "Node mallocs", total->ast.mallocs);
+        fprintf(out, "%-20s %12zu\n", "Child reallocs", total->ast.reallocs);
+
+        fprintf(out, "%-20s %12zu\n", "Tokens", sum(total->tokens, TOKEN_TYPE_COUNT));
+        for (int i = 0; i < TOKEN_TYPE_COUNT; i++)
+            if (total->tokens[i]) fprintf(out, "  %-18s %12zu\n", token_type_name(i), total->tokens[i]);
+
+        fprintf(out, "%-20s %12zu\n", "Nodes", sum(total->ast.nodes_by_type, AST_NODE_TYPE_COUNT));
+        for (int i = 0; i < AST_NODE_TYPE_COUNT; i++)
+            if (total->ast.nodes_by_type[i]) fprintf(out, "  %-18s %12zu\n", ast_node_type_name(i), total->ast.nodes_by_type[i]);
+
+        fprintf(out, "%-20s %12zu\n", "Folded operators", total->fold.folded);
+        fprintf(out, "%-20s %12zu\n", "Simplifications", total->fold.simplified);
+        fprintf(out, "%-20s %12zu\n", "Nodes removed", total->fold.removed);
+    }
+}
+
+
+/*
+    JSON
+*/
+static void json_string(FILE* out, const char* string) {
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)string; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+        else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+        else fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void json_stats(FILE* out, const CompileStats* stats, int what) {
+    const char* separator = "";
+    fprintf(out, "{");
+
+    if (what & STATS_TIMES) {
+        fprintf(out, "\"passes\": {");
+        for (int i = 0; i < PASS_COUNT; i++)
+            fprintf(out, "%s\"%s\": {\"wall_ms\": %.6f, \"cpu_ms\": %.6f}", i ? ", " : "", pass_names[i], stats->wall[i] * 1e3, stats->cpu[i] * 1e3);
+        fprintf(out, "}");
+        separator = ", ";
+    }
+
+    if (what & STATS_COUNTERS) {
+        fprintf(out, "%s\"bytes_read\": %zu, \"node_mallocs\": %zu, \"child_reallocs\": %zu", separator,
+            stats->bytes_read, stats->ast.mallocs, stats->ast.reallocs);
+
+        fprintf(out, ", \"tokens\": {");
+        for (int i = 0, first = 1; i < TOKEN_TYPE_COUNT; i++) {
+            if (!stats->tokens[i]) continue;
+            fprintf(out, "%s\"%s\": %zu", first ? "" : ", ", token_type_name(i), stats->tokens[i]);
+            first = 0;
+        }
+        fprintf(out, "}, \"nodes\": {");
+        for (int i = 0, first = 1; i < AST_NODE_TYPE_COUNT; i++) {
+            if (!stats->ast.nodes_by_type[i]) continue;
+            fprintf(out, "%s\"%s\": %zu", first ? "" : ", ", ast_node_type_name(i), stats->ast.nodes_by_type[i]);
+            first = 0;
+        }
+        fprintf(out, "}, \"fold\": {\"folded\": %zu, \"simplified\": %zu, \"removed\": %zu}",
+            stats->fold.folded, stats->fold.simplified, stats->fold.removed);
+    }
+
+    fprintf(out, "}");
+}
+
+// One JSON object: every file's numbers, the totals and the peak RSS
+void stats_print_json(FILE* out, const CompileStats* files, const char* const* names, int count, const CompileStats* total, int what) {
+    fprintf(out, "{\"files\": [");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s\n  {\"file\": ", i ? "," : "");
+        json_string(out, names[i]);
+        fprintf(out, ", \"stats\": ");
+        json_stats(out, &files[i], what);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n], \"total\": ");
+    json_stats(out, total, what);
+    fprintf(out, ", \"peak_rss_kb\": %ld}\n", peak_rss());
+}
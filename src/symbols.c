@@ -0,0 +1,251 @@
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "fold.h"
+#include "intern.h"
+#include "names.h"
+#include "symbols.h"
+#include "types.h"
+
+/*
+    The symbol table: the symbols of the open scopes on a stack, innermost
+    last, and a map from each name to its symbol there (open addressing
+    over the interned pointer, see names.h), so a lookup is one probe
+    sequence however deep the scopes are nested.
+*/
+typedef struct Symbol {
+    const char* name;
+    int depth;          // Of the scope it was declared in, 0 for globals
+    int slot;
+    IntType type;
+} Symbol;
+
+typedef struct SymbolTable {
+    Symbol* symbols;    // The scope stack
+    uint32_t count;
+    uint32_t capacity;
+    NameMap visible;    // Name -> index of its symbol, or -1
+    int depth;          // Of the innermost open scope
+} SymbolTable;
+
+typedef struct Resolver {
+    SymbolTable table;
+    NameMap functions;  // Name -> function index
+    int locals;         // Slots given out in the function being resolved
+    FILE* errors;
+    int error_count;
+} Resolver;
+
+static void error(Resolver* resolver, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(resolver->errors, format, arguments);
+    va_end(arguments);
+    resolver->error_count++;
+}
+
+
+/*
+    Scopes
+*/
+static const Symbol* lookup(SymbolTable* table, const char* name) {
+    int index = name ? name_slot(&table->visible, name)->value : -1;
+    return index < 0 ? NULL : &table->symbols[index];
+}
+
+// Push a symbol for `name` in the innermost scope, through its slot in the map
+static const Symbol* push(SymbolTable* table, NameSlot* visible, const char* name, int slot, IntType type) {
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 64;
+        table->symbols = realloc(table->symbols, sizeof(Symbol) * table->capacity);
+        if (!table->symbols) {
+            fprintf(stderr, "Out of memory resolving names\n");
+            exit(1);
+        }
+    }
+    table->symbols[table->count] = (Symbol){ name, table->depth, slot, type };
+    visible->value = (int)table->count;
+    return &table->symbols[table->count++];
+}
+
+// The symbol `name` means here, declared with `slot` and `type` (i64 if none) if there isn't one
+static const Symbol* lookup_or_declare(SymbolTable* table, const char* name, int* slot, IntType type) {
+    NameSlot* visible = name_slot(&table->visible, name);
+    if (visible->value >= 0) return &table->symbols[visible->value];
+    return push(table, visible, name, (*slot)++, type ? type : TYPE_I64);
+}
+
+static void enter_scope(SymbolTable* table) {
+    table->depth++;
+}
+
+// Forget the symbols of the scope being left (none of them hid another)
+static void leave_scope(SymbolTable* table) {
+    table->depth--;
+    while (table->count && table->symbols[table->count - 1].depth > table->depth)
+        name_slot(&table->visible, table->symbols[--table->count].name)->value = -1;
+}
+
+static void bind(Node* identifier, const Symbol* symbol) {
+    identifier->depth = symbol->depth;
+    identifier->slot = symbol->slot;
+    identifier->type = (char)symbol->type;
+}
+
+
+/*
+    Expressions and statements. Only what the back ends compile is
+    resolved: what they reject (a nested func, a statement where an
+    expression belongs) is left for them to report. An operator's result
+    is a u64 if an operand is one, else an i64 (always, for a comparison).
+*/
+static IntType result_type(const Node* node) {
+    if (node->node == AST_BINOP && ast_is_comparison(node->op)) return TYPE_I64;
+    return type_unsigned_operands(node) ? TYPE_U64 : TYPE_I64;
+}
+
+static void expression(Resolver* resolver, Node* node) {
+    if (!node) return;
+
+    switch (node->node) {
+        case AST_IDENTIFIER: {
+            const Symbol* symbol = lookup(&resolver->table, node->name);
+            if (symbol) bind(node, symbol);
+            else error(resolver, "Undeclared variable '%s'\n", node->name ? node->name : "");
+            break;
+        }
+
+        case AST_UNARY:
+        case AST_BINOP:
+            for (int i = 0; i < node->children_count; i++) expression(resolver, node->children[i]);
+            node->type = (char)result_type(node);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void statement(Resolver* resolver, Node* node);
+
+static void block(Resolver* resolver, Node* node, int first) {
+    enter_scope(&resolver->table);
+    for (int i = first; i < node->children_count; i++) statement(resolver, node->children[i]);
+    leave_scope(&resolver->table);
+}
+
+/*
+    A let keeps the type its variable was declared with, and a constant it
+    stores has to fit. Constant expressions are worked out here, so the
+    check doesn't depend on whether the tree was folded first.
+*/
+static void check_let(Resolver* resolver, const Node* node) {
+    const Node* target = node->children[0];
+    const Node* value = node->children_count > 1 ? node->children[1] : NULL;
+    IntType type = (IntType)target->type;
+    long constant;
+
+    if (node->type && node->type != type) {
+        error(resolver, "'%s' is %s, it can't be declared %s\n", target->name, type_name(type), type_name((IntType)node->type));
+    } else if (fold_evaluate(value, &constant) && !type_fits(type, constant)) {
+        error(resolver, "%ld is out of range for '%s' (%s)\n", constant, target->name, type_name(type));
+    }
+}
+
+static void let(Resolver* resolver, Node* node) {
+    Node* target = node->children[0];
+    expression(resolver, node->children_count > 1 ? node->children[1] : NULL);
+
+    // A new local if there's nothing to assign, not visible in its own initializer
+    bind(target, lookup_or_declare(&resolver->table, target->name, &resolver->locals, (IntType)node->type));
+    check_let(resolver, node);
+}
+
+static void statement(Resolver* resolver, Node* node) {
+    if (!node) return;
+
+    switch (node->node) {
+        case AST_LET:
+            let(resolver, node);
+            break;
+
+        case AST_IF:
+        case AST_WHILE:
+            expression(resolver, node->condition);
+            block(resolver, node, 0);
+            break;
+
+        case AST_RETURN:
+            expression(resolver, node->children_count > 0 ? node->children[0] : NULL);
+            break;
+
+        case AST_FUNC:
+            break;
+
+        default:
+            expression(resolver, node);
+            break;
+    }
+}
+
+
+/*
+    Resolve every identifier of a whole program (see symbols.h). Problems
+    are reported to `errors`; returns how many there were (the tree can't
+    be compiled unless 0).
+*/
+int resolve_names(Node* program, FILE* errors) {
+    Resolver resolver = { 0 };
+    resolver.errors = errors;
+    name_map_reserve(&resolver.table.visible, (uint32_t)program->children_count);
+
+    // Number the functions and globals first, so they can be used anywhere
+    int functions = 1, globals = 0;
+    for (int i = 0; i < program->children_count; i++) {
+        Node* node = program->children[i];
+        if (!node || (node->node != AST_FUNC && node->node != AST_LET) || !node->children_count) continue;
+
+        Node* name = node->children[0];
+        if (node->node == AST_FUNC) {
+            NameSlot* slot = name_slot(&resolver.functions, name->name);
+            name->depth = 0;
+            if (slot->value >= 0) {
+                error(&resolver, "Function '%s' is defined more than once\n", name->name);
+                name->slot = -1;
+            } else {
+                name->slot = slot->value = functions++;
+            }
+        } else if (node->node == AST_LET) {
+            bind(name, lookup_or_declare(&resolver.table, name->name, &globals, (IntType)node->type));
+        }
+    }
+
+    program->slot = name_slot(&resolver.functions, intern("main", 4))->value;
+
+    for (int i = 0; i < program->children_count; i++) {
+        Node* node = program->children[i];
+        if (!node || node->node != AST_FUNC || node->children[0]->slot < 0) continue;
+        resolver.locals = 0;
+        block(&resolver, node, 1);
+    }
+
+    // The top level: its lets are the globals, bound above; only its ifs and whiles have locals
+    resolver.locals = 0;
+    enter_scope(&resolver.table);
+    for (int i = 0; i < program->children_count; i++) {
+        Node* node = program->children[i];
+        if (!node || node->node == AST_FUNC) continue;
+        if (node->node == AST_LET) {
+            expression(&resolver, node->children_count > 1 ? node->children[1] : NULL);
+            check_let(&resolver, node);
+        } else {
+            statement(&resolver, node);
+        }
+    }
+    leave_scope(&resolver.table);
+
+    free(resolver.table.symbols);
+    name_map_free(&resolver.table.visible);
+    name_map_free(&resolver.functions);
+    return resolver.error_count;
+}
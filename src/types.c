@@ -0,0 +1,83 @@
+#include <string.h>
+
+#include "types.h"
+
+static const struct {
+    const char* name;
+    const char* c_name;     // Storage in the generated C
+    unsigned char bits;
+    unsigned char is_unsigned;
+} types[TYPE_COUNT] = {
+    [TYPE_NONE] = { "i64", "long",     64, 0 },
+    [TYPE_I8]   = { "i8",  "int8_t",   8,  0 },
+    [TYPE_I16]  = { "i16", "int16_t",  16, 0 },
+    [TYPE_I32]  = { "i32", "int32_t",  32, 0 },
+    [TYPE_I64]  = { "i64", "long",     64, 0 },
+    [TYPE_U8]   = { "u8",  "uint8_t",  8,  1 },
+    [TYPE_U16]  = { "u16", "uint16_t", 16, 1 },
+    [TYPE_U32]  = { "u32", "uint32_t", 32, 1 },
+    [TYPE_U64]  = { "u64", "uint64_t", 64, 1 },
+};
+
+// The type spelled `name`, or TYPE_NONE if there's no such type
+IntType type_named(const char* name, size_t length) {
+    for (int type = TYPE_I8; type < TYPE_COUNT; type++)
+        if (strlen(types[type].name) == length && !memcmp(types[type].name, name, length)) return (IntType)type;
+    return TYPE_NONE;
+}
+
+const char* type_name(IntType type) {
+    return types[type].name;
+}
+
+const char* type_c_name(IntType type) {
+    return types[type].c_name;
+}
+
+int type_bits(IntType type) {
+    return types[type].bits;
+}
+
+int type_is_unsigned(IntType type) {
+    return types[type].is_unsigned;
+}
+
+// `value` wrapped to the width of `type`, as storing it in a variable of that type does
+long type_wrap(IntType type, long value) {
+    int shift = 64 - types[type].bits;
+    if (!shift) return value;
+    unsigned long bits = (unsigned long)value << shift;
+    return types[type].is_unsigned ? (long)(bits >> shift) : (long)bits >> shift;
+}
+
+// Can `value` be written as a constant of `type`?
+int type_fits(IntType type, long value) {
+    if (type == TYPE_U64) return value >= 0;
+    return type_wrap(type, value) == value;
+}
+
+// Is every value of `inner` a value of `outer` too?
+int type_within(IntType inner, IntType outer) {
+    if (types[outer].bits == 64 || inner == outer) return 1;
+    if (types[inner].is_unsigned == types[outer].is_unsigned) return types[inner].bits <= types[outer].bits;
+    return types[inner].is_unsigned && types[inner].bits < types[outer].bits;
+}
+
+/*
+    Does storing `value` into a variable of `type` have to wrap it? Not if
+    the variable is 64 bits wide, nor if the value is a constant (which
+    resolve_names has checked fits), a comparison or of a type within it.
+*/
+int type_narrows(IntType type, const Node* value) {
+    if (types[type].bits == 64 || !value) return 0;
+    if (value->node == AST_INTEGER) return !type_fits(type, value->value);
+    if (value->node == AST_BINOP && ast_is_comparison(value->op)) return 0;
+    return !(value->type != TYPE_NONE && type_within((IntType)value->type, type));
+}
+
+// Does the operator `node` divide or compare unsigned (is an operand a u64)?
+int type_unsigned_operands(const Node* node) {
+    for (int i = 0; i < node->children_count; i++)
+        if (node->children[i] && node->children[i]->type == TYPE_U64) return 1;
+    return 0;
+}
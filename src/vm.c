@@ -0,0 +1,667 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "vm.h"
+
+#define VM_MAX_FRAMES   10000
+
+static const char* opcode_names[OP_COUNT] = {
+    [OP_MOVE]   = "MOVE",
+    [OP_LOADI]  = "LOADI",
+    [OP_LOADK]  = "LOADK",
+    [OP_GETG]   = "GETG",
+    [OP_SETG]   = "SETG",
+    [OP_ADD]    = "ADD",
+    [OP_SUB]    = "SUB",
+    [OP_MUL]    = "MUL",
+    [OP_DIV]    = "DIV",
+    [OP_DIVU]   = "DIVU",
+    [OP_LT]     = "LT",
+    [OP_LE]     = "LE",
+    [OP_EQ]     = "EQ",
+    [OP_NE]     = "NE",
+    [OP_LTU]    = "LTU",
+    [OP_LEU]    = "LEU",
+    [OP_ADDI]   = "ADDI",
+    [OP_SUBI]   = "SUBI",
+    [OP_MULI]   = "MULI",
+    [OP_DIVI]   = "DIVI",
+    [OP_NEG]    = "NEG",
+    [OP_NARROW] = "NARROW",
+    [OP_JUMP]   = "JUMP",
+    [OP_JUMPZ]  = "JUMPZ",
+    [OP_JUMPNZ] = "JUMPNZ",
+    [OP_CALL]   = "CALL",
+    [OP_RETURN] = "RETURN",
+};
+
+static void* grow(void* array, uint32_t* capacity, size_t element_size) {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, element_size * *capacity);
+    if (!array) {
+        fprintf(stderr, "Out of memory compiling bytecode\n");
+        exit(1);
+    }
+    return array;
+}
+
+
+/*
+    Lowering
+*/
+typedef struct Lowering {
+    VmProgram* program;
+    VmFunction* function;   // Function being lowered
+    FILE* errors;
+    int error_count;
+
+    int* locals;            // Local slot (see symbols.h) -> its register, or -1 before it's declared
+    uint32_t local_capacity;
+    int registers;          // Next free register
+} Lowering;
+
+static void error(Lowering* lowering, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(lowering->errors, format, arguments);
+    va_end(arguments);
+    lowering->error_count++;
+}
+
+static uint32_t emit(Lowering* lowering, VmInstruction instruction) {
+    VmFunction* function = lowering->function;
+    if (function->count == function->capacity)
+        function->code = grow(function->code, &function->capacity, sizeof(VmInstruction));
+    function->code[function->count] = instruction;
+    return function->count++;
+}
+
+// Point the jump at `at` to the next instruction
+static void patch(Lowering* lowering, uint32_t at) {
+    lowering->function->code[at].index = lowering->function->count;
+}
+
+static int new_register(Lowering* lowering) {
+    int reg = lowering->registers++;
+    if (reg >= VM_MAX_REGISTERS) {
+        if (reg == VM_MAX_REGISTERS) error(lowering, "Function '%s' needs more than %d registers\n",
+            lowering->function->name ? lowering->function->name : "(top level)", VM_MAX_REGISTERS);
+        return 0;
+    }
+    if ((uint32_t)lowering->registers > lowering->function->registers) lowering->function->registers = lowering->registers;
+    return reg;
+}
+
+// Register of the local `node` names, or -1 (a global, or one not declared yet)
+static int find_local(Lowering* lowering, const Node* node) {
+    if (node->depth <= 0) return -1;
+    while ((uint32_t)node->slot >= lowering->local_capacity) {
+        uint32_t old = lowering->local_capacity;
+        lowering->locals = grow(lowering->locals, &lowering->local_capacity, sizeof(int));
+        memset(lowering->locals + old, -1, sizeof(int) * (lowering->local_capacity - old));
+    }
+    return lowering->locals[node->slot];
+}
+
+// Reuse the registers of the block being left (its locals can't be named after it)
+static void leave_block(Lowering* lowering, int registers) {
+    lowering->registers = registers;
+}
+
+
+/*
+    Expressions
+*/
+static void expression_into(Lowering* lowering, const Node* node, int dest);
+
+// A register holding the value of `node`: the local itself, or a new temporary
+static int value_register(Lowering* lowering, const Node* node) {
+    if (node && node->node == AST_IDENTIFIER) {
+        int reg = find_local(lowering, node);
+        if (reg >= 0) return reg;
+    }
+    int reg = new_register(lowering);
+    expression_into(lowering, node, reg);
+    return reg;
+}
+
+static void load_constant(Lowering* lowering, long value, int dest) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        emit(lowering, (VmInstruction){ .op = OP_LOADI, .a = dest, .immediate = (int32_t)value });
+        return;
+    }
+
+    VmProgram* program = lowering->program;
+    uint32_t capacity = program->constant_count;
+    if ((capacity & (capacity - 1)) == 0) {     // Sizes go 0, 1, 2, 4, ...
+        capacity = capacity ? capacity * 2 : 1;
+        program->constants = realloc(program->constants, sizeof(long) * capacity);
+        if (!program->constants) {
+            fprintf(stderr, "Out of memory compiling bytecode\n");
+            exit(1);
+        }
+    }
+    program->constants[program->constant_count] = value;
+    emit(lowering, (VmInstruction){ .op = OP_LOADK, .a = dest, .index = program->constant_count++ });
+}
+
+static void binop(Lowering* lowering, const Node* node, int dest) {
+    VmOpcode op, small_op = OP_COUNT;  // None
+    int swap = 0;
+    switch (node->op) {
+        case '+': op = OP_ADD; small_op = OP_ADDI; break;
+        case '-': op = OP_SUB; small_op = OP_SUBI; break;
+        case '*': op = OP_MUL; small_op = OP_MULI; break;
+        case '/': op = OP_DIV; small_op = OP_DIVI; break;
+        case '<':                   op = OP_LT; break;
+        case '>':                   op = OP_LT; swap = 1; break;
+        case AST_OP_LESS_EQUAL:     op = OP_LE; break;
+        case AST_OP_GREATER_EQUAL:  op = OP_LE; swap = 1; break;
+        case AST_OP_EQUAL:          op = OP_EQ; break;
+        case AST_OP_NOT_EQUAL:      op = OP_NE; break;
+        default:  error(lowering, "Unknown operator '%c'\n", node->op); return;
+    }
+    if (type_unsigned_operands(node)) {
+        if (op == OP_DIV) op = OP_DIVU;
+        else if (op == OP_LT) op = OP_LTU;
+        else if (op == OP_LE) op = OP_LEU;
+    }
+
+    const Node* left = node->children_count > 0 ? node->children[0] : NULL;
+    const Node* right = node->children_count > 1 ? node->children[1] : NULL;
+    int registers = lowering->registers;
+    int b = value_register(lowering, left);
+
+    // A constant right operand goes in the instruction (signed division only by one that can't trap or overflow)
+    if (right && right->node == AST_INTEGER && right->value >= INT16_MIN && right->value <= INT16_MAX
+        && small_op != OP_COUNT && op != OP_DIVU && !(op == OP_DIV && (right->value == 0 || right->value == -1))) {
+        emit(lowering, (VmInstruction){ .op = small_op, .a = dest, .b = b, .small = (int16_t)right->value });
+    } else {
+        int c = value_register(lowering, right);
+        emit(lowering, (VmInstruction){ .op = op, .a = dest, .b = swap ? c : b, .c = swap ? b : c });
+    }
+    lowering->registers = registers;
+}
+
+// Evaluate `node` into register `dest`
+static void expression_into(Lowering* lowering, const Node* node, int dest) {
+    if (!node) { error(lowering, "Missing expression\n"); return; }
+
+    switch (node->node) {
+        case AST_INTEGER:
+            load_constant(lowering, node->value, dest);
+            break;
+
+        case AST_IDENTIFIER: {
+            int reg = find_local(lowering, node);
+            if (reg >= 0) {
+                if (reg != dest) emit(lowering, (VmInstruction){ .op = OP_MOVE, .a = dest, .b = reg });
+                break;
+            }
+            emit(lowering, (VmInstruction){ .op = OP_GETG, .a = dest, .index = node->slot });
+            break;
+        }
+
+        case AST_UNARY: {
+            int registers = lowering->registers;
+            int b = value_register(lowering, node->children_count > 0 ? node->children[0] : NULL);
+            emit(lowering, (VmInstruction){ .op = OP_NEG, .a = dest, .b = b });
+            lowering->registers = registers;
+            break;
+        }
+
+        case AST_BINOP:
+            binop(lowering, node, dest);
+            break;
+
+        default:
+            error(lowering, "Expected an expression, found %s\n", ast_node_type_name(node->node));
+            break;
+    }
+}
+
+
+/*
+    Statements
+*/
+static void statement(Lowering* lowering, const Node* node);
+
+static void block(Lowering* lowering, const Node* node) {
+    int registers = lowering->registers;
+    for (int i = 0; i < node->children_count; i++) statement(lowering, node->children[i]);
+    leave_block(lowering, registers);
+}
+
+// Wrap the value in `reg` to the width of `variable`, unless it fits already
+static void narrow(Lowering* lowering, const Node* variable, const Node* value, int reg) {
+    if (type_narrows((IntType)variable->type, value))
+        emit(lowering, (VmInstruction){ .op = OP_NARROW, .a = reg, .b = reg, .c = (uint16_t)variable->type });
+}
+
+static void let(Lowering* lowering, const Node* node) {
+    const Node* variable = node->children[0];
+    const Node* value = node->children_count > 1 ? node->children[1] : NULL;
+
+    if (variable->depth == 0) {
+        int registers = lowering->registers;
+        int reg;
+        if (type_narrows((IntType)variable->type, value)) {
+            reg = new_register(lowering);
+            expression_into(lowering, value, reg);
+            narrow(lowering, variable, value, reg);
+        } else {
+            reg = value_register(lowering, value);
+        }
+        emit(lowering, (VmInstruction){ .op = OP_SETG, .a = reg, .index = variable->slot });
+        lowering->registers = registers;
+        return;
+    }
+
+    int reg = find_local(lowering, variable);
+    if (reg >= 0) {
+        expression_into(lowering, value, reg);
+        narrow(lowering, variable, value, reg);
+        return;
+    }
+
+    // A new local, not visible in its own initializer
+    reg = new_register(lowering);
+    expression_into(lowering, value, reg);
+    narrow(lowering, variable, value, reg);
+    lowering->locals[variable->slot] = reg;
+}
+
+static void statement(Lowering* lowering, const Node* node) {
+    if (!node) return;
+    int registers = lowering->registers;
+
+    switch (node->node) {
+        case AST_LET:
+            let(lowering, node);
+            return;     // Keeps the register of a new local
+
+        case AST_IF: {
+            int condition = value_register(lowering, node->condition);
+            uint32_t skip = emit(lowering, (VmInstruction){ .op = OP_JUMPZ, .a = condition });
+            lowering->registers = registers;
+            block(lowering, node);
+            patch(lowering, skip);
+            break;
+        }
+
+        case AST_WHILE: {
+            // The test goes at the bottom, so each iteration takes one branch
+            uint32_t enter = emit(lowering, (VmInstruction){ .op = OP_JUMP });
+            uint32_t body = lowering->function->count;
+            block(lowering, node);
+            patch(lowering, enter);
+            int condition = value_register(lowering, node->condition);
+            emit(lowering, (VmInstruction){ .op = OP_JUMPNZ, .a = condition, .index = body });
+            break;
+        }
+
+        case AST_RETURN: {
+            int reg = value_register(lowering, node->children_count > 0 ? node->children[0] : NULL);
+            emit(lowering, (VmInstruction){ .op = OP_RETURN, .a = reg });
+            break;
+        }
+
+        case AST_FUNC:
+            error(lowering, "Function '%s' must be defined at the top level\n", node->children[0]->name);
+            break;
+
+        default:
+            value_register(lowering, node);     // Only for its effect (a division may trap)
+            break;
+    }
+    lowering->registers = registers;
+}
+
+static VmFunction* begin_function(Lowering* lowering, uint32_t index, const char* name) {
+    VmFunction* function = &lowering->program->functions[index];
+    *function = (VmFunction){ name, NULL, 0, 0, 0 };
+    lowering->function = function;
+    lowering->registers = 0;
+    if (lowering->locals) memset(lowering->locals, -1, sizeof(int) * lowering->local_capacity);
+    return function;
+}
+
+// Falling off the end returns 0
+static void end_function(Lowering* lowering) {
+    int reg = new_register(lowering);
+    emit(lowering, (VmInstruction){ .op = OP_LOADI, .a = reg, .immediate = 0 });
+    emit(lowering, (VmInstruction){ .op = OP_RETURN, .a = reg });
+}
+
+
+/*
+    Lower a whole program into `program`, once resolve_names has gone over
+    it without errors. Problems are reported to `errors`; returns how many
+    there were (the program can't be run unless 0). vm_program_free
+    releases it either way.
+*/
+int vm_compile(VmProgram* program, const Node* ast, FILE* errors) {
+    memset(program, 0, sizeof(*program));
+    Lowering lowering = { 0 };
+    lowering.program = program;
+    lowering.errors = errors;
+
+    // Functions and globals are numbered already; only their counts are needed
+    program->function_count = 1;
+    for (int i = 0; i < ast->children_count; i++) {
+        const Node* node = ast->children[i];
+        if (!node || (node->node != AST_FUNC && node->node != AST_LET)) continue;
+
+        uint32_t* count = node->node == AST_FUNC ? &program->function_count : &program->global_count;
+        if (node->children[0]->slot >= (int)*count) *count = (uint32_t)node->children[0]->slot + 1;
+    }
+
+    program->functions = calloc(program->function_count, sizeof(VmFunction));
+    if (!program->functions) {
+        fprintf(stderr, "Out of memory compiling bytecode\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < ast->children_count; i++) {
+        const Node* node = ast->children[i];
+        if (!node || node->node != AST_FUNC) continue;
+
+        const Node* name = node->children[0];
+        if (name->slot < 0) continue;   // A duplicate, already reported
+
+        begin_function(&lowering, (uint32_t)name->slot, name->name);
+        for (int k = 1; k < node->children_count; k++) statement(&lowering, node->children[k]);
+        end_function(&lowering);
+    }
+
+    // The top level, then main
+    begin_function(&lowering, 0, NULL);
+    for (int i = 0; i < ast->children_count; i++) {
+        const Node* node = ast->children[i];
+        if (node && node->node != AST_FUNC) statement(&lowering, node);
+    }
+    leave_block(&lowering, 0);
+
+    if (ast->slot > 0) {    // main, found by resolve_names
+        int reg = new_register(&lowering);
+        emit(&lowering, (VmInstruction){ .op = OP_CALL, .a = reg, .index = (uint32_t)ast->slot });
+        emit(&lowering, (VmInstruction){ .op = OP_RETURN, .a = reg });
+    } else {
+        end_function(&lowering);
+    }
+
+    free(lowering.locals);
+    return lowering.error_count;
+}
+
+void vm_program_free(VmProgram* program) {
+    for (uint32_t i = 0; i < program->function_count; i++)
+        if (program->functions) free(program->functions[i].code);
+    free(program->functions);
+    free(program->constants);
+    memset(program, 0, sizeof(*program));
+}
+
+
+/*
+    Interpreter
+*/
+typedef struct Frame {
+    const VmFunction* function;
+    const VmInstruction* resume;    // Caller's next instruction
+    size_t base;                    // Caller's register window
+    uint16_t dest;                  // Caller's register for the result
+} Frame;
+
+// Same results as sr_add & co. in the generated code
+static inline long wrap_add(long a, long b) { return (long)((unsigned long)a + (unsigned long)b); }
+static inline long wrap_sub(long a, long b) { return (long)((unsigned long)a - (unsigned long)b); }
+static inline long wrap_mul(long a, long b) { return (long)((unsigned long)a * (unsigned long)b); }
+static inline long wrap_neg(long a) { return (long)(0ul - (unsigned long)a); }
+
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_COMPUTED_GOTO
+#endif
+
+/*
+    Run `program`. Its result is stored in `result` and 0 returned, or a
+    trap (division by zero, runaway calls) is reported to `errors` and 1
+    returned, the exit status the generated C would have.
+*/
+int vm_run(const VmProgram* program, long* result, FILE* errors) {
+#ifdef VM_COMPUTED_GOTO
+    static const void* labels[OP_COUNT] = {
+        [OP_MOVE] = &&op_MOVE, [OP_LOADI] = &&op_LOADI, [OP_LOADK] = &&op_LOADK,
+        [OP_GETG] = &&op_GETG, [OP_SETG] = &&op_SETG,
+        [OP_ADD] = &&op_ADD, [OP_SUB] = &&op_SUB, [OP_MUL] = &&op_MUL, [OP_DIV] = &&op_DIV, [OP_DIVU] = &&op_DIVU,
+        [OP_LT] = &&op_LT, [OP_LE] = &&op_LE, [OP_EQ] = &&op_EQ, [OP_NE] = &&op_NE, [OP_LTU] = &&op_LTU, [OP_LEU] = &&op_LEU,
+        [OP_ADDI] = &&op_ADDI, [OP_SUBI] = &&op_SUBI, [OP_MULI] = &&op_MULI, [OP_DIVI] = &&op_DIVI,
+        [OP_NEG] = &&op_NEG, [OP_NARROW] = &&op_NARROW, [OP_JUMP] = &&op_JUMP, [OP_JUMPZ] = &&op_JUMPZ, [OP_JUMPNZ] = &&op_JUMPNZ,
+        [OP_CALL] = &&op_CALL, [OP_RETURN] = &&op_RETURN,
+    };
+    #define DISPATCH()  goto *labels[pc->op]
+    #define CASE(name)  op_##name:
+#else
+    #define DISPATCH()  goto dispatch
+    #define CASE(name)  case OP_##name:
+#endif
+    #define NEXT()      do { pc++; DISPATCH(); } while (0)
+
+    int status = 0;
+    long* globals = calloc(program->global_count ? program->global_count : 1, sizeof(long));
+    Frame* frames = malloc(sizeof(Frame) * VM_MAX_FRAMES);
+    size_t stack_size = program->functions[0].registers + 256;
+    long* stack = malloc(sizeof(long) * stack_size);
+    if (!globals || !frames || !stack) {
+        fprintf(stderr, "Out of memory running bytecode\n");
+        exit(1);
+    }
+
+    const VmFunction* function = &program->functions[0];
+    const VmInstruction* code = function->code;
+    const VmInstruction* pc = code;
+    size_t base = 0;
+    long* R = stack;
+    int depth = 0;
+
+    DISPATCH();
+#ifndef VM_COMPUTED_GOTO
+dispatch:
+    switch ((VmOpcode)pc->op) {
+#endif
+    CASE(MOVE)   R[pc->a] = R[pc->b]; NEXT();
+    CASE(LOADI)  R[pc->a] = pc->immediate; NEXT();
+    CASE(LOADK)  R[pc->a] = program->constants[pc->index]; NEXT();
+    CASE(GETG)   R[pc->a] = globals[pc->index]; NEXT();
+    CASE(SETG)   globals[pc->index] = R[pc->a]; NEXT();
+
+    CASE(ADD)    R[pc->a] = wrap_add(R[pc->b], R[pc->c]); NEXT();
+    CASE(SUB)    R[pc->a] = wrap_sub(R[pc->b], R[pc->c]); NEXT();
+    CASE(MUL)    R[pc->a] = wrap_mul(R[pc->b], R[pc->c]); NEXT();
+    CASE(DIV) {
+        long divisor = R[pc->c];
+        if (divisor == 0) goto divide_by_zero;
+        R[pc->a] = divisor == -1 ? wrap_neg(R[pc->b]) : R[pc->b] / divisor;
+        NEXT();
+    }
+    CASE(DIVU) {
+        unsigned long divisor = (unsigned long)R[pc->c];
+        if (divisor == 0) goto divide_by_zero;
+        R[pc->a] = (long)((unsigned long)R[pc->b] / divisor);
+        NEXT();
+    }
+    CASE(LT)     R[pc->a] = R[pc->b] < R[pc->c]; NEXT();
+    CASE(LE)     R[pc->a] = R[pc->b] <= R[pc->c]; NEXT();
+    CASE(EQ)     R[pc->a] = R[pc->b] == R[pc->c]; NEXT();
+    CASE(NE)     R[pc->a] = R[pc->b] != R[pc->c]; NEXT();
+    CASE(LTU)    R[pc->a] = (unsigned long)R[pc->b] < (unsigned long)R[pc->c]; NEXT();
+    CASE(LEU)    R[pc->a] = (unsigned long)R[pc->b] <= (unsigned long)R[pc->c]; NEXT();
+
+    CASE(ADDI)   R[pc->a] = wrap_add(R[pc->b], pc->small); NEXT();
+    CASE(SUBI)   R[pc->a] = wrap_sub(R[pc->b], pc->small); NEXT();
+    CASE(MULI)   R[pc->a] = wrap_mul(R[pc->b], pc->small); NEXT();
+    CASE(DIVI)   R[pc->a] = R[pc->b] / pc->small; NEXT();
+    CASE(NEG)    R[pc->a] = wrap_neg(R[pc->b]); NEXT();
+    CASE(NARROW) R[pc->a] = type_wrap((IntType)pc->c, R[pc->b]); NEXT();
+
+    CASE(JUMP)   pc = code + pc->index; DISPATCH();
+    CASE(JUMPZ)  pc = R[pc->a] == 0 ? code + pc->index : pc + 1; DISPATCH();
+    CASE(JUMPNZ) pc = R[pc->a] != 0 ? code + pc->index : pc + 1; DISPATCH();
+
+    CASE(CALL) {
+        if (depth == VM_MAX_FRAMES) {
+            fprintf(errors, "serrate: too many nested calls\n");
+            status = 1;
+            goto done;
+        }
+        frames[depth++] = (Frame){ function, pc + 1, base, pc->a };
+
+        base += function->registers;
+        function = &program->functions[pc->index];
+        if (base + function->registers > stack_size) {
+            stack_size = (base + function->registers) * 2;
+            stack = realloc(stack, sizeof(long) * stack_size);
+            if (!stack) {
+                fprintf(stderr, "Out of memory running bytecode\n");
+                exit(1);
+            }
+        }
+        R = stack + base;
+        code = function->code;
+        pc = code;
+        DISPATCH();
+    }
+
+    CASE(RETURN) {
+        long value = R[pc->a];
+        if (depth == 0) {
+            *result = value;
+            goto done;
+        }
+
+        const Frame* frame = &frames[--depth];
+        function = frame->function;
+        code = function->code;
+        pc = frame->resume;
+        base = frame->base;
+        R = stack + base;
+        R[frame->dest] = value;
+        DISPATCH();
+    }
+#ifndef VM_COMPUTED_GOTO
+    default:
+        fprintf(errors, "serrate: bad opcode %d\n", pc->op);
+        status = 1;
+        goto done;
+    }
+#endif
+
+divide_by_zero:
+    fputs("serrate: division by zero\n", errors);
+    status = 1;
+
+done:
+    free(globals);
+    free(frames);
+    free(stack);
+    return status;
+
+    #undef DISPATCH
+    #undef CASE
+    #undef NEXT
+}
+
+
+/*
+    Disassembly (--dump-bytecode)
+*/
+static void write_register(Writer* out, char prefix, long reg) {
+    writer_char(out, ' ');
+    writer_char(out, prefix);
+    writer_long(out, reg);
+}
+
+void vm_disassemble(const VmProgram* program, Writer* out) {
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const VmFunction* function = &program->functions[f];
+        if (!function->code) continue;
+
+        writer_string(out, "function ");
+        writer_string(out, function->name ? function->name : "(top level)");
+        writer_string(out, ", ");
+        writer_long(out, function->registers);
+        writer_string(out, " registers\n");
+
+        for (uint32_t i = 0; i < function->count; i++) {
+            const VmInstruction* instruction = &function->code[i];
+            writer_indent(out, 1);
+            writer_long(out, i);
+            writer_string(out, "\t");
+            writer_string(out, opcode_names[instruction->op]);
+
+            switch ((VmOpcode)instruction->op) {
+                case OP_MOVE:
+                case OP_NEG:
+                    write_register(out, 'r', instruction->a);
+                    write_register(out, 'r', instruction->b);
+                    break;
+                case OP_LOADI:
+                    write_register(out, 'r', instruction->a);
+                    writer_char(out, ' ');
+                    writer_long(out, instruction->immediate);
+                    break;
+                case OP_LOADK:
+                    write_register(out, 'r', instruction->a);
+                    writer_char(out, ' ');
+                    writer_long(out, program->constants[instruction->index]);
+                    break;
+                case OP_GETG:
+                case OP_SETG:
+                    write_register(out, 'r', instruction->a);
+                    write_register(out, 'g', instruction->index);
+                    break;
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_DIVU:
+                case OP_LT: case OP_LE: case OP_EQ: case OP_NE: case OP_LTU: case OP_LEU:
+                    write_register(out, 'r', instruction->a);
+                    write_register(out, 'r', instruction->b);
+                    write_register(out, 'r', instruction->c);
+                    break;
+                case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_DIVI:
+                    write_register(out, 'r', instruction->a);
+                    write_register(out, 'r', instruction->b);
+                    writer_char(out, ' ');
+                    writer_long(out, instruction->small);
+                    break;
+                case OP_NARROW:
+                    write_register(out, 'r', instruction->a);
+                    write_register(out, 'r', instruction->b);
+                    writer_char(out, ' ');
+                    writer_string(out, type_name((IntType)instruction->c));
+                    break;
+                case OP_JUMP:
+                    writer_string(out, " -> ");
+                    writer_long(out, instruction->index);
+                    break;
+                case OP_JUMPZ:
+                case OP_JUMPNZ:
+                    write_register(out, 'r', instruction->a);
+                    writer_string(out, " -> ");
+                    writer_long(out, instruction->index);
+                    break;
+                case OP_CALL:
+                    write_register(out, 'r', instruction->a);
+                    writer_char(out, ' ');
+                    writer_string(out, program->functions[instruction->index].name);
+                    break;
+                case OP_RETURN:
+                    write_register(out, 'r', instruction->a);
+                    break;
+                default:
+                    break;
+            }
+            writer_char(out, '\n');
+        }
+    }
+}
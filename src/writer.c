@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+#define WRITER_BUFFER (256 * 1024)
+
+
+// `out` may be NULL to collect everything in memory
+void writer_init(Writer* writer, FILE* out) {
+    writer->out = out;
+    writer->buffer = malloc(WRITER_BUFFER);
+    if (!writer->buffer) {
+        fprintf(stderr, "Out of memory allocating output buffer\n");
+        exit(1);
+    }
+    writer->length = 0;
+    writer->capacity = WRITER_BUFFER;
+}
+
+// In-memory writers: make room for `length` more bytes
+static void reserve(Writer* writer, size_t length) {
+    size_t capacity = writer->capacity ? writer->capacity : WRITER_BUFFER;
+    while (capacity - writer->length < length) capacity *= 2;
+    if (capacity == writer->capacity) return;
+
+    writer->buffer = realloc(writer->buffer, capacity);
+    if (!writer->buffer) {
+        fprintf(stderr, "Out of memory growing output buffer\n");
+        exit(1);
+    }
+    writer->capacity = capacity;
+}
+
+// Hand everything buffered so far to `out` (in-memory writers grow instead)
+void writer_flush(Writer* writer) {
+    if (!writer->out) { reserve(writer, 1); return; }
+    if (writer->length) fwrite(writer->buffer, 1, writer->length, writer->out);
+    writer->length = 0;
+}
+
+// Flush and release the buffer
+void writer_free(Writer* writer) {
+    if (writer->out) {
+        writer_flush(writer);
+        fflush(writer->out);
+    }
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->length = 0;
+    writer->capacity = 0;
+}
+
+// Everything an in-memory writer collected (malloc'd, for the caller to free). The writer is left empty.
+char* writer_take(Writer* writer, size_t* length) {
+    char* text = writer->buffer;
+    *length = writer->length;
+    writer->buffer = NULL;
+    writer->length = 0;
+    writer->capacity = 0;
+    return text;
+}
+
+
+void writer_write(Writer* writer, const char* data, size_t length) {
+    if (writer->length + length > writer->capacity) {
+        if (!writer->out) {
+            reserve(writer, length);
+        } else {
+            writer_flush(writer);
+            if (length > writer->capacity) {    // Too big to buffer, write it straight through
+                fwrite(data, 1, length, writer->out);
+                return;
+            }
+        }
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+// Decimal digits of `value`
+void writer_long(Writer* writer, long value) {
+    char digits[24];
+    int n = sizeof(digits);
+    unsigned long magnitude = value < 0 ? 0ul - (unsigned long)value : (unsigned long)value;
+
+    do {
+        digits[--n] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) digits[--n] = '-';
+
+    writer_write(writer, digits + n, sizeof(digits) - n);
+}
+
+// Two spaces per level, like print_ast
+void writer_indent(Writer* writer, int depth) {
+    for (int i = 0; i < depth; i++) writer_write(writer, "  ", 2);
+}